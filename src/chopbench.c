@@ -0,0 +1,732 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "chopcodec.h"
+#include "chopconn.h"
+#include "chopconst.h"
+#include "chopdata.h"
+#include "chopdebug.h"
+#include "choppacket.h"
+#include "choppool.h"
+#include "choptimer.h"
+
+#define BENCH_WINDOW 255
+#define BENCH_BYTES (64 * 1024 * 1024) // body bytes pushed through each run
+
+#define SCAN_BYTES (256 * 1024 * 1024) // text scanned by each run
+
+#define TIMER_LEAD_MS 10000 // no timer is due sooner, the ticks until then have nothing to do
+#define TIMER_SPAN_MS 60000 // timers are armed up to a minute after that, like idle timeouts
+#define TIMER_REARMS 10 // times every timer is pushed back before it may fire
+
+#define FANOUT_DELIVERIES 4000000 // messages queued on clients by each run
+#define FANOUT_FD_BASE 65536 // clients in the bench own no socket, only an index
+
+#define ACK_REQUESTS 1000000 // acknowledged requests parsed by each run
+
+#define PARSE_PACKETS 2000000 // packets read and dispatched by each run
+#define PARSE_TURN_BYTES 4096 // bytes of whole packets arriving at once
+
+#define ALLOC_PACKETS 2000000 // packets built and destroyed by each run
+
+#define STYLE_CALLS 100000000 // headers packed by each run
+
+const char bench_usage[] = "usage: %s [-j] [-n megabytes] [-s megabytes]\n";
+const char bench_write_result[] = "%-16s segments=%-3d %6.2f syscalls/packet %10.0f packets/s %8.1f MB/s\n";
+const char bench_scan_result[] = "%-16s buffer=%-8d %-7s %10.1f MB/s %6.2fx scalar\n";
+const char bench_fanout_result[] = "%-16s clients=%-6d bytes=%-5d %10.0f deliveries/s %7.1f ns/client %9ld bytes copied/message\n";
+const char bench_ack_result[] = "%-16s pipeline=%-4d %6.3f packets/request %6.3f syscalls/request %6.2f bytes/request %10.0f requests/s\n";
+const char bench_timer_result[] = "%-16s timers=%-8d %7.1f ns/arm %7.1f ns/rearm %7.1f ns/fire %7.1f ns/empty tick %ld misfired\n";
+const char bench_parse_result[] = "%-16s from=%-10s bytes=%-4d %7.1f ns/packet %10.0f packets/s\n";
+const char bench_alloc_result[] = "%-16s segments=%-3d %7.1f ns/packet %10.0f packets/s\n";
+const char bench_style_result[] = "%-16s %7.2f ns/call\n";
+
+/// one JSON object per line, keys in a fixed order so runs can be compared line by line
+const char bench_write_json[] = "{\"bench\": \"%s\", \"segments\": %d, \"syscalls_per_packet\": %.3f, \"packets_per_s\": %.0f, \"mb_per_s\": %.1f}\n";
+const char bench_scan_json[] = "{\"bench\": \"%s\", \"buffer\": %d, \"kernel\": \"%s\", \"mb_per_s\": %.1f, \"vs_scalar\": %.3f}\n";
+const char bench_fanout_json[] = "{\"bench\": \"%s\", \"clients\": %d, \"bytes\": %d, \"deliveries_per_s\": %.0f, \"ns_per_client\": %.1f, \"bytes_copied_per_message\": %ld}\n";
+const char bench_ack_json[] = "{\"bench\": \"%s\", \"pipeline\": %d, \"packets_per_request\": %.3f, \"syscalls_per_request\": %.3f, \"bytes_per_request\": %.2f, \"requests_per_s\": %.0f}\n";
+const char bench_timer_json[] = "{\"bench\": \"%s\", \"timers\": %d, \"ns_per_arm\": %.1f, \"ns_per_rearm\": %.1f, \"ns_per_fire\": %.1f, \"ns_per_empty_tick\": %.1f, \"misfired\": %ld}\n";
+const char bench_parse_json[] = "{\"bench\": \"%s\", \"from\": \"%s\", \"bytes\": %d, \"ns_per_packet\": %.1f, \"packets_per_s\": %.0f}\n";
+const char bench_alloc_json[] = "{\"bench\": \"%s\", \"segments\": %d, \"ns_per_packet\": %.1f, \"packets_per_s\": %.0f}\n";
+const char bench_style_json[] = "{\"bench\": \"%s\", \"ns_per_call\": %.2f}\n";
+
+// results are printed as JSON lines instead of a table
+int json = 0;
+
+/*
+ * Syscall Counting
+ */
+
+// the bench is linked with --wrap=sendmsg so vectored writes can be counted
+long sendmsg_calls = 0;
+
+ssize_t __real_sendmsg(int fd, const struct msghdr *msg, int flags);
+
+ssize_t __wrap_sendmsg(int fd, const struct msghdr *msg, int flags) {
+	sendmsg_calls++;
+	return __real_sendmsg(fd, msg, flags);
+}
+
+long write_calls = 0;
+
+/*
+ * Bench Utility Functions
+ */
+
+double now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Spawns a process that reads and discards everything sent on the returned
+ * socket, so writes never stall on a full socket buffer.
+ */
+int spawn_sink(pid_t *child) {
+	int pair[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+		return -errno;
+	}
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		return -errno;
+	} else if (pid == 0) {
+		close(pair[0]);
+		char discard[65536];
+		while (read(pair[1], discard, sizeof(discard)) > 0);
+		_exit(0);
+	}
+
+	close(pair[1]);
+	*child = pid;
+	return pair[0];
+}
+
+void reap_sink(int fd, pid_t child) {
+	close(fd);
+	waitpid(child, NULL, 0);
+}
+
+int build_text_packet(struct packet **out, const int segments) {
+	if (init_packet_struct(out) < 0) {
+		return -ENOMEM;
+	}
+	assemble_header(*out, 0, START_TEXT, segments, BENCH_WINDOW);
+
+	char fill[BENCH_WINDOW];
+	memset(fill, 'x', sizeof(fill));
+	for (int i = 0; i < segments; i++) {
+		if (append_data(*out, fill, BENCH_WINDOW, BENCH_WINDOW) < 0) {
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
+/*
+ * The write path as it was before vectored writes: one write for the header
+ * and one more for every data segment.
+ */
+int legacy_write_packet(struct client *cli, struct packet *pack) {
+	char header[HEADER_LEN];
+	codec_encode_header(header, HEADER_LEN, pack->head, pack->status, pack->control1, pack->control2);
+
+	int total = 0;
+	write_calls++;
+	if (write(cli->socket_fd, header, HEADER_LEN) != HEADER_LEN) {
+		total = -1;
+	}
+
+	struct buffer *segment;
+	for (segment = pack->data; segment != NULL && total >= 0; segment = segment->next) {
+		write_calls++;
+		if (write(cli->socket_fd, segment->buf, segment->inbuf) != segment->inbuf) {
+			total = -1;
+			break;
+		}
+		total += segment->inbuf;
+	}
+
+	destroy_packet_struct(&pack);
+	return total;
+}
+
+/*
+ * The write path as it is: the packet is queued and the queue written with
+ * vectored sends, waiting here for room the way the event loop would.
+ */
+int queued_write_packet(struct client *cli, struct packet *pack) {
+	int total = pack->datasize;
+	if (enqueue_packet(cli, pack) < 0) {
+		destroy_packet_struct(&pack);
+		return -1;
+	}
+
+	int ret;
+	while ((ret = flush_queue(cli)) == 1) {
+		struct pollfd wait = {cli->socket_fd, POLLOUT, 0};
+		poll(&wait, 1, -1);
+	}
+	return (ret < 0) ? ret : total;
+}
+
+/*
+ * Benchmarks
+ */
+
+int bench_write(const char *name, int (*writer)(struct client *, struct packet *), long *calls, const int segments, const long bytes) {
+	struct client *cli;
+	if (init_client_struct(&cli, BENCH_WINDOW) < 0) {
+		return -ENOMEM;
+	}
+
+	pid_t child;
+	int fd = spawn_sink(&child);
+	if (fd < 0) {
+		destroy_client_struct(&cli);
+		return fd;
+	}
+	cli->socket_fd = fd;
+
+	long packets = bytes / (segments * BENCH_WINDOW) + 1;
+	*calls = 0;
+
+	double start = now_seconds();
+	for (long i = 0; i < packets; i++) {
+		// each writer takes ownership of the packet it is given
+		struct packet *pack;
+		if (build_text_packet(&pack, segments) < 0 || writer(cli, pack) < 0) {
+			fprintf(stderr, "%s: write failed\n", name);
+			break;
+		}
+	}
+	double elapsed = now_seconds() - start;
+
+	long sent = packets * (segments * BENCH_WINDOW + HEADER_LEN);
+	printf(json ? bench_write_json : bench_write_result, name, segments, (double) *calls / packets, packets / elapsed, sent / elapsed / (1024 * 1024));
+
+	reap_sink(cli->socket_fd, child);
+	cli->socket_fd = -1;
+	destroy_client_struct(&cli);
+	return 0;
+}
+
+/*
+ * Scans text for END_TEXT or a newline in buffers of the given size, with the
+ * symbol only in the last byte of each buffer so every byte is examined.
+ * Returns the throughput in MB/s.
+ */
+double bench_scan(const char *name, const char *kernel, const int size, const long bytes) {
+	if (select_scan_kernel(kernel) < 0) {
+		return 0;
+	}
+
+	// text with the symbol closing every buffer
+	char *text = (char *) malloc(size);
+	if (text == NULL) {
+		return 0;
+	}
+	for (int i = 0; i < size; i++) {
+		text[i] = 'a' + i % 26;
+	}
+	char symbol = (strcmp(name, "scan newline") == 0) ? '\n' : END_TEXT;
+	text[size - 1] = symbol;
+
+	long passes = bytes / size + 1;
+	long found = 0;
+
+	double start = now_seconds();
+	for (long i = 0; i < passes; i++) {
+		if (symbol == '\n') {
+			found += find_newline(text, size);
+		} else {
+			found += buf_contains_symbol(text, size, symbol);
+		}
+	}
+	double elapsed = now_seconds() - start;
+
+	free(text);
+
+	// every pass must find the symbol, otherwise the kernel is wrong
+	if (found != passes * (size - 1)) {
+		fprintf(stderr, "%s: %s found wrong index\n", name, kernel);
+		return 0;
+	}
+	return passes * (double) size / elapsed / (1024 * 1024);
+}
+
+/*
+ * Timer Wheel Bench
+ */
+
+// wheels in the bench run on simulated time, advanced one tick at a time
+long bench_clock_ms = 0;
+
+long bench_clock(void) {
+	return bench_clock_ms;
+}
+
+struct bench_timer {
+	struct timer timer;
+	long due_ms; // when the timer was last asked to fire
+};
+
+long timers_misfired = 0;
+
+void bench_timer_fired(struct timer_wheel *wheel, struct timer *timer) {
+	struct bench_timer *cur = (struct bench_timer *) timer->arg;
+
+	// firing early, or more than a tick late, is wrong
+	if (bench_clock_ms < cur->due_ms || bench_clock_ms >= cur->due_ms + wheel->tick_ms) {
+		timers_misfired++;
+	}
+}
+
+/*
+ * Arms count timers across a minute, pushes each of them back several times
+ * as an idle timeout is on every read, then runs the wheel through the ticks
+ * before any is due and on until all fired.
+ */
+int bench_timers(const char *name, const int count) {
+	struct bench_timer *timers = (struct bench_timer *) calloc(count, sizeof(struct bench_timer));
+	struct timer_wheel *wheel;
+	bench_clock_ms = 0;
+	if (timers == NULL || init_timer_wheel(&wheel, TIMER_TICK_MS, bench_clock) < 0) {
+		free(timers);
+		return -ENOMEM;
+	}
+	srand(1);
+	timers_misfired = 0;
+
+	double start = now_seconds();
+	for (int i = 0; i < count; i++) {
+		timer_setup(&(timers[i].timer), bench_timer_fired, timers + i);
+		timers[i].due_ms = TIMER_LEAD_MS + rand() % TIMER_SPAN_MS;
+		timer_arm(wheel, &(timers[i].timer), timers[i].due_ms);
+	}
+	double arm = now_seconds() - start;
+
+	start = now_seconds();
+	for (int round = 0; round < TIMER_REARMS; round++) {
+		for (int i = 0; i < count; i++) {
+			timers[i].due_ms = TIMER_LEAD_MS + rand() % TIMER_SPAN_MS;
+			timer_arm(wheel, &(timers[i].timer), timers[i].due_ms);
+		}
+	}
+	double rearm = now_seconds() - start;
+
+	// stop before the level above brings down the earliest timers
+	long ticks = 0;
+	start = now_seconds();
+	while (bench_clock_ms < TIMER_LEAD_MS - TIMER_SLOTS * TIMER_TICK_MS) {
+		bench_clock_ms += TIMER_TICK_MS;
+		timer_advance(wheel);
+		ticks++;
+	}
+	double empty = now_seconds() - start;
+
+	// the clock never jumps, so every tick is run on its own
+	start = now_seconds();
+	while (wheel->armed > 0) {
+		bench_clock_ms += TIMER_TICK_MS;
+		timer_advance(wheel);
+	}
+	double fire = now_seconds() - start;
+
+	if (wheel->fired != count) {
+		timers_misfired += count - wheel->fired;
+	}
+	printf(json ? bench_timer_json : bench_timer_result, name, count, arm * 1e9 / count, rearm * 1e9 / ((long) count * TIMER_REARMS), fire * 1e9 / count, empty * 1e9 / ticks, timers_misfired);
+
+	destroy_timer_wheel(&wheel);
+	free(timers);
+	return 0;
+}
+
+/*
+ * Fan-Out Bench
+ */
+
+/*
+ * Queues one message for every client the way broadcasts were written before
+ * fan_out, building and copying a packet for each of them.
+ */
+int copied_send_to_all(struct server *host, const char *msg, const int msg_len) {
+	int delimited = (msg_len > 255);
+	char body[msg_len + 1];
+	memcpy(body, msg, msg_len);
+	body[msg_len] = END_TEXT;
+
+	for (int i = 0; i < host->cur_connections; i++) {
+		if (write_datapack(host->live[i], 0, START_TEXT, delimited ? 0 : 1, delimited ? 0 : msg_len, body, msg_len + delimited) < 0) {
+			return -ENOMEM;
+		}
+	}
+	return host->cur_connections;
+}
+
+/*
+ * Broadcasts messages of the given size to count clients, then lets every
+ * queue go as if its socket took all of it, until each client was handed
+ * FANOUT_DELIVERIES / count messages.
+ */
+int bench_fanout(const char *name, int (*broadcast)(struct server *, const char *, const int), const int count, const int msg_len) {
+	struct server *host;
+	if (init_server_struct(&host, 0, count, 1) < 0) {
+		return -ENOMEM;
+	}
+
+	for (int i = 0; i < count; i++) {
+		if (adopt_client(host, FANOUT_FD_BASE + i, BENCH_WINDOW, NULL) < 0) {
+			destroy_server_struct(&host);
+			return -ENOMEM;
+		}
+	}
+
+	char *msg = (char *) malloc(msg_len);
+	if (msg == NULL) {
+		destroy_server_struct(&host);
+		return -ENOMEM;
+	}
+	memset(msg, 'x', msg_len);
+
+	long rounds = FANOUT_DELIVERIES / count;
+
+	double start = now_seconds();
+	for (long round = 0; round < rounds; round++) {
+		if (broadcast(host, msg, msg_len) != count) {
+			fprintf(stderr, "%s: broadcast failed\n", name);
+			break;
+		}
+		for (int i = 0; i < count; i++) {
+			advance_queue(host->live[i], host->live[i]->out_bytes);
+		}
+	}
+	double elapsed = now_seconds() - start;
+
+	// one shared copy per message, or one packet body per client
+	long copied = (broadcast == copied_send_to_all) ? (long) count * msg_len : msg_len;
+	printf(json ? bench_fanout_json : bench_fanout_result, name, count, msg_len, rounds * count / elapsed, elapsed * 1e9 / (rounds * count), copied);
+
+	// none of the descriptors are real
+	for (int i = 0; i < host->cur_connections; i++) {
+		host->live[i]->socket_fd = -1;
+	}
+	free(msg);
+	destroy_server_struct(&host);
+	return 0;
+}
+
+/*
+ * Acknowledge Bench
+ */
+
+/*
+ * Parses turns of pipeline short texts from a client and writes out what
+ * they are answered with, acknowledged one by one or in blocks as the given
+ * mode says, until ACK_REQUESTS were answered.
+ */
+int bench_acks(const char *name, const int mode, const int pipeline) {
+	pid_t child;
+	int fd = spawn_sink(&child);
+	if (fd < 0) {
+		return fd;
+	}
+
+	struct client *cli;
+	if (init_client_struct(&cli, BENCH_WINDOW) < 0) {
+		reap_sink(fd, child);
+		return -ENOMEM;
+	}
+	cli->socket_fd = fd;
+	cli->ack_mode = mode;
+
+	// one turn worth of requests, as they would arrive in the receive ring
+	const char request[] = {0, START_TEXT, 1, 5, 'h', 'e', 'l', 'l', 'o'};
+	char *turn = (char *) malloc(sizeof(request) * pipeline);
+	if (turn == NULL) {
+		destroy_client_struct(&cli);
+		reap_sink(fd, child);
+		return -ENOMEM;
+	}
+	for (int i = 0; i < pipeline; i++) {
+		memcpy(turn + i * sizeof(request), request, sizeof(request));
+	}
+
+	long turns = ACK_REQUESTS / pipeline;
+	long calls = sendmsg_calls;
+	unsigned int queued = cli->out_seq;
+	double start = now_seconds();
+	for (long i = 0; i < turns; i++) {
+		ring_write(cli->recv, turn, sizeof(request) * pipeline);
+		parse_stream(cli);
+		flush_queue(cli);
+	}
+	double elapsed = now_seconds() - start;
+
+	long requests = turns * pipeline;
+	printf(json ? bench_ack_json : bench_ack_result, name, pipeline, (double) (cli->out_seq - queued) / requests, (double) (sendmsg_calls - calls) / requests, (double) cli->bytes_out / requests, requests / elapsed);
+
+	free(turn);
+	cli->socket_fd = -1;
+	destroy_client_struct(&cli);
+	reap_sink(fd, child);
+	return 0;
+}
+
+/*
+ * Parse Bench
+ */
+
+/*
+ * Reads turns of the given request and parses them, every header taken off
+ * the receive ring and dispatched to its handler, until PARSE_PACKETS were
+ * parsed. The turns either come through a socketpair or are put in the ring
+ * directly, leaving the dispatch alone. Answers are let go as if written.
+ */
+int bench_parse(const char *name, const int from_socket, const char *request, const int request_len) {
+	int pair[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+		return -errno;
+	}
+
+	struct client *cli;
+	if (init_client_struct(&cli, BENCH_WINDOW) < 0) {
+		close(pair[0]);
+		close(pair[1]);
+		return -ENOMEM;
+	}
+	cli->socket_fd = pair[0];
+
+	// whole requests only, so every turn leaves the ring empty
+	int per_turn = PARSE_TURN_BYTES / request_len;
+	int turn_len = per_turn * request_len;
+	char *turn = (char *) malloc(turn_len);
+	if (turn == NULL) {
+		cli->socket_fd = -1;
+		destroy_client_struct(&cli);
+		close(pair[0]);
+		close(pair[1]);
+		return -ENOMEM;
+	}
+	for (int i = 0; i < per_turn; i++) {
+		memcpy(turn + i * request_len, request, request_len);
+	}
+
+	long turns = PARSE_PACKETS / per_turn;
+	long parsed = 0;
+	double start = now_seconds();
+	for (long i = 0; i < turns; i++) {
+		if (from_socket) {
+			if (write(pair[1], turn, turn_len) != turn_len || fill_ring(cli) < 0) {
+				fprintf(stderr, "%s: read failed\n", name);
+				break;
+			}
+		} else {
+			ring_write(cli->recv, turn, turn_len);
+		}
+
+		int got = parse_stream(cli);
+		if (got < 0) {
+			fprintf(stderr, "%s: parse failed\n", name);
+			break;
+		}
+		parsed += got;
+		advance_queue(cli, cli->out_bytes);
+	}
+	double elapsed = now_seconds() - start;
+
+	if (parsed > 0) {
+		printf(json ? bench_parse_json : bench_parse_result, name, from_socket ? "socketpair" : "ring", request_len, elapsed * 1e9 / parsed, parsed / elapsed);
+	}
+
+	free(turn);
+	cli->socket_fd = -1;
+	destroy_client_struct(&cli);
+	close(pair[0]);
+	close(pair[1]);
+	return 0;
+}
+
+/*
+ * Packet Churn Bench
+ */
+
+/*
+ * Builds packets of the given number of segments and destroys them again,
+ * from the pool if one is given, or malloc otherwise.
+ */
+int bench_alloc(const char *name, struct pool *pool, const int segments) {
+	long packets = ALLOC_PACKETS / segments;
+
+	double start = now_seconds();
+	for (long i = 0; i < packets; i++) {
+		struct packet *pack;
+		if (pool_alloc_packet(pool, &pack) < 0) {
+			fprintf(stderr, "%s: alloc failed\n", name);
+			return -ENOMEM;
+		}
+		for (int j = 0; j < segments; j++) {
+			if (append_buffer(pack, BENCH_WINDOW, NULL) < 0) {
+				fprintf(stderr, "%s: alloc failed\n", name);
+				destroy_packet_struct(&pack);
+				return -ENOMEM;
+			}
+		}
+		destroy_packet_struct(&pack);
+	}
+	double elapsed = now_seconds() - start;
+
+	printf(json ? bench_alloc_json : bench_alloc_result, name, segments, elapsed * 1e9 / packets, packets / elapsed);
+	return 0;
+}
+
+/*
+ * Packet Style Bench
+ */
+
+// summed so the calls cannot be left out
+volatile int style_sum = 0;
+
+int bench_style(const char *name) {
+	struct packet *pack;
+	if (init_packet_struct(&pack) < 0) {
+		return -ENOMEM;
+	}
+
+	int sum = 0;
+	double start = now_seconds();
+	for (long i = 0; i < STYLE_CALLS; i++) {
+		pack->status = (pack_stat) i;
+		sum += packet_style(pack);
+	}
+	double elapsed = now_seconds() - start;
+	style_sum = sum;
+
+	printf(json ? bench_style_json : bench_style_result, name, elapsed * 1e9 / STYLE_CALLS);
+
+	destroy_packet_struct(&pack);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	// parse command line options
+	int opt;
+	long bytes = BENCH_BYTES;
+	long scan_bytes = SCAN_BYTES;
+	while ((opt = getopt(argc, argv, "jn:s:")) != -1) {
+		switch (opt) {
+			case 'j':
+				json = 1;
+				break;
+
+			case 'n':
+				bytes = strtol(optarg, NULL, 10) * 1024 * 1024;
+				if (bytes < 1) {
+					fprintf(stderr, bench_usage, argv[0]);
+					exit(1);
+				}
+				break;
+
+			case 's':
+				scan_bytes = strtol(optarg, NULL, 10) * 1024 * 1024;
+				if (scan_bytes < 1) {
+					fprintf(stderr, bench_usage, argv[0]);
+					exit(1);
+				}
+				break;
+
+			default:
+				fprintf(stderr, bench_usage, argv[0]);
+				exit(1);
+		}
+	}
+
+	// writes to an exited sink should fail, not kill the bench
+	signal(SIGPIPE, SIG_IGN);
+
+	const int segment_counts[] = {1, 4, 10, 64, 255};
+	for (int i = 0; i < (int) (sizeof(segment_counts) / sizeof(segment_counts[0])); i++) {
+		bench_write("write legacy", legacy_write_packet, &write_calls, segment_counts[i], bytes);
+		bench_write("write vectored", queued_write_packet, &sendmsg_calls, segment_counts[i], bytes);
+	}
+
+	// compare every supported scanning kernel against the scalar loop
+	const char *scans[] = {"scan END_TEXT", "scan newline"};
+	const char *kernels[] = {"scalar", "sse2", "avx2"};
+	const int scan_sizes[] = {16, 64, 255, 4096, 65536, 1048576};
+	for (int i = 0; i < 2; i++) {
+		for (int j = 0; j < (int) (sizeof(scan_sizes) / sizeof(scan_sizes[0])); j++) {
+			double scalar = 0;
+			for (int k = 0; k < 3; k++) {
+				double rate = bench_scan(scans[i], kernels[k], scan_sizes[j], scan_bytes);
+				if (rate <= 0) {
+					continue;
+				}
+				if (k == 0) {
+					scalar = rate;
+				}
+				printf(json ? bench_scan_json : bench_scan_result, scans[i], scan_sizes[j], kernels[k], rate, rate / scalar);
+			}
+		}
+	}
+
+	// a tick with nothing due must not cost more with more timers armed
+	const int timer_counts[] = {1000, 100000, 1000000};
+	for (int i = 0; i < (int) (sizeof(timer_counts) / sizeof(timer_counts[0])); i++) {
+		bench_timers("timer wheel", timer_counts[i]);
+	}
+
+	// a broadcast costs one copy however many clients receive it
+	const int fanout_counts[] = {1000, 10000};
+	const int fanout_sizes[] = {64, 4096};
+	for (int i = 0; i < (int) (sizeof(fanout_counts) / sizeof(fanout_counts[0])); i++) {
+		for (int j = 0; j < (int) (sizeof(fanout_sizes) / sizeof(fanout_sizes[0])); j++) {
+			bench_fanout("fanout copied", copied_send_to_all, fanout_counts[i], fanout_sizes[j]);
+			bench_fanout("fanout shared", send_buf_to_all, fanout_counts[i], fanout_sizes[j]);
+		}
+	}
+
+	// pipelined requests cost one acknowledge per turn in blocks
+	const int ack_pipelines[] = {1, 16, 256};
+	for (int i = 0; i < (int) (sizeof(ack_pipelines) / sizeof(ack_pipelines[0])); i++) {
+		bench_acks("acks one by one", SHIFT_IN, ack_pipelines[i]);
+		bench_acks("acks in blocks", SHIFT_OUT, ack_pipelines[i]);
+	}
+
+	// reading a header and dispatching it, with and without the read
+	const char enquiry[] = {0, ENQUIRY, ENQUIRY_NORMAL, 0};
+	const char text[] = {0, START_TEXT, 1, 5, 'h', 'e', 'l', 'l', 'o'};
+	for (int from_socket = 0; from_socket < 2; from_socket++) {
+		bench_parse("parse enquiry", from_socket, enquiry, sizeof(enquiry));
+		bench_parse("parse text", from_socket, text, sizeof(text));
+	}
+
+	// building a packet costs the same however long the server ran
+	struct pool *pool;
+	if (init_pool_struct(&pool) < 0 || pool_add_class(pool, BENCH_WINDOW) < 0) {
+		fprintf(stderr, "pool init failed\n");
+		exit(1);
+	}
+	const int alloc_segments[] = {1, 4, 16};
+	for (int i = 0; i < (int) (sizeof(alloc_segments) / sizeof(alloc_segments[0])); i++) {
+		bench_alloc("packets malloc", NULL, alloc_segments[i]);
+		bench_alloc("packets pooled", pool, alloc_segments[i]);
+	}
+	destroy_pool_struct(&pool);
+
+	bench_style("packet style");
+
+	return 0;
+}
@@ -2,15 +2,42 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <time.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
 
 #include "chopconn.h"
 #include "chopconst.h"
 #include "chopdata.h"
 #include "chopdebug.h"
+#include "chopdispatch.h"
+#include "chopevent.h"
+#include "chopmetrics.h"
 #include "choppacket.h"
+#include "chopsink.h"
+#include "chopsocket.h"
+#include "choptimer.h"
 
 #define BUFSIZE 255
+#define HANDSHAKE_MS 2000 // time the server has to acknowledge a handshake
+#define HANDSHAKE_RETRIES 2 // times a handshake is resent before giving up
+#define RTT_PINGS 1000 // stamps an rtt command sends when not told how many
+#define LOAD_SECONDS 10 // how long a load run sends when not told
+#define LOAD_TEXT_LEN 64 // bytes of text in a load run's START_TEXT when not told
+#define LOAD_TEXT_MAX (255 * 255) // most text a counted START_TEXT carries
+#define LOAD_WINDOW 1024 // requests a load connection can have unanswered
+#define LOAD_DRAIN_MS 2000 // time answers are waited for once a load run stops sending
+#define LOAD_EVENTS 256
+
+/// Load Requests
+#define LOAD_TEXT 0 // START_TEXT, acknowledged
+#define LOAD_ENQUIRY 1 // ENQUIRY_NORMAL, acknowledged
+#define LOAD_CHURN 2 // IDLE then WAKEUP, each acknowledged
+#define LOAD_KINDS 3
 
 #ifndef PORT
 #define PORT 50001
@@ -24,29 +51,688 @@ int sigint_received;
 
 struct client *server_connection;
 
+struct timer_wheel *wheel;
+
+int handshake_retries;
+
+// round trips of the rtt command running, one stamp in flight at a time
+struct rtt_run {
+	long *samples; // round trip of every echo so far
+	long *held; // time the server held each stamp
+	int want;
+	int have;
+	long seen; // client's echo count when the last sample was taken
+	struct sink *quiet; // drops the echoes' output while the run lasts
+} rtt;
+
+struct load_request {
+	long sent_ns; // when it was sent, or came due in an open loop
+	int kind;
+};
+
+struct load_conn {
+	struct client *cli;
+	struct load_request window[LOAD_WINDOW]; // unanswered requests, oldest first
+	int head; // index of the oldest
+	int outstanding;
+};
+
+// a load run over many connections, answers are matched to requests in order
+struct load_run {
+	struct event_loop *loop;
+	int pacer; // timerfd waking an open loop when the next request comes due
+	struct load_conn *conns;
+	int count;
+	int open; // connections still up
+	struct load_conn **by_fd;
+	int fd_cap;
+	struct load_conn **dirty; // connections given requests this turn
+	int dirty_count;
+	int depth; // closed loop, requests kept unanswered on every connection
+	long rate; // open loop, requests a second over every connection, 0 for closed loop
+	int weights[LOAD_KINDS]; // how often each kind of request is picked
+	int weight_sum;
+	long picks;
+	char *text;
+	int text_count; // control1 and control2 of every START_TEXT
+	int text_width;
+	int sending;
+	long start_ns;
+	long stop_ns;
+	long last_ns; // when the last answer arrived
+	long due; // open loop requests scheduled so far
+	long behind; // open loop requests due but not yet sent
+	long waiting; // requests unanswered over every connection
+	int next; // connection the next open loop request goes to
+	long sent[LOAD_KINDS];
+	long answered[LOAD_KINDS];
+	long refused[LOAD_KINDS];
+	long lost; // requests left unanswered on connections that closed
+	struct histogram latency[LOAD_KINDS];
+} load;
+
+const char client_usage[] = "usage: %s [-n connections [-d seconds] [-r rate | -p depth] [-s text_len] [-m text,enquiry,churn]]\n";
+const char load_start[] = "Load: %d connections for %ld s, %s.\n";
+const char load_kind[] = "%-8s %ld sent, %ld answered, %ld refused; p50 %.1f us, p90 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us.\n";
+const char load_total[] = "Total: %ld answered in %.2f s, %.0f requests/s; %ld unanswered, %ld lost with %d closed connections; %ld came due but were never sent.\n";
+
 void sigint_handler(int code);
 
+int send_handshake(struct client *cli, const pack_stat status);
+
+void handshake_expired(struct timer_wheel *wheel, struct timer *timer);
+
+int start_rtt(struct client *cli, const int count);
+
+void collect_rtt(struct client *cli);
+
+int compare_longs(const void *a, const void *b);
+
+int run_load(const int connections, const long seconds);
+
+int load_connect(struct load_conn *conn);
+
+int load_send(struct load_conn *conn, const long stamp);
+
+int load_answered(struct client *cli, struct packet *pack);
+
+int load_refused(struct client *cli, struct packet *pack);
+
+void load_schedule(const long now);
+
+void load_serve(struct load_conn *conn, const int events);
+
+void load_close(struct load_conn *conn);
+
+void load_report(const int connections);
+
 void sigint_handler(int code) {
 	DEBUG_PRINT("received SIGINT, setting flag");
 	sigint_received = 1;
 }
 
-int main(void) {
+int send_handshake(struct client *cli, const pack_stat status) {
+	if (write_dataless(cli, 0, status, 0, 0) < 0) {
+		return -1;
+	}
+
+	// the acknowledge handler stops the deadline
+	cli->awaiting = status;
+	cli->awaiting_seq = cli->out_seq;
+	handshake_retries = 0;
+	return timer_arm(wheel, &(cli->ack_timer), HANDSHAKE_MS);
+}
+
+void handshake_expired(struct timer_wheel *wheel, struct timer *timer) {
+	struct client *cli = (struct client *) timer->arg;
+
+	// the request or its answer may have been lost, ask again
+	if (handshake_retries < HANDSHAKE_RETRIES) {
+		handshake_retries++;
+		DEBUG_PRINT("%s unanswered, retry %d", stat_to_str(cli->awaiting), handshake_retries);
+		if (write_dataless(cli, 0, cli->awaiting, 0, 0) < 0) {
+			DEBUG_PRINT("failed packet write");
+			exit(1);
+		}
+		cli->awaiting_seq = cli->out_seq;
+		timer_arm(wheel, timer, HANDSHAKE_MS);
+		return;
+	}
+
+	printf("No answer to %s from the server.\n", stat_to_str(cli->awaiting));
+
+	// leaving does not need the server's permission
+	if (cli->awaiting == ESCAPE) {
+		exit(1);
+	}
+	cli->awaiting = -1;
+}
+
+int start_rtt(struct client *cli, const int count) {
+	rtt.samples = (long *) malloc(sizeof(long) * count);
+	rtt.held = (long *) malloc(sizeof(long) * count);
+	if (rtt.samples == NULL || rtt.held == NULL || init_sink_struct(&(rtt.quiet), SINK_NONE, STDOUT_FILENO) < 0) {
+		free(rtt.samples);
+		free(rtt.held);
+		return -1;
+	}
+	rtt.want = count;
+	rtt.have = 0;
+	rtt.seen = cli->rtt_samples;
+
+	message_sink = rtt.quiet;
+	return write_stamp(cli);
+}
+
+int compare_longs(const void *a, const void *b) {
+	long x = *(const long *) a;
+	long y = *(const long *) b;
+	return (x > y) - (x < y);
+}
+
+void collect_rtt(struct client *cli) {
+	// nothing running, or the stamp in flight was not echoed yet
+	if (rtt.want == 0 || cli->rtt_samples == rtt.seen) {
+		return;
+	}
+	rtt.seen = cli->rtt_samples;
+	rtt.samples[rtt.have] = cli->rtt_last_ns;
+	rtt.held[rtt.have] = cli->rtt_held_ns;
+	rtt.have++;
+
+	if (rtt.have < rtt.want) {
+		if (write_stamp(cli) < 0) {
+			DEBUG_PRINT("failed packet write");
+			exit(1);
+		}
+		return;
+	}
+
+	// percentiles of the whole run
+	int n = rtt.have;
+	qsort(rtt.samples, n, sizeof(long), compare_longs);
+	qsort(rtt.held, n, sizeof(long), compare_longs);
+	printf("Round trips over %d stamps: p50 %.1f us, p99 %.1f us, p999 %.1f us, max %.1f us.\n", n,
+			rtt.samples[n * 50 / 100] / 1000.0, rtt.samples[n * 99 / 100] / 1000.0, rtt.samples[n * 999 / 1000] / 1000.0, rtt.samples[n - 1] / 1000.0);
+	printf("Server held them p50 %.1f us, p99 %.1f us; smoothed round trip %.1f us, variation %.1f us.\n",
+			rtt.held[n * 50 / 100] / 1000.0, rtt.held[n * 99 / 100] / 1000.0, cli->srtt_ns / 1000.0, cli->rttvar_ns / 1000.0);
+
+	message_sink = NULL;
+	destroy_sink_struct(&(rtt.quiet));
+	free(rtt.samples);
+	free(rtt.held);
+	rtt.want = 0;
+}
+
+int run_load(const int connections, const long seconds) {
+	// every connection is watched from one loop
+	if (init_event_loop(&(load.loop), EVENT_BACKEND_EPOLL, LOAD_EVENTS) < 0) {
+		DEBUG_PRINT("failed event loop init");
+		return -1;
+	}
+	load.conns = (struct load_conn *) calloc(connections, sizeof(struct load_conn));
+	load.dirty = (struct load_conn **) malloc(sizeof(struct load_conn *) * connections);
+	load.text = (char *) malloc(load.text_count * load.text_width);
+	if (load.conns == NULL || load.dirty == NULL || load.text == NULL) {
+		DEBUG_PRINT("malloc, load run");
+		return -1;
+	}
+	memset(load.text, 'x', load.text_count * load.text_width);
+
+	// millisecond waits would hold due requests back by up to a millisecond each
+	load.pacer = -1;
+	if (load.rate > 0) {
+		load.pacer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+		if (load.pacer < 0 || event_loop_add(load.loop, load.pacer, EVENT_READ, NULL) < 0) {
+			DEBUG_PRINT("failed pacer");
+			return -1;
+		}
+	}
+
+	// answers are matched to requests instead of being displayed
+	register_handler(DISPATCH_STATUS, ACKNOWLEDGE, load_answered);
+	register_handler(DISPATCH_STATUS, NEG_ACKNOWLEDGE, load_refused);
+
+	for (int i = 0; i < connections; i++) {
+		if (load_connect(load.conns + i) < 0) {
+			printf("Cannot open connection %d.\n", i);
+			return -1;
+		}
+		load.count++;
+		load.open++;
+	}
+
+	char mode[64];
+	if (load.rate > 0) {
+		snprintf(mode, sizeof(mode), "open loop at %ld requests/s", load.rate);
+	} else {
+		snprintf(mode, sizeof(mode), "closed loop with %d unanswered each", load.depth);
+	}
+	printf(load_start, connections, seconds, mode);
+	fflush(stdout);
+
+	load.start_ns = timer_now_ns();
+	load.stop_ns = load.start_ns + seconds * 1000000000L;
+	load.sending = 1;
+
+	// a closed loop starts every connection with its pipeline full
+	if (load.rate == 0) {
+		for (int i = 0; i < load.count; i++) {
+			while (load.conns[i].outstanding < load.depth) {
+				if (load_send(load.conns + i, timer_now_ns()) < 0) {
+					DEBUG_PRINT("failed packet write");
+					return -1;
+				}
+			}
+		}
+	}
+
+	struct event ready[LOAD_EVENTS];
+	while (load.open > 0) {
+		long now = timer_now_ns();
+
+		// stop sending, then wait a while for what is still unanswered
+		if (load.sending && now >= load.stop_ns) {
+			// the last requests due before the stop still go out
+			if (load.rate > 0) {
+				load_schedule(load.stop_ns - 1);
+			}
+			load.sending = 0;
+		}
+		if (!load.sending && (load.waiting == 0 || now >= load.stop_ns + LOAD_DRAIN_MS * 1000000L)) {
+			break;
+		}
+
+		if (load.sending && load.rate > 0) {
+			load_schedule(now);
+		}
+
+		// write out everything queued this turn at once
+		for (int i = 0; i < load.dirty_count; i++) {
+			if (load.dirty[i]->cli != NULL) {
+				load.dirty[i]->cli->pending = 0;
+				load_serve(load.dirty[i], EVENT_WRITE);
+			}
+		}
+		load.dirty_count = 0;
+
+		// an open loop is woken by the pacer when the next request comes due, without
+		// spinning, so a server on the same host keeps the processor
+		if (load.sending && load.rate > 0) {
+			long next_due = load.start_ns + (long) (load.due * 1e9 / load.rate);
+			struct itimerspec spec = {{0, 0}, {next_due / 1000000000L, next_due % 1000000000L}};
+			timerfd_settime(load.pacer, TFD_TIMER_ABSTIME, &spec, NULL);
+		}
+		int nready = event_loop_wait(load.loop, ready, LOAD_EVENTS, 10);
+		if (nready < 0) {
+			if (nready == -EINTR) {
+				continue;
+			}
+			DEBUG_PRINT("failed wait");
+			break;
+		}
+
+		for (int i = 0; i < nready; i++) {
+			// the pacer has no connection, only its expiry count to clear
+			if (ready[i].owner == NULL) {
+				uint64_t expired;
+				if (read(load.pacer, &expired, sizeof(expired)) < 0) {
+					DEBUG_PRINT("pacer read");
+				}
+				continue;
+			}
+			load_serve((struct load_conn *) ready[i].owner, ready[i].events);
+		}
+	}
+
+	load_report(connections);
+
+	for (int i = 0; i < load.count; i++) {
+		if (load.conns[i].cli != NULL) {
+			load_close(load.conns + i);
+		}
+	}
+	if (load.pacer >= 0) {
+		close(load.pacer);
+	}
+	destroy_event_loop(&(load.loop));
+	free(load.conns);
+	free(load.dirty);
+	free(load.by_fd);
+	free(load.text);
+	return 0;
+}
+
+int load_connect(struct load_conn *conn) {
+	if (establish_server_connection(ADDRESS, PORT, &(conn->cli), BUFSIZE) < 0) {
+		DEBUG_PRINT("failed connection");
+		return -1;
+	}
+	struct client *cli = conn->cli;
+	if (set_nonblocking(cli->socket_fd) < 0) {
+		DEBUG_PRINT("failed nonblocking");
+		return -1;
+	}
+
+	// answers find their connection by descriptor
+	if (cli->socket_fd >= load.fd_cap) {
+		int cap = (load.fd_cap > 0) ? load.fd_cap : 64;
+		while (cap <= cli->socket_fd) {
+			cap *= 2;
+		}
+		struct load_conn **by_fd = (struct load_conn **) realloc(load.by_fd, sizeof(struct load_conn *) * cap);
+		if (by_fd == NULL) {
+			DEBUG_PRINT("realloc, fd index");
+			return -1;
+		}
+		memset(by_fd + load.fd_cap, 0, sizeof(struct load_conn *) * (cap - load.fd_cap));
+		load.by_fd = by_fd;
+		load.fd_cap = cap;
+	}
+	load.by_fd[cli->socket_fd] = conn;
+
+	cli->watched = EVENT_READ;
+	return event_loop_add(load.loop, cli->socket_fd, cli->watched, conn);
+}
+
+int load_send(struct load_conn *conn, const long stamp) {
+	struct client *cli = conn->cli;
+
+	// kinds are picked in proportion to their weights, in a fixed order
+	long slot = load.picks++ % load.weight_sum;
+	int kind = 0;
+	while (slot >= load.weights[kind]) {
+		slot -= load.weights[kind];
+		kind++;
+	}
+
+	// churn is a pair of requests, answered one by one
+	int requests = (kind == LOAD_CHURN) ? 2 : 1;
+	for (int i = 0; i < requests; i++) {
+		int ret;
+		if (kind == LOAD_TEXT) {
+			ret = write_datapack(cli, 0, START_TEXT, load.text_count, load.text_width, load.text, load.text_count * load.text_width);
+		} else if (kind == LOAD_ENQUIRY) {
+			ret = write_dataless(cli, 0, ENQUIRY, ENQUIRY_NORMAL, 0);
+		} else {
+			ret = write_dataless(cli, 0, (i == 0) ? IDLE : WAKEUP, 0, 0);
+		}
+		if (ret < 0) {
+			return ret;
+		}
+
+		struct load_request *req = conn->window + (conn->head + conn->outstanding) % LOAD_WINDOW;
+		req->sent_ns = stamp;
+		req->kind = kind;
+		conn->outstanding++;
+		load.waiting++;
+		load.sent[kind]++;
+	}
+
+	if (!cli->pending) {
+		cli->pending = 1;
+		load.dirty[load.dirty_count++] = conn;
+	}
+	return requests;
+}
+
+/*
+ * Takes the oldest unanswered request of the client's connection, which the
+ * packet being parsed answers. Returns NULL if nothing was waiting.
+ */
+static struct load_conn *load_take(struct client *cli, struct load_request *out) {
+	struct load_conn *conn = (cli->socket_fd < load.fd_cap) ? load.by_fd[cli->socket_fd] : NULL;
+	if (conn == NULL || conn->outstanding == 0) {
+		DEBUG_PRINT("answer to nothing on %d", cli->socket_fd);
+		return NULL;
+	}
+
+	*out = conn->window[conn->head];
+	conn->head = (conn->head + 1) % LOAD_WINDOW;
+	conn->outstanding--;
+	load.waiting--;
+	load.last_ns = cli->recv_ns;
+	return conn;
+}
+
+/*
+ * Keeps a closed loop connection's pipeline full.
+ */
+static int load_refill(struct load_conn *conn) {
+	while (load.sending && load.rate == 0 && conn->outstanding < load.depth) {
+		if (load_send(conn, timer_now_ns()) < 0) {
+			DEBUG_PRINT("failed packet write");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int load_answered(struct client *cli, struct packet *pack) {
+	// any acknowledge answers the oldest request
+	(void) pack;
+
+	struct load_request req;
+	struct load_conn *conn = load_take(cli, &req);
+	if (conn == NULL) {
+		return -1;
+	}
+
+	// timed from the read that brought the answer in
+	histogram_record(load.latency + req.kind, cli->recv_ns - req.sent_ns);
+	load.answered[req.kind]++;
+	return load_refill(conn);
+}
+
+int load_refused(struct client *cli, struct packet *pack) {
+	// a refused connection has no request to match
+	if (pack->control1 == NULL_BYTE) {
+		return nak_connection(cli, pack);
+	}
+
+	struct load_request req;
+	struct load_conn *conn = load_take(cli, &req);
+	if (conn == NULL) {
+		return -1;
+	}
+
+	load.refused[req.kind]++;
+	return load_refill(conn);
+}
+
+void load_schedule(const long now) {
+	// requests come due at an even pace from the start, the first one right away
+	long target = (long) ((double) (now - load.start_ns) * load.rate / 1e9) + 1;
+	while (load.due < target) {
+		// round robin, passing over windows too full for a churn pair
+		struct load_conn *conn = NULL;
+		for (int tries = 0; tries < load.count && conn == NULL; tries++) {
+			struct load_conn *cur = load.conns + load.next;
+			load.next = (load.next + 1) % load.count;
+			if (cur->cli != NULL && cur->outstanding + 2 <= LOAD_WINDOW) {
+				conn = cur;
+			}
+		}
+
+		// still due next turn, timed from when it came due
+		if (conn == NULL) {
+			break;
+		}
+
+		// a churn pair counts as the two requests it is
+		long stamp = load.start_ns + (long) (load.due * 1e9 / load.rate);
+		int sent = load_send(conn, stamp);
+		if (sent < 0) {
+			DEBUG_PRINT("failed packet write");
+			break;
+		}
+		load.due += sent;
+	}
+	load.behind = (target > load.due) ? target - load.due : 0;
+}
+
+void load_serve(struct load_conn *conn, const int events) {
+	struct client *cli = conn->cli;
+	if (cli == NULL) {
+		return;
+	}
+	int was_throttled = cli->throttled;
+
+	if ((events & EVENT_WRITE) && flush_queue(cli) < 0) {
+		DEBUG_PRINT("failed flush");
+	}
+
+	// read when ready, or when draining the queue just lifted a pause
+	if (!cli->throttled && ((events & (EVENT_READ | EVENT_ERROR)) || was_throttled)) {
+		if (process_request(cli) < 0) {
+			DEBUG_PRINT("failed request");
+		}
+	}
+
+	if (is_client_status(cli, CANCEL)) {
+		load_close(conn);
+		return;
+	}
+
+	// wait for room only while requests are queued
+	int watch = EVENT_READ | ((cli->out_head != NULL) ? EVENT_WRITE : 0);
+	if (watch != cli->watched && event_loop_modify(load.loop, cli->socket_fd, watch, conn) == 0) {
+		cli->watched = watch;
+	}
+}
+
+void load_close(struct load_conn *conn) {
+	struct client *cli = conn->cli;
+	event_loop_remove(load.loop, cli->socket_fd);
+	load.by_fd[cli->socket_fd] = NULL;
+
+	// what it still waited on will never be answered
+	load.lost += conn->outstanding;
+	load.waiting -= conn->outstanding;
+	conn->outstanding = 0;
+
+	destroy_client_struct(&(conn->cli));
+	load.open--;
+}
+
+void load_report(const int connections) {
+	const char *names[LOAD_KINDS] = {"Text", "Enquiry", "Churn"};
+	long answered = 0;
+	for (int kind = 0; kind < LOAD_KINDS; kind++) {
+		if (load.weights[kind] == 0) {
+			continue;
+		}
+
+		struct histogram *hist = load.latency + kind;
+		printf(load_kind, names[kind], load.sent[kind], load.answered[kind], load.refused[kind],
+				histogram_value_at(hist, 0.5) / 1000.0, histogram_value_at(hist, 0.9) / 1000.0, histogram_value_at(hist, 0.99) / 1000.0,
+				histogram_value_at(hist, 0.999) / 1000.0, hist->max / 1000.0);
+		answered += load.answered[kind] + load.refused[kind];
+	}
+
+	// throughput over the time answers kept arriving
+	long end = (load.last_ns > load.start_ns) ? load.last_ns : load.stop_ns;
+	double elapsed = (end - load.start_ns) / 1e9;
+	printf(load_total, answered, elapsed, answered / elapsed, load.waiting, load.lost, connections - load.open, load.behind);
+}
+
+int main(int argc, char **argv) {
 	// Reset SIGINT received flag.
 	sigint_received = 0;
 
 	// mark debug statements as clientside
 	header_type = 1;
 
+	// a load run is asked for with the number of connections it opens
+	int connections = 0;
+	long seconds = LOAD_SECONDS;
+	long text_len = LOAD_TEXT_LEN;
+	load.depth = 1;
+	load.weights[LOAD_TEXT] = 1;
+	load.weights[LOAD_ENQUIRY] = 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:d:r:p:s:m:")) != -1) {
+		switch (opt) {
+			case 'n':
+				connections = strtol(optarg, NULL, 10);
+				if (connections < 1) {
+					fprintf(stderr, client_usage, argv[0]);
+					exit(1);
+				}
+				break;
+
+			case 'd':
+				seconds = strtol(optarg, NULL, 10);
+				if (seconds < 1) {
+					fprintf(stderr, client_usage, argv[0]);
+					exit(1);
+				}
+				break;
+
+			case 'r':
+				load.rate = strtol(optarg, NULL, 10);
+				if (load.rate < 0) {
+					fprintf(stderr, client_usage, argv[0]);
+					exit(1);
+				}
+				break;
+
+			case 'p':
+				// room is kept for a churn pair on top
+				load.depth = strtol(optarg, NULL, 10);
+				if (load.depth < 1 || load.depth > LOAD_WINDOW - 2) {
+					fprintf(stderr, client_usage, argv[0]);
+					exit(1);
+				}
+				break;
+
+			case 's':
+				text_len = strtol(optarg, NULL, 10);
+				if (text_len < 1 || text_len > LOAD_TEXT_MAX) {
+					fprintf(stderr, client_usage, argv[0]);
+					exit(1);
+				}
+				break;
+
+			case 'm':
+				if (sscanf(optarg, "%d,%d,%d", load.weights + LOAD_TEXT, load.weights + LOAD_ENQUIRY, load.weights + LOAD_CHURN) != 3) {
+					fprintf(stderr, client_usage, argv[0]);
+					exit(1);
+				}
+				break;
+
+			default:
+				fprintf(stderr, client_usage, argv[0]);
+				exit(1);
+		}
+	}
+
+	if (connections > 0) {
+		for (int kind = 0; kind < LOAD_KINDS; kind++) {
+			if (load.weights[kind] < 0) {
+				fprintf(stderr, client_usage, argv[0]);
+				exit(1);
+			}
+			load.weight_sum += load.weights[kind];
+		}
+		if (load.weight_sum == 0) {
+			fprintf(stderr, client_usage, argv[0]);
+			exit(1);
+		}
+
+		// longer text is counted in elements of up to 255 bytes, rounded up
+		load.text_width = (text_len < 255) ? text_len : 255;
+		load.text_count = (text_len + load.text_width - 1) / load.text_width;
+
+		exit((run_load(connections, seconds) < 0) ? 1 : 0);
+	}
+
+	// display every packet as it is handled
+	register_default_printers();
+
 	// connect to locally hosted server
 	if (establish_server_connection(ADDRESS, PORT, &server_connection, BUFSIZE) < 0) {
 		DEBUG_PRINT("failed connection");
 		exit(1);
 	}
 
+	// file bodies are sent only as far as the socket takes them
+	if (set_nonblocking(server_connection->socket_fd) < 0) {
+		DEBUG_PRINT("failed nonblocking");
+		exit(1);
+	}
+
+	// handshakes the server leaves unanswered are retried, then given up
+	if (init_timer_wheel(&wheel, TIMER_TICK_MS, NULL) < 0) {
+		DEBUG_PRINT("failed timer wheel init");
+		exit(1);
+	}
+	timer_setup(&(server_connection->ack_timer), handshake_expired, server_connection);
+
 	// setup fd set for selecting
 	int max_fd = server_connection->socket_fd;
-	fd_set all_fds, listen_fds;
+	fd_set all_fds, listen_fds, write_fds;
 	FD_ZERO(&all_fds);
 	FD_SET(server_connection->socket_fd, &all_fds);
 	FD_SET(STDIN_FILENO, &all_fds);
@@ -61,19 +747,43 @@ int main(void) {
 			exit(1);
 		}
 
-		// selecting
+		// send whatever was queued since the last pass
+		if (flush_queue(server_connection) < 0) {
+			DEBUG_PRINT("failed packet write");
+			exit(1);
+		}
+
+		// selecting, waiting for room only while packets are queued
 		listen_fds = all_fds;
-		int nready = select(max_fd + 1, &listen_fds, NULL, NULL, NULL);
+		FD_ZERO(&write_fds);
+		if (server_connection->out_head != NULL) {
+			FD_SET(server_connection->socket_fd, &write_fds);
+		}
+		struct timeval timeout;
+		int next = timer_next_ms(wheel);
+		timeout.tv_sec = next / 1000;
+		timeout.tv_usec = (next % 1000) * 1000;
+		int nready = select(max_fd + 1, &listen_fds, &write_fds, NULL, (next < 0) ? NULL : &timeout);
 		if (nready < 0) {
 			DEBUG_PRINT("select");
 			exit(1);
 		}
+		timer_advance(wheel);
+
+		// writing queued packets to server
+		if (FD_ISSET(server_connection->socket_fd, &write_fds)) {
+			if (flush_queue(server_connection) < 0) {
+				DEBUG_PRINT("failed packet write");
+				exit(1);
+			}
+		}
 
 		// reading from server
 		if (FD_ISSET(server_connection->socket_fd, &listen_fds)) {
-			if (process_request(server_connection, &all_fds) < 0) {
+			if (process_request(server_connection) < 0) {
 				exit(1); // TODO: remove once failing a packet isn't really bad
 			}
+			collect_rtt(server_connection);
 
 			// if escape
 			if (is_client_status(server_connection, CANCEL)) {
@@ -99,7 +809,7 @@ int main(void) {
 			// setting values of header
 			if (strcmp(buffer, "exit") == 0) {
 				// exit
-				if (write_dataless(server_connection, 0, ESCAPE, 0, 0) < 0) {
+				if (send_handshake(server_connection, ESCAPE) < 0) {
 					DEBUG_PRINT("failed packet write");
 					exit(1);
 				}
@@ -132,16 +842,76 @@ int main(void) {
 					exit(1);
 				}
 
+			} else if (strcmp(buffer, "shift") == 0 || strcmp(buffer, "unshift") == 0) {
+				// acknowledges in blocks, or one by one again
+				if (write_dataless(server_connection, 0, (buffer[0] == 's') ? SHIFT_OUT : SHIFT_IN, 0, 0) < 0) {
+					DEBUG_PRINT("failed packet write");
+					exit(1);
+				}
+
+			} else if (strcmp(buffer, "rtt") == 0 || strncmp(buffer, "rtt ", 4) == 0) {
+				// one stamp at a time, each sent once the last was echoed
+				int count = (buffer[3] == ' ') ? atoi(buffer + 4) : RTT_PINGS;
+				if (rtt.want > 0 || count < 1) {
+					printf("Usage: rtt [count], one run at a time.\n");
+				} else if (start_rtt(server_connection, count) < 0) {
+					DEBUG_PRINT("failed packet write");
+					exit(1);
+				}
+
+			} else if (strcmp(buffer, "metrics") == 0) {
+				// server answers with a report of its metrics
+				if (write_dataless(server_connection, 0, END_OF_MEDIUM, METRICS_QUERY, 0) < 0) {
+					DEBUG_PRINT("failed packet write");
+					exit(1);
+				}
+
 			} else if (strcmp(buffer, "sleep") == 0) {
 				// sleep request
-				if (write_dataless(server_connection, 0, IDLE, 0, 0) < 0) {
+				if (send_handshake(server_connection, IDLE) < 0) {
 					DEBUG_PRINT("failed packet write");
 					exit(1);
 				}
 
 			} else if (strcmp(buffer, "wake") == 0) {
 				// wake request
-				if (write_dataless(server_connection, 0, WAKEUP, 0, 0) < 0) {
+				if (send_handshake(server_connection, WAKEUP) < 0) {
+					DEBUG_PRINT("failed packet write");
+					exit(1);
+				}
+
+			} else if (strncmp(buffer, "sub ", 4) == 0 || strncmp(buffer, "unsub ", 6) == 0) {
+				// topic name follows the command
+				int status = (buffer[0] == 's') ? SUBSCRIBE : UNSUBSCRIBE;
+				char *name = strchr(buffer, ' ') + 1;
+				if (write_datapack(server_connection, 0, status, strlen(name), 0, name, strlen(name)) < 0) {
+					DEBUG_PRINT("failed packet write");
+					exit(1);
+				}
+
+			} else if (strncmp(buffer, "pub ", 4) == 0 && strchr(buffer + 4, ' ') != NULL) {
+				// topic name, then the message, sent back to back
+				char *name = buffer + 4;
+				char *message = strchr(name, ' ');
+				int name_len = message - name;
+				memmove(message, message + 1, strlen(message));
+				if (write_datapack(server_connection, 0, PUBLISH, name_len, strlen(message), name, name_len + strlen(message)) < 0) {
+					DEBUG_PRINT("failed packet write");
+					exit(1);
+				}
+
+			} else if (strncmp(buffer, "file ", 5) == 0) {
+				// whole file as a data section, sent straight from the file
+				int fd = open(buffer + 5, O_RDONLY);
+				struct stat info;
+				if (fd < 0 || fstat(fd, &info) < 0) {
+					printf("Cannot open \"%s\".\n", buffer + 5);
+					if (fd >= 0) {
+						close(fd);
+					}
+					continue;
+				}
+				if (write_file(server_connection, 0, fd, 0, info.st_size) < 0) {
 					DEBUG_PRINT("failed packet write");
 					exit(1);
 				}
@@ -0,0 +1,207 @@
+#include <string.h>
+#include <errno.h>
+
+#include "chopcodec.h"
+#include "chopconst.h"
+#include "chopdata.h"
+#include "chopdebug.h"
+
+/*
+ * Field Functions
+ */
+
+void codec_put_be(char *dest, const int width, const unsigned long value) {
+	unsigned long rest = value;
+	for (int i = width - 1; i >= 0; i--) {
+		dest[i] = (char) (rest & 0xff);
+		rest >>= 8;
+	}
+}
+
+unsigned long codec_get_be(const char *src, const int width) {
+	unsigned long value = 0;
+	for (int i = 0; i < width; i++) {
+		value = (value << 8) | (unsigned char) src[i];
+	}
+	return value;
+}
+
+int codec_body_len(const pack_stat status, const pack_con1 control1, const pack_con2 control2) {
+	switch (status) {
+		case START_TEXT:
+			// both control signals 0 is text ended by END_TEXT
+			if (control1 == 0 && control2 == 0) {
+				return BODY_DELIMITED;
+			}
+			return control1 * control2;
+
+		case ENQUIRY:
+			// times are carried in the data section, control2 wide
+			if (control1 == ENQUIRY_TIME || control1 == ENQUIRY_STAMP || control1 == ENQUIRY_ECHO) {
+				return control2;
+			}
+			return 0;
+
+		case ACKNOWLEDGE:
+			// only a block carries data, control2 wide
+			if (control1 == END_TRANSMISSION_BLOCK) {
+				return control2;
+			}
+			return 0;
+
+		case SUBSCRIBE:
+		case UNSUBSCRIBE:
+			return control1;
+
+		case PUBLISH:
+		case DELIVER:
+			// topic name, then the message
+			return control1 + control2;
+
+		case END_OF_MEDIUM:
+			// only a report carries text, ended by END_TEXT
+			if (control1 == METRICS_REPORT) {
+				return BODY_DELIMITED;
+			}
+			return 0;
+
+		default:
+			return 0;
+	}
+}
+
+/*
+ * Encoding Functions
+ */
+
+int codec_encode_header(char *buf, const int len, const pack_head head, const pack_stat status, const pack_con1 control1, const pack_con2 control2) {
+	// check valid arguments
+	if (buf == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	if (len < HEADER_LEN) {
+		return -ENOSPC;
+	}
+
+	// one byte each, in the order they travel
+	buf[PACKET_HEAD] = (char) head;
+	buf[PACKET_STATUS] = (char) status;
+	buf[PACKET_CONTROL1] = (char) control1;
+	buf[PACKET_CONTROL2] = (char) control2;
+	return HEADER_LEN;
+}
+
+int codec_encode(char *buf, const int len, const pack_head head, const pack_stat status, const pack_con1 control1, const pack_con2 control2, const char *body, const int body_len) {
+	// check valid arguments
+	if (buf == NULL || body_len < 0 || (body == NULL && body_len > 0)) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// a counted body must be as long as the header says
+	int counted = codec_body_len(status, control1, control2);
+	if (counted != BODY_DELIMITED && counted != body_len) {
+		DEBUG_PRINT("body of %d, header counts %d", body_len, counted);
+		return -EINVAL;
+	}
+
+	int total = HEADER_LEN + body_len + ((counted == BODY_DELIMITED) ? 1 : 0);
+	if (len < total) {
+		return -ENOSPC;
+	}
+
+	int offset = codec_encode_header(buf, len, head, status, control1, control2);
+	if (body_len > 0) {
+		memcpy(buf + offset, body, body_len);
+	}
+	if (counted == BODY_DELIMITED) {
+		buf[total - 1] = END_TEXT;
+	}
+	return total;
+}
+
+int codec_encode_extent(char *buf, const int len, const pack_head head, const long extent) {
+	// check valid arguments
+	if (buf == NULL || extent < 0) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	if (len < HEADER_LEN + DATA_LEN_BYTES) {
+		return -ENOSPC;
+	}
+
+	int offset = codec_encode_header(buf, len, head, START_DATA, 0, 0);
+	codec_put_be(buf + offset, DATA_LEN_BYTES, extent);
+	return offset + DATA_LEN_BYTES;
+}
+
+/*
+ * Decoding Functions
+ */
+
+int codec_decode_header(const char *buf, const int len, struct packet_view *view) {
+	// check valid arguments
+	if (buf == NULL || view == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// header has not fully arrived yet
+	if (len < HEADER_LEN) {
+		return -EAGAIN;
+	}
+
+	view->head = (pack_head) buf[PACKET_HEAD];
+	view->status = (pack_stat) buf[PACKET_STATUS];
+	view->control1 = (pack_con1) buf[PACKET_CONTROL1];
+	view->control2 = (pack_con2) buf[PACKET_CONTROL2];
+	view->body = NULL;
+	view->body_len = 0;
+	view->extent = 0;
+	view->len = HEADER_LEN;
+	return HEADER_LEN;
+}
+
+int codec_decode(const char *buf, const int len, struct packet_view *view) {
+	int offset = codec_decode_header(buf, len, view);
+	if (offset < 0) {
+		return offset;
+	}
+	const char *rest = buf + offset;
+	int left = len - offset;
+
+	// streamed bodies are left where they are, only their length is taken
+	if (view->status == START_DATA) {
+		if (left < DATA_LEN_BYTES) {
+			return -EAGAIN;
+		}
+		view->extent = (long) codec_get_be(rest, DATA_LEN_BYTES);
+		if (view->extent < 0) {
+			return -EOVERFLOW;
+		}
+		view->len = offset + DATA_LEN_BYTES;
+		return view->len;
+	}
+
+	int body_len = codec_body_len(view->status, view->control1, view->control2);
+
+	// a delimited body is known complete once its END_TEXT is
+	int taken = body_len;
+	if (body_len == BODY_DELIMITED) {
+		body_len = (left > 0) ? buf_contains_symbol(rest, left, END_TEXT) : -ENOENT;
+		if (body_len < 0) {
+			return -EAGAIN;
+		}
+		taken = body_len + 1;
+	} else if (left < body_len) {
+		return -EAGAIN;
+	}
+
+	view->body = (body_len > 0) ? rest : NULL;
+	view->body_len = body_len;
+	view->len = offset + taken;
+	return view->len;
+}
@@ -0,0 +1,86 @@
+#ifndef __CHOPCODEC_H__
+#define __CHOPCODEC_H__
+
+#include "chopconst.h"
+
+/*
+ * Structures
+ */
+
+/*
+ * A packet decoded in place, its body pointing into the bytes it was decoded
+ * from. Valid only as long as those bytes are.
+ */
+struct packet_view {
+	pack_head head;
+	pack_stat status;
+	pack_con1 control1;
+	pack_con2 control2;
+	const char *body; // first body byte, NULL if there is no body
+	int body_len; // body bytes, the END_TEXT ending a delimited body not included
+	long extent; // START_DATA body length, the body itself follows unread
+	int len; // bytes the packet took, header included
+};
+
+/*
+ * Field Functions
+ */
+
+/*
+ * Writes the value into width bytes, most significant byte first.
+ */
+void codec_put_be(char *dest, const int width, const unsigned long value);
+
+/*
+ * Reads a value of width bytes, most significant byte first.
+ */
+unsigned long codec_get_be(const char *src, const int width);
+
+/*
+ * Returns how many body bytes follow a header of the given fields, or
+ * BODY_DELIMITED if the body runs until an END_TEXT symbol.
+ */
+int codec_body_len(const pack_stat status, const pack_con1 control1, const pack_con2 control2);
+
+/*
+ * Encoding Functions
+ */
+
+/*
+ * Writes a header into buf. Returns the bytes written, or -ENOSPC if buf is
+ * shorter than a header.
+ */
+int codec_encode_header(char *buf, const int len, const pack_head head, const pack_stat status, const pack_con1 control1, const pack_con2 control2);
+
+/*
+ * Writes a header and its body into buf, followed by END_TEXT if the header
+ * calls for a delimited body. Returns the bytes written, -EINVAL if body_len
+ * differs from what the header counts, or -ENOSPC if buf is too short.
+ */
+int codec_encode(char *buf, const int len, const pack_head head, const pack_stat status, const pack_con1 control1, const pack_con2 control2, const char *body, const int body_len);
+
+/*
+ * Writes a START_DATA header and the body length that follows it into buf,
+ * leaving the body to the caller. Returns the bytes written, or -ENOSPC if
+ * buf is too short.
+ */
+int codec_encode_extent(char *buf, const int len, const pack_head head, const long extent);
+
+/*
+ * Decoding Functions
+ */
+
+/*
+ * Reads the header at the front of buf into view, without its body. Returns
+ * the bytes taken, or -EAGAIN if buf is shorter than a header.
+ */
+int codec_decode_header(const char *buf, const int len, struct packet_view *view);
+
+/*
+ * Decodes the packet at the front of buf into view, copying nothing. Returns
+ * the bytes the packet took, -EAGAIN if buf ends before the packet does, or
+ * -EOVERFLOW for a START_DATA length that does not fit a long.
+ */
+int codec_decode(const char *buf, const int len, struct packet_view *view);
+
+#endif
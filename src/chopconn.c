@@ -4,69 +4,160 @@
 #include <string.h>
 #include <stdarg.h>
 #include <errno.h>
-#include <sys/select.h>
 
+#include "chopcodec.h"
 #include "chopconn.h"
 #include "chopconst.h"
 #include "chopdata.h"
 #include "chopdebug.h"
+#include "chopmetrics.h"
 #include "choppacket.h"
+#include "choppool.h"
 #include "chopsocket.h"
+#include "choptopic.h"
 
 /*
  * Client/Server Management functions
  */
 
-int accept_new_client(struct server *receiver, const size_t bufsize) {
+int accept_new_client(struct server *receiver, const size_t bufsize, struct client **out) {
 	// precondition for invalid arguments
 	if (receiver == NULL || bufsize < 1) {
 		DEBUG_PRINT("invalid arguments");
 		return -EINVAL;
 	}
 
-	// init new client
-	struct client *newcli;
-	if (init_client_struct(&newcli, bufsize) < 0) {
-		DEBUG_PRINT("init client fail, refusing incoming");
-		refuse_connection(receiver->server_fd);
-		return -ENOMEM;
+	// turn the peer away before anything is allocated for it
+	if (!server_has_room(receiver)) {
+		int ret = refuse_connection(receiver->server_fd);
+		if (ret < 0) {
+			return ret;
+		}
+		receiver->refused++;
+		if (receiver->metrics != NULL) {
+			metrics_add(&(receiver->metrics->refused), 1);
+		}
+		DEBUG_PRINT("server full, refused");
+		return -ENOSPC;
 	}
 
 	// accept new client
-	int client_fd = accept_connection(receiver->server_fd, &(newcli->address));
+	struct sockaddr_in peer;
+	int client_fd = accept_connection(receiver->server_fd, &peer);
 	if (client_fd < 0) {
 		DEBUG_PRINT("accept fail");
 		return client_fd;
 	}
 	DEBUG_PRINT("new client on fd %d", client_fd);
 
-	// find space to put potential new client in
-	int destination = -1;
-	for (int i = 0; i < receiver->max_connections; i++) {
-		if (receiver->clients[i] == NULL) {
-			destination = i;
-			break;
-		}
+	struct client *newcli;
+	int status = adopt_client(receiver, client_fd, bufsize, &newcli);
+	if (status < 0) {
+		return status;
+	}
+	newcli->address = peer;
+
+	// return reference to new client
+	if (out != NULL) {
+		*out = newcli;
+	}
+	return client_fd;
+}
+
+/*
+ * Grows the descriptor index of the server to hold the given descriptor.
+ */
+static int index_fd_space(struct server *host, const int fd) {
+	int cap = (host->fd_cap > 0) ? host->fd_cap : 64;
+	while (cap <= fd) {
+		cap *= 2;
+	}
+
+	struct client **by_fd = (struct client **) realloc(host->by_fd, sizeof(struct client *) * cap);
+	if (by_fd == NULL) {
+		DEBUG_PRINT("realloc, fd index");
+		return -ENOMEM;
+	}
+	memset(by_fd + host->fd_cap, 0, sizeof(struct client *) * (cap - host->fd_cap));
+
+	host->by_fd = by_fd;
+	host->fd_cap = cap;
+	return 0;
+}
+
+int adopt_client(struct server *receiver, const int client_fd, const size_t bufsize, struct client **out) {
+	// precondition for invalid arguments
+	if (receiver == NULL || client_fd < MIN_FD || bufsize < 1) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// init new client
+	struct client *newcli;
+	if (init_client_struct(&newcli, bufsize) < 0) {
+		DEBUG_PRINT("init client fail, refusing incoming");
+		close(client_fd);
+		return -ENOMEM;
+	}
+
+	// a full table grows while it is under its limit
+	if (receiver->free_count == 0 && receiver->max_connections < receiver->connection_limit) {
+		int grown = receiver->max_connections * 2;
+		if (grown > receiver->connection_limit) grown = receiver->connection_limit;
+		grow_server_struct(receiver, grown);
 	}
 
 	// no empty space found
-	if (destination < 0) {
+	if (receiver->free_count == 0) {
 		DEBUG_PRINT("no space for new client, refusing");
 		close(client_fd);
 		destroy_client_struct(&newcli);
 		return -ENOSPC;
 	}
 
+	// descriptors index straight to their client
+	if (client_fd >= receiver->fd_cap && index_fd_space(receiver, client_fd) < 0) {
+		DEBUG_PRINT("no room to index fd %d, refusing", client_fd);
+		close(client_fd);
+		destroy_client_struct(&newcli);
+		return -ENOMEM;
+	}
+	int destination = receiver->free_slots[--receiver->free_count];
+
 	// setup new client
 	receiver->clients[destination] = newcli;
+	receiver->live[receiver->cur_connections] = newcli;
+	receiver->by_fd[client_fd] = newcli;
+	newcli->slot = destination;
+	newcli->live_index = receiver->cur_connections;
 	newcli->socket_fd = client_fd;
 	newcli->server_fd = receiver->server_fd;
 	newcli->inc_flag = 0;
 	newcli->out_flag = 0;
 	newcli->window = bufsize;
+	newcli->high_water = receiver->high_water;
+	newcli->low_water = receiver->low_water;
+	newcli->pool = receiver->pool;
+	newcli->contiguous = receiver->contiguous;
+	newcli->topics = receiver->topics;
+	newcli->metrics = receiver->metrics;
+
+	// buffers sized to the client's window get a slab class of their own
+	if (pool_add_class(receiver->pool, bufsize) < 0) {
+		DEBUG_PRINT("no slab class for window %d", (int) bufsize);
+	}
+
+	// return reference to new client
+	if (out != NULL) {
+		*out = newcli;
+	}
 
 	// track new client
 	receiver->cur_connections++;
+	receiver->accepted++;
+	if (receiver->metrics != NULL) {
+		metrics_add(&(receiver->metrics->accepted), 1);
+	}
 	DEBUG_PRINT("new client, index %d", destination);
 	return client_fd;
 }
@@ -106,7 +197,7 @@ int establish_server_connection(const char *address, const int port, struct clie
 
 int remove_client_index(const int client_index, struct server *host) {
 	// precondition for invalid arguments
-	if (client_index < MIN_FD || host == NULL) {
+	if (client_index < MIN_FD || host == NULL || client_index >= host->max_connections) {
 		DEBUG_PRINT("invalid arguments");
 		return -EINVAL;
 	}
@@ -117,12 +208,35 @@ int remove_client_index(const int client_index, struct server *host) {
 		return -ENOENT;
 	}
 
+	// keep the client's counters once it is gone
+	struct client *cli = host->clients[client_index];
+	host->backpressure_count += cli->backpressure_count;
+	host->packets_in += cli->packets_in;
+	host->bytes_in += cli->bytes_in;
+	host->bytes_out += cli->bytes_out;
+
+	// unindex, the last live client fills the hole
+	if (cli->socket_fd >= 0 && cli->socket_fd < host->fd_cap && host->by_fd[cli->socket_fd] == cli) {
+		host->by_fd[cli->socket_fd] = NULL;
+	}
+	struct client *last = host->live[host->cur_connections - 1];
+	host->live[cli->live_index] = last;
+	last->live_index = cli->live_index;
+	host->live[host->cur_connections - 1] = NULL;
+	host->free_slots[host->free_count++] = client_index;
+
+	// nothing is delivered to a client that is gone
+	topic_drop_client(host->topics, cli);
+
 	// destroy client
 	if (destroy_client_struct(host->clients + client_index) < 0) {
 		DEBUG_PRINT("failed client destruct");
 		return -EINVAL;
 	}
 
+	// stop tracking client
+	host->cur_connections--;
+
 	DEBUG_PRINT("removed client at index %d", client_index);
 	return 0;
 }
@@ -150,49 +264,112 @@ int remove_client_address(const int client_index, struct client **target) {
 	return 0;
 }
 
-int process_request(struct client *cli, fd_set *all_fds) {
+int find_client_index(struct server *host, struct client *cli) {
 	// precondition for invalid arguments
-	if (cli == NULL || all_fds == NULL) {
+	if (host == NULL || cli == NULL) {
 		DEBUG_PRINT("invalid arguments");
 		return -EINVAL;
 	}
 
-	// init packet for recieving
-	struct packet *pack;
-	if (init_packet_struct(&pack) < 0) {
-		DEBUG_PRINT("failed packet init");
-		return -ENOMEM;
+	// clients remember their slot
+	if (cli->slot < 0 || cli->slot >= host->max_connections || host->clients[cli->slot] != cli) {
+		DEBUG_PRINT("client not found");
+		return -ENOENT;
 	}
 
+	return cli->slot;
+}
+
+struct client *find_client_fd(struct server *host, const int fd) {
+	// unknown descriptors have no client
+	if (host == NULL || fd < 0 || fd >= host->fd_cap) {
+		return NULL;
+	}
+
+	return host->by_fd[fd];
+}
+
+int process_request(struct client *cli) {
+	// precondition for invalid arguments
+	if (cli == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// read until the socket is drained, parsing between reads to free the ring
 	int status = 0;
-	switch (cli->inc_flag) {
-		case CANCEL:
-			DEBUG_PRINT("client closed");
-			// TODO: flush the fd and close the connection (this shouldn't need to happen)
-			//break;
-		default:
-			DEBUG_PRINT("client %d flag", cli->inc_flag);
-			status = read_header(cli, pack);
-			if (status < 0) {
+	int drained = 0;
+	while (!is_client_status(cli, CANCEL)) {
+		// the ring may still hold packets from before a pause
+		if (parse_stream(cli) < 0) {
+			DEBUG_PRINT("failed stream parse");
+			status = -1;
+		}
+
+		// replies are backed up, only continue if writing them lifts the pause
+		if (cli->throttled) {
+			if (flush_queue(cli) < 0 || cli->throttled) {
 				break;
 			}
-			status = parse_header(cli, pack);
+			continue;
+		}
+
+		// a short read means the socket had nothing more waiting
+		if (drained) {
 			break;
+		}
+
+		int space = cli->recv->ringsize - cli->recv->inring;
+		int filled = fill_ring(cli);
+		if (filled == -EAGAIN || filled == 0) {
+			break;
+		} else if (filled < 0) {
+			DEBUG_PRINT("failed ring fill");
+			status = filled;
+			break;
+		}
+		drained = (filled < space);
 	}
 
-	if (destroy_packet_struct(&pack) < 0) {
-	    DEBUG_PRINT("failed packet destroy");
-        return -1;
+	// send every reply from this pass together, including any final goodbye
+	if (flush_queue(cli) < 0) {
+		DEBUG_PRINT("failed flush");
+		status = -1;
 	}
 
 	return status;
 }
 
 /*
- * Sending functions
+ * Admission Functions
  */
 
+int server_has_room(struct server *host) {
+	// precondition for invalid arguments
+	if (host == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return 0;
+	}
+
+	return host->free_count > 0 || host->max_connections < host->connection_limit;
+}
+
+int admission_can_resume(struct server *host) {
+	// precondition for invalid arguments
+	if (host == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return 0;
+	}
+
+	// resuming the moment one slot frees would flap on every close
+	int low_water = host->connection_limit - 1 - host->connection_limit / ADMIT_RESUME_SHARE;
+	return !host->admitting && host->cur_connections <= low_water;
+}
+
 /*
+ * Sending functions
+ */
+
 int write_buf_to_client(struct client *cli, const char *msg, const int msg_len) {
 	// precondition for invalid arguments
 	if (cli == NULL || msg == NULL || msg_len < 0) {
@@ -206,45 +383,51 @@ int write_buf_to_client(struct client *cli, const char *msg, const int msg_len)
 		return 0;
 	}
 
+	// text longer than a control signal can count is ended by END_TEXT instead
+	int delimited = (msg_len > 255);
+	if (delimited && buf_contains_symbol(msg, msg_len, END_TEXT) >= 0) {
+		DEBUG_PRINT("text holds END_TEXT, cannot be delimited");
+		return -EINVAL;
+	}
+
 	// initialize packet for buffer
 	struct packet *pack;
-	if (init_packet_struct(&pack) < 0) {
+	if (pool_alloc_packet(cli->pool, &pack) < 0) {
 		DEBUG_PRINT("failed init packet");
 		return -ENOMEM;
 	}
 
 	// assemble packet header with text signal
-	if (assemble_header(pack, 0, START_TEXT, 1, msg_len) < 0) {
+	if (assemble_header(pack, 0, START_TEXT, delimited ? 0 : 1, delimited ? 0 : msg_len) < 0) {
 		DEBUG_PRINT("failed header assemble");
+		destroy_packet_struct(&pack);
 		return -EINVAL;
 	}
 
-	// add new data section
-	struct buffer *buf;
-	if (append_buffer(pack, msg_len, &buf) < 0) {
-		DEBUG_PRINT("failed data expansion");
+	// place text in a single segment, room left for its END_TEXT
+	char end = END_TEXT;
+	if (append_data(pack, msg, msg_len, msg_len + delimited) < 0 || (delimited && append_data(pack, &end, 1, 1) < 0)) {
+		DEBUG_PRINT("failed body assemble");
+		destroy_packet_struct(&pack);
 		return -ENOMEM;
 	}
 
-	// allocate packet body
-	if (assemble_body(buf, msg, msg_len) < 0) {
-		DEBUG_PRINT("failed body assemble");
-		return -EINVAL;
+	// queue behind anything not yet written, never into the middle of it
+	int ret = enqueue_packet(cli, pack);
+	if (ret < 0) {
+		DEBUG_PRINT("failed enqueue");
+		destroy_packet_struct(&pack);
+		return ret;
 	}
 
-	// write to client
-	if (write_packet(cli, pack) < 0) {
+	// write what the socket takes now, the rest once it has room
+	ret = flush_queue(cli);
+	if (ret < 0) {
 		DEBUG_PRINT("failed write");
-		return -1; // TODO: possibly capture return for better error reporting
-	}
-
-	// destroy allocated packet
-	if (destroy_packet_struct(&pack) < 0) {
-		DEBUG_PRINT("failed packet destroy");
-		return -EINVAL; // TODO: this probably cannot fail
+		return ret;
 	}
 
-	DEBUG_PRINT("wrote %d byte buffer", msg_len);
+	DEBUG_PRINT("queued %d byte buffer", msg_len);
 	return 0;
 }
 
@@ -255,100 +438,153 @@ int send_str_to_client(struct client *cli, const char *str) {
 		return -EINVAL;
 	}
 
-	// delegate writing
-	int ret = write_buf_to_client(cli, str, strlen(str) + 1);
-	if (ret < 0) {
-		DEBUG_PRINT("failed write");
-		return ret;
-	}
-
-	DEBUG_PRINT("str written");
-	return 0;
+	// delegate writing, terminator included
+	return write_buf_to_client(cli, str, strlen(str) + 1);
 }
 
 int send_fstr_to_client(struct client *cli, const char *format, ...) {
-	// precondition for invalid argument
-	if (cli == NULL) {
+	// precondition for invalid arguments
+	if (cli == NULL || format == NULL) {
 		DEBUG_PRINT("invalid arguments");
 		return -EINVAL;
 	}
 
 	// get length of assembled fstr
-	va_list uargs;
-	va_start(uargs, format);
-	int len = vdprintf(-1, format, uargs);
-	va_end(uargs);
-
-	// buffer for assembling format string
-	char msg[len + 1];
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(NULL, 0, format, args);
+	va_end(args);
+	if (len < 0) {
+		DEBUG_PRINT("bad format");
+		return -EINVAL;
+	}
 
 	// assemble string into buffer
-	va_list args;
+	char msg[len + 1];
 	va_start(args, format);
-	vsnprintf(msg, strlen(format) * 2, format, args);
+	vsnprintf(msg, len + 1, format, args);
 	va_end(args);
 
-	// delegate writing
-	int ret = write_buf_to_client(cli, msg, len + 1);
-	if (ret < 0) {
-		DEBUG_PRINT("failed write");
-		return ret;
+	// delegate writing, terminator included
+	return write_buf_to_client(cli, msg, len + 1);
+}
+
+int fan_out(struct server *host, struct shared *payload) {
+	// precondition for invalid arguments
+	if (host == NULL || payload == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
 	}
 
-	DEBUG_PRINT("fstr written");
-	return 0;
+	// every open client takes a reference, none takes a copy
+	int queued = 0;
+	for (int i = 0; i < host->cur_connections; i++) {
+		struct client *cli = host->live[i];
+		if (cli->inc_flag == CANCEL || cli->out_flag == CANCEL) {
+			continue;
+		}
+
+		if (write_shared(cli, payload) < 0) {
+			DEBUG_PRINT("failed queueing for client %d", cli->socket_fd);
+			continue;
+		}
+		queued++;
+	}
+
+	DEBUG_PRINT("%d bytes queued for %d clients", payload->len, queued);
+	return queued;
 }
 
-int send_str_to_all(struct server *host, const char *str) {
+int flush_all(struct server *host) {
 	// precondition for invalid arguments
-	if (host == NULL || str == NULL) {
+	if (host == NULL) {
 		DEBUG_PRINT("invalid arguments");
 		return -EINVAL;
 	}
 
-	// iterate through all available clients, stopping if any fail
-	for (int i = 0; i < host->max_connections; i++) {
-		if (host->clients[i] != NULL) {
-			if (send_str_to_client(host->clients[i], str) < 0) {
-				DEBUG_PRINT("failed sending at %d", i);
-				return 1;
-			}
+	// write what every socket takes, a full one keeps the rest queued
+	int left = 0;
+	for (int i = 0; i < host->cur_connections; i++) {
+		struct client *cli = host->live[i];
+		if (cli->out_head == NULL || cli->inc_flag == CANCEL || cli->out_flag == CANCEL) {
+			continue;
+		}
+
+		if (flush_queue(cli) > 0) {
+			left++;
 		}
 	}
 
-	DEBUG_PRINT("str written to all");
-	return 0;
+	return left;
+}
+
+int send_buf_to_all(struct server *host, const char *msg, const int msg_len) {
+	// precondition for invalid arguments
+	if (host == NULL || msg == NULL || msg_len < 0) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// text longer than a control signal can count is ended by END_TEXT instead
+	int delimited = (msg_len > 255);
+	if (delimited && buf_contains_symbol(msg, msg_len, END_TEXT) >= 0) {
+		DEBUG_PRINT("text holds END_TEXT, cannot be delimited");
+		return -EINVAL;
+	}
+
+	// serialize the packet once for every client
+	struct shared *payload;
+	if (init_shared_struct(&payload, HEADER_LEN + msg_len + delimited) < 0) {
+		DEBUG_PRINT("failed shared init");
+		return -ENOMEM;
+	}
+
+	// delimited text gains its END_TEXT from the codec
+	codec_encode(payload->bytes, payload->len, 0, START_TEXT, delimited ? 0 : 1, delimited ? 0 : msg_len, msg, msg_len);
+
+	// queues hold their own references, drop the one used to build it
+	int ret = fan_out(host, payload);
+	destroy_shared_struct(&payload);
+	return ret;
+}
+
+int send_str_to_all(struct server *host, const char *str) {
+	// precondition for invalid arguments
+	if (host == NULL || str == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// delegate writing, terminator included
+	return send_buf_to_all(host, str, strlen(str) + 1);
 }
 
 int send_fstr_to_all(struct server *host, const char *format, ...) {
 	// precondition for invalid arguments
-	if (host == NULL) {
+	if (host == NULL || format == NULL) {
 		DEBUG_PRINT("invalid arguments");
 		return -EINVAL;
 	}
 
-	// get variable arguments
+	// get length of assembled fstr
 	va_list args;
 	va_start(args, format);
-	//vsnprintf(msg, TEXT_LEN, format, args);
-
-	// iterate through all available clients, stopping if any fail
-	for (int i = 0; i < host->max_connections; i++) {
-		if (host->clients[i] != NULL) {
-			if (send_fstr_to_client(host->clients[i], format, args) < 0) {
-				DEBUG_PRINT("failed sending at %d", i);
-				return 1;
-			}
-		}
+	int len = vsnprintf(NULL, 0, format, args);
+	va_end(args);
+	if (len < 0) {
+		DEBUG_PRINT("bad format");
+		return -EINVAL;
 	}
 
-	// close access to variable arguments
+	// assemble string into buffer
+	char msg[len + 1];
+	va_start(args, format);
+	vsnprintf(msg, len + 1, format, args);
 	va_end(args);
 
-	DEBUG_PRINT("fstr written to all");
-	return 0;
+	// delegate writing, terminator included
+	return send_buf_to_all(host, msg, len + 1);
 }
-*/
 
 /*
  * Client/Server Utility Functions
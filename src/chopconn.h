@@ -1,15 +1,21 @@
 #ifndef __CHOPCONN_H__
 #define __CHOPCONN_H__
 
-#include <sys/select.h>
-
 #include "chopconst.h"
 
 /*
  * Client/Server Management functions
  */
 
-int accept_new_client(struct server *receiver, const size_t bufsize);
+int accept_new_client(struct server *receiver, const size_t bufsize, struct client **out);
+
+/*
+ * Takes an already accepted connection into the server's client table, in
+ * the slot on top of its free stack. A full table grows by doubling up to the
+ * server's connection_limit; past it, closes the descriptor and returns
+ * -ENOSPC.
+ */
+int adopt_client(struct server *receiver, const int client_fd, const size_t bufsize, struct client **out);
 
 int establish_server_connection(const char *address, const int port, struct client **dest, const int bufsize);
 
@@ -17,14 +23,67 @@ int remove_client_index(const int client_index, struct server *host);
 
 int remove_client_address(const int client_index, struct client **target);
 
-int process_request(struct client *cli, fd_set *all_fds);
+int find_client_index(struct server *host, struct client *cli);
+
+/*
+ * Returns the client owning the given descriptor, NULL if there is none.
+ */
+struct client *find_client_fd(struct server *host, const int fd);
+
+int process_request(struct client *cli);
+
+/*
+ * Admission Functions
+ */
+
+/*
+ * Returns 1 if the server can take another client, counting room it may
+ * still grow into, 0 otherwise.
+ */
+int server_has_room(struct server *host);
+
+/*
+ * Returns 1 if accepting was paused and enough clients have left to take new
+ * ones again, 0 otherwise. A paused server resumes at a low water mark rather
+ * than as soon as a single slot frees.
+ */
+int admission_can_resume(struct server *host);
 
 /*
  * Sending functions
  */
 
+/*
+ * Queues msg_len bytes as START_TEXT behind whatever the client has queued,
+ * then writes as much of its queue as the socket takes without blocking. The
+ * rest is written once the socket has room. Text longer than 255 bytes is
+ * sent ended by END_TEXT.
+ */
 int write_buf_to_client(struct client *cli, const char *msg, const int msg_len);
 
+/*
+ * Queues the serialized packet for every open client of the server table,
+ * each holding a reference to the one copy. With several workers each has a
+ * table of its own, so only this worker's clients are reached. Nothing is
+ * written, see flush_all. Returns the number of clients it was queued for.
+ */
+int fan_out(struct server *host, struct shared *payload);
+
+/*
+ * Writes as much of every open client's queue as its socket takes without
+ * blocking. Returns the number of clients left with packets queued, to be
+ * flushed again once their sockets are writable, or negative on error.
+ */
+int flush_all(struct server *host);
+
+/*
+ * Queues msg_len bytes as START_TEXT for every open client of the server
+ * table, serialized once. Text longer than 255 bytes is sent ended by
+ * END_TEXT. Like fan_out it writes nothing, see flush_all. Returns the
+ * number of clients it was queued for.
+ */
+int send_buf_to_all(struct server *host, const char *msg, const int msg_len);
+
 int send_str_to_all(struct server *host, const char *str);
 
 int send_fstr_to_all(struct server *host, const char *format, ...);
@@ -5,6 +5,9 @@
 
 #include "chopconst.h"
 #include "chopdebug.h"
+#include "choppool.h"
+#include "choptimer.h"
+#include "choptopic.h"
 
 /*
  * Structure Management Functions
@@ -16,14 +19,39 @@ int init_buffer_struct(struct buffer **target, const int size) {
 		return -EINVAL;
 	}
 
+	// allocate structure with buffer memory directly behind it
+	struct buffer *init = (struct buffer *) malloc(sizeof(struct buffer) + sizeof(char) * size);
+	if (init == NULL) {
+		DEBUG_PRINT("malloc");
+		return -ENOMEM;
+	}
+
+	// initialize structure fields
+	init->buf = (char *) (init + 1);
+	init->inbuf = 0;
+	init->bufsize = size;
+	init->next = NULL;
+	init->origin = NULL;
+
+	// set given pointer to new struct
+	*target = init;
+	return 0;
+}
+
+int init_ring_struct(struct ring **target, const int size) {
+	// check valid argument
+	if (target == NULL || size < 1) {
+		return -EINVAL;
+	}
+
 	// allocate structure
-	struct buffer *init = (struct buffer *) malloc(sizeof(struct buffer));
+	struct ring *init = (struct ring *) malloc(sizeof(struct ring));
 	if (init == NULL) {
 		DEBUG_PRINT("malloc, structure");
 		return -ENOMEM;
 	}
 
-	// allocate buffer memory
+	// allocate ring memory
 	char *mem = (char *) malloc(sizeof(char) * size);
 	if (mem == NULL) {
 		DEBUG_PRINT("malloc, memory");
@@ -33,9 +61,9 @@ int init_buffer_struct(struct buffer **target, const int size) {
 
 	// initialize structure fields
 	init->buf = mem;
-	init->inbuf = 0;
-	init->bufsize = size;
-	init->next = NULL;
+	init->start = 0;
+	init->inring = 0;
+	init->ringsize = size;
 
 	// set given pointer to new struct
 	*target = init;
@@ -56,12 +84,59 @@ int init_packet_struct(struct packet **target) {
 	}
 
 	// initialize structure fields
-	init->head = -1;
-	init->status = -1;
-	init->control1 = -1;
-	init->control2 = -1;
-	init->data = NULL;
-	init->datalen = 0;
+	clear_packet_struct(init);
+	init->pool = NULL;
+
+	// set given pointer to new struct
+	*target = init;
+	return 0;
+}
+
+int clear_packet_struct(struct packet *target) {
+	// check valid argument
+	if (target == NULL) {
+		return -EINVAL;
+	}
+
+	// reset every field but the owning pool
+	target->head = -1;
+	target->status = -1;
+	target->control1 = -1;
+	target->control2 = -1;
+	target->data = NULL;
+	target->datalen = 0;
+	target->tail = NULL;
+	target->datasize = 0;
+	target->flags = 0;
+	target->next = NULL;
+	target->shared = NULL;
+	target->extent = 0;
+	target->file_fd = -1;
+	target->file_offset = 0;
+	target->file_left = 0;
+	target->recv_ns = 0;
+	target->queued_ns = 0;
+	return 0;
+}
+
+int init_shared_struct(struct shared **target, const int len) {
+	// check valid argument
+	if (target == NULL || len < HEADER_LEN) {
+		return -EINVAL;
+	}
+
+	// allocate structure with the serialized bytes directly behind it
+	struct shared *init = (struct shared *) malloc(sizeof(struct shared) + sizeof(char) * len);
+	if (init == NULL) {
+		DEBUG_PRINT("malloc");
+		return -ENOMEM;
+	}
+
+	// initialize structure fields
+	init->refs = 1;
+	init->len = len;
+	init->bytes = (char *) (init + 1);
+	init->next = NULL;
 
 	// set given pointer to new struct
 	*target = init;
@@ -83,15 +158,21 @@ int init_server_struct(struct server **target, const int port, const int max_con
 
 	// allocate server client array
 	struct client **mem = (struct client **) malloc(sizeof(struct client *) * max_conns);
-	if (mem == NULL) {
+	int *free_slots = (int *) malloc(sizeof(int) * max_conns);
+	struct client **live = (struct client **) malloc(sizeof(struct client *) * max_conns);
+	if (mem == NULL || free_slots == NULL || live == NULL) {
 		DEBUG_PRINT("malloc, memory");
+		free(mem);
+		free(free_slots);
+		free(live);
 		free(init);
 		return -ENOMEM;
 	}
 
-	// set client array to empty
+	// set client array to empty, lowest slot on top of the free stack
 	for (int i = 0; i < max_conns; i++) {
 		mem[i] = NULL;
+		free_slots[i] = max_conns - 1 - i;
 	}
 
 	// initialize structure fields
@@ -100,13 +181,96 @@ int init_server_struct(struct server **target, const int port, const int max_con
 	init->clients = mem;
 	init->max_connections = max_conns;
 	init->cur_connections = 0;
+	init->connection_limit = max_conns;
+	init->free_slots = free_slots;
+	init->free_count = max_conns;
+	init->live = live;
+	init->by_fd = NULL;
+	init->fd_cap = 0;
+	init->admitting = 1;
+	init->refused = 0;
+	init->admission_pauses = 0;
 	init->connect_queue = queue_len;
+	init->high_water = OUT_HIGH_WATER;
+	init->low_water = OUT_LOW_WATER;
+	init->backpressure_count = 0;
+	init->accepted = 0;
+	init->packets_in = 0;
+	init->bytes_in = 0;
+	init->bytes_out = 0;
+	init->contiguous = 0;
+	init->metrics = NULL;
+
+	// allocate packet pool shared by clients
+	if (init_pool_struct(&(init->pool)) < 0) {
+		DEBUG_PRINT("init pool fail");
+		free(mem);
+		free(free_slots);
+		free(live);
+		free(init);
+		return -ENOMEM;
+	}
+
+	// allocate subscription index
+	if (init_topic_table(&(init->topics)) < 0) {
+		DEBUG_PRINT("init topic table fail");
+		destroy_pool_struct(&(init->pool));
+		free(mem);
+		free(free_slots);
+		free(live);
+		free(init);
+		return -ENOMEM;
+	}
 
 	// set given pointer to new struct
 	*target = init;
 	return 0;
 }
 
+int grow_server_struct(struct server *target, const int max_conns) {
+	// check valid arguments
+	if (target == NULL || max_conns < target->max_connections) {
+		return -EINVAL;
+	}
+
+	// nothing to grow
+	if (max_conns == target->max_connections) {
+		return 0;
+	}
+
+	// only the arrays of pointers move, clients stay where they are
+	struct client **mem = (struct client **) realloc(target->clients, sizeof(struct client *) * max_conns);
+	if (mem == NULL) {
+		DEBUG_PRINT("realloc, clients");
+		return -ENOMEM;
+	}
+	target->clients = mem;
+
+	int *free_slots = (int *) realloc(target->free_slots, sizeof(int) * max_conns);
+	if (free_slots == NULL) {
+		DEBUG_PRINT("realloc, free slots");
+		return -ENOMEM;
+	}
+	target->free_slots = free_slots;
+
+	struct client **live = (struct client **) realloc(target->live, sizeof(struct client *) * max_conns);
+	if (live == NULL) {
+		DEBUG_PRINT("realloc, live clients");
+		return -ENOMEM;
+	}
+	target->live = live;
+
+	// new slots go on the free stack, lowest on top
+	for (int i = max_conns - 1; i >= target->max_connections; i--) {
+		mem[i] = NULL;
+		free_slots[target->free_count++] = i;
+	}
+
+	DEBUG_PRINT("grew from %d to %d slots", target->max_connections, max_conns);
+	target->max_connections = max_conns;
+	return 0;
+}
+
 int init_client_struct(struct client **target, const int size) {
 	// check valid argument
 	if (target == NULL || size < 1) {
@@ -120,12 +284,64 @@ int init_client_struct(struct client **target, const int size) {
 		return -ENOMEM;
 	}
 
+	// allocate receive ring
+	struct ring *recv;
+	if (init_ring_struct(&recv, RECV_RING_LEN) < 0) {
+		DEBUG_PRINT("init ring fail");
+		free(init);
+		return -ENOMEM;
+	}
+
 	// initialize structure fields
 	init->socket_fd = -1;
+	init->slot = -1;
+	init->live_index = -1;
 	init->server_fd = -1;
 	init->inc_flag = -1;
 	init->out_flag = -1;
 	init->window = size;
+	init->recv = recv;
+	init->partial = NULL;
+	init->remaining = 0;
+	init->streaming = 0;
+	init->out_head = NULL;
+	init->out_tail = NULL;
+	init->out_offset = 0;
+	init->out_bytes = 0;
+	init->high_water = OUT_HIGH_WATER;
+	init->low_water = OUT_LOW_WATER;
+	init->throttled = 0;
+	init->backpressure_count = 0;
+	init->packets_in = 0;
+	init->bytes_in = 0;
+	init->bytes_out = 0;
+	init->watched = 0;
+	init->pool = NULL;
+	init->contiguous = 0;
+	init->engine = NULL;
+	timer_setup(&(init->idle_timer), NULL, init);
+	timer_setup(&(init->ack_timer), NULL, init);
+	init->awaiting = -1;
+	init->awaiting_seq = 0;
+	init->ack_mode = SHIFT_IN;
+	init->in_seq = 0;
+	init->out_seq = 0;
+	init->ack_seq = 0;
+	init->ack_pending = 0;
+	init->recv_ns = 0;
+	init->srtt_ns = 0;
+	init->rttvar_ns = 0;
+	init->rtt_last_ns = 0;
+	init->rtt_held_ns = 0;
+	init->rtt_samples = 0;
+	init->idle_mark = 0;
+	init->quiet_ms = 0;
+	init->topics = NULL;
+	init->subs = NULL;
+	init->sub_count = 0;
+	init->sub_cap = 0;
+	init->pending = 0;
+	init->metrics = NULL;
 
 	// set given pointer to new struct
 	*target = init;
@@ -146,7 +362,33 @@ int destroy_buffer_struct(struct buffer **target) {
 	// direct reference to structure
 	struct buffer *old = *target;
 
-	// deallocate data section
+	// return pooled buffer, or deallocate structure and data section together
+	if (old->origin != NULL) {
+		pool_release_buffer(old);
+	} else {
+		free(old);
+	}
+
+	// dereference holder
+	*target = NULL;
+	return 0;
+}
+
+int destroy_ring_struct(struct ring **target) {
+	// check valid argument
+	if (target == NULL) {
+		return -EINVAL;
+	}
+
+	// struct already doesn't exist
+	if (*target == NULL) {
+		return 0;
+	}
+
+	// direct reference to structure
+	struct ring *old = *target;
+
+	// deallocate ring memory
 	free(old->buf);
 
 	// deallocate structure
@@ -176,13 +418,45 @@ int destroy_packet_struct(struct packet **target) {
 	struct buffer *next;
 	for (cur = old->data; cur != NULL; cur = next) {
 		next = cur->next;
-		free(cur->buf);
-		free(cur);
-		cur = NULL;
+		destroy_buffer_struct(&cur);
 	}
 
-	// deallocate structure
-	free(old);
+	// let go of serialized bytes shared with other queues
+	destroy_shared_struct(&(old->shared));
+
+	// a file being sent belongs to its packet
+	if (old->file_fd >= 0) {
+		close(old->file_fd);
+	}
+
+	// return pooled packet, or deallocate structure
+	if (old->pool != NULL) {
+		pool_release_packet(old);
+	} else {
+		free(old);
+	}
+
+	// dereference holder
+	*target = NULL;
+	return 0;
+}
+
+int destroy_shared_struct(struct shared **target) {
+	// check valid argument
+	if (target == NULL) {
+		return -EINVAL;
+	}
+
+	// struct already doesn't exist
+	if (*target == NULL) {
+		return 0;
+	}
+
+	// deallocate structure and bytes together once the last holder lets go
+	struct shared *old = *target;
+	if (--old->refs == 0) {
+		free(old);
+	}
 
 	// dereference holder
 	*target = NULL;
@@ -208,15 +482,22 @@ int destroy_server_struct(struct server **target) {
 		close(old->server_fd);
 	}
 
-	// deallocate remaining clients
-	for (int i = 0; i < old->max_connections; i++) {
-		if (old->clients + i != NULL) destroy_client_struct(old->clients + i);
-		// TODO: make sure the array of client pointers can be iterated along as such
-		//destroy_client_struct(&(old->clients[i])); // alternative option
+	// topics go first, clients only free their own side of a subscription
+	destroy_topic_table(&(old->topics));
+
+	// deallocate remaining clients, all packed at the front of the live array
+	for (int i = 0; i < old->cur_connections; i++) {
+		destroy_client_struct(old->live + i);
 	}
 
 	// deallocate clients section
 	free(old->clients);
+	free(old->free_slots);
+	free(old->live);
+	free(old->by_fd);
+
+	// deallocate pool once no client can hold pooled packets
+	destroy_pool_struct(&(old->pool));
 
 	// deallocate structure
 	free(old);
@@ -240,11 +521,30 @@ int destroy_client_struct(struct client **target) {
 	// direct reference to structure
 	struct client *old = *target;
 
+	// nothing may fire for a client that is gone
+	timer_cancel(&(old->idle_timer));
+	timer_cancel(&(old->ack_timer));
+
 	// close open channels
 	if (old->socket_fd > MIN_FD) {
 		close(old->socket_fd);
 	}
 
+	// deallocate subscriptions, the topics must have dropped the client already
+	free(old->subs);
+
+	// deallocate receive state
+	destroy_ring_struct(&(old->recv));
+	destroy_packet_struct(&(old->partial));
+
+	// deallocate unsent packets
+	struct packet *cur;
+	struct packet *next;
+	for (cur = old->out_head; cur != NULL; cur = next) {
+		next = cur->next;
+		destroy_packet_struct(&cur);
+	}
+
 	// deallocate structure
 	free(old);
 
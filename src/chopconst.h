@@ -26,21 +26,24 @@
 #define ENQUIRY_RETURN 1 // return enquiry signal1=0
 #define ENQUIRY_TIME 2 // sent time in data section
 #define ENQUIRY_RTIME 3 // return time in data section
+#define ENQUIRY_STAMP 4 // control2 - STAMP_LEN, monotonic send time in ns, answered with ENQUIRY_ECHO
+#define ENQUIRY_ECHO 5 // control2 - 3 * STAMP_LEN, the echoed send time, then receive and transmit time
 #define ACKNOWLEDGE 6 // signal was received, control1 is recieved status
 #define WAKEUP 7 // wake sleeping connection
 
-#define SHIFT_OUT 14 // TODO
-#define SHIFT_IN 15 // TODO
-#define START_DATA 16 // TODO
+#define SHIFT_OUT 14 // acknowledge in blocks from the next packet on, see END_TRANSMISSION_BLOCK
+#define SHIFT_IN 15 // acknowledge every packet on its own again
+#define START_DATA 16 // an 8 byte body length follows the header, the body is streamed rather than held
 #define CONTROL_ONE 17 // special action 1
 #define CONTROL_TWO 18 // special action 2
 #define CONTROL_THREE 19 // special action 3
 #define CONTROL_FOUR 20 // special action 4
 #define NEG_ACKNOWLEDGE 21 // received status/message is incorrect/invalid, control1 is status
 #define IDLE 22 // go to sleep, only accept wakeup or escape as signals
-#define END_TRANSMISSION_BLOCK 23 // TODO
+#define END_TRANSMISSION_BLOCK 23 // control1 of an ACKNOWLEDGE for a block, control2 - ACK_BLOCK_LEN
+// data holds the sequence of the last packet acknowledged, then how many were, 4 bytes each
 #define CANCEL 24 // flag marker for closing connections, should not be sent in a packet
-#define END_OF_MEDIUM 25 // TODO
+#define END_OF_MEDIUM 25 // asks for the server's metrics, control1 is a METRICS_ request
 #define SUBSTITUTE 26 // TODO
 #define ESCAPE 27 // Disconnect, waits for acknowledge (useful for cleanup)
 #define FILE_SEPARATOR 28 // TODO
@@ -48,11 +51,36 @@
 #define RECORD_SEPARATOR 30 // TODO
 #define UNIT_SEPARATOR 31 // TODO
 
+/// Topic Statuses, a topic name of control1 bytes opens the data section
+#define SUBSCRIBE CONTROL_ONE // receive what is published to the topic
+#define UNSUBSCRIBE CONTROL_TWO // stop receiving from the topic
+#define PUBLISH CONTROL_THREE // control2 - message length, the message follows the name
+#define DELIVER CONTROL_FOUR // a publish as relayed to subscribers, same layout
+
+/// Metrics Requests, control1 of an END_OF_MEDIUM
+#define METRICS_QUERY 0 // send the metrics of every worker
+#define METRICS_REPORT 1 // the answer, text ended by END_TEXT
+
 /*
  * General Macros
  */
 
 #define MIN_FD 0
+#define RECV_RING_LEN 16384 // bytes a client can have read but not yet parsed
+#define BODY_DELIMITED -1 // body length is unknown until END_TEXT is seen
+#define OUT_HIGH_WATER 65536 // queued outbound bytes that pause reading from a peer
+#define OUT_LOW_WATER 16384 // queued outbound bytes that resume reading from a peer
+#define ADMIT_RESUME_SHARE 8 // a full server accepts again once an eighth of its limit is free
+#define DATA_LEN_BYTES 8 // width of START_DATA's body length, most significant byte first
+#define DATA_FILE_CHUNK 1048576 // most file bytes handed to a single sendfile
+#define ACK_BLOCK_LEN 8 // data bytes of an acknowledge for a block
+#define STAMP_LEN 8 // bytes of a nanosecond time in an enquiry, most significant first
+
+/// Refusal Reasons, control2 of a NEG_ACKNOWLEDGE for NULL_BYTE refusing a connection
+#define REFUSE_FULL 1 // server has no room for another client
+
+/// Packet Flags
+#define PACKET_CONTIGUOUS 0x1 // data section is one segment grown as needed
 
 /*
  * Type Definitions
@@ -63,15 +91,52 @@ typedef unsigned char pack_stat;
 typedef unsigned char pack_con1;
 typedef unsigned char pack_con2;
 
+/*
+ * Structure-Relevant Macros
+ */
+
+#define HEADER_LEN ((int) (sizeof(pack_head) + sizeof(pack_stat) + sizeof(pack_con1) + sizeof(pack_con2)))
+
 /*
  * Structures
  */
 
+struct metrics;
+struct pool;
+struct slab_class;
+struct subscription;
+struct timer_wheel;
+struct topic_table;
+
+struct timer {
+	struct timer *next; // next timer in the same slot
+	struct timer **pprev; // link pointing at this timer, NULL while unarmed
+	long expires; // tick the timer fires on
+	void (*callback)(struct timer_wheel *wheel, struct timer *timer);
+	void *arg;
+	struct timer_wheel *wheel; // wheel the timer was last armed on
+};
+
 struct buffer {
 	char *buf;
 	int inbuf;
 	int bufsize;
 	struct buffer *next;
+	struct slab_class *origin; // slab class the buffer returns to, NULL if allocated alone
+};
+
+struct shared {
+	int refs; // queued packets still pointing at the bytes, only touched by the owning worker
+	int len; // bytes on the wire, header included
+	char *bytes; // serialized packet, never changed once built
+	struct shared *next; // next payload waiting in a relay queue
+};
+
+struct ring {
+	char *buf;
+	int start; // index of the first unread byte
+	int inring; // number of unread bytes
+	int ringsize;
 };
 
 struct packet {
@@ -79,51 +144,145 @@ struct packet {
 	pack_stat status;
 	pack_con1 control1;
 	pack_con2 control2;
+	char header[HEADER_LEN]; // the fields above as they travel, encoded when queued
 	struct buffer *data;
-	int datalen;
+	int datalen; // number of segments in data
+	struct buffer *tail; // last segment in data
+	int datasize; // bytes held across every segment in data
+	int flags;
+	struct packet *next; // next packet in an outbound queue
+	struct shared *shared; // serialized form sent in place of the header and data, NULL if none
+	long extent; // START_DATA body length, not counted in datasize
+	int file_fd; // descriptor the START_DATA body is sent from, -1 if none
+	long file_offset; // where the unsent part of the body starts in file_fd
+	long file_left; // body bytes not yet sent from file_fd
+	long recv_ns; // when the bytes holding the header were read, if metrics are kept
+	long queued_ns; // when the packet was queued, if metrics are kept
+	struct pool *pool; // pool the packet returns to, NULL if allocated alone
 };
 
 struct server {
 	int server_fd;
 	int server_port;
 	struct sockaddr_in address;
-	struct client **clients; // array of client pointers
+	struct client **clients; // array of client pointers, a client keeps its slot until removed
 	int max_connections;
 	int cur_connections;
+	int connection_limit; // most slots the array may grow to when full
+	int *free_slots; // stack of empty slots, the next one to fill on top
+	int free_count;
+	struct client **live; // every client packed at the front, in no particular order
+	struct client **by_fd; // client owning each descriptor, NULL if none
+	int fd_cap;
+	int admitting; // whether the listening socket is being accepted from
+	long refused; // connections turned away for lack of room
+	long admission_pauses; // times accepting stopped because the server was full
 	int connect_queue;
+	int high_water; // outbound watermarks given to each accepted client
+	int low_water;
+	long backpressure_count; // times reading was paused for removed clients
+	long accepted; // clients accepted since the server started
+	long packets_in; // packets parsed from removed clients
+	long bytes_in; // bytes read from removed clients
+	long bytes_out; // bytes written to removed clients
+	struct pool *pool; // packets and buffers shared by every client
+	int contiguous; // whether accepted clients grow text of unknown length in one buffer
+	struct topic_table *topics; // subscriptions of every client
+	struct metrics *metrics; // given to accepted clients, NULL if none are kept
 };
 
 struct client {
 	struct sockaddr_in address;
 	int socket_fd; // fd of the client
+	int slot; // index in the server's clients, -1 if not held by a server
+	int live_index; // index in the server's live array
 	int server_fd; // fd of the server this client is attached to, -1 if client
 	pack_stat inc_flag; // what the client is receiving
 	pack_stat out_flag; // what the client is sending
 	int window; // how much data the client can pass at once
+	struct ring *recv; // bytes read from the socket, not yet parsed
+	struct packet *partial; // packet being assembled across reads, if any
+	int remaining; // body bytes the partial packet is still waiting on
+	long streaming; // START_DATA body bytes still to be handed on as they arrive
+	struct packet *out_head; // packets waiting to be written, oldest first
+	struct packet *out_tail;
+	int out_offset; // bytes of out_head already written
+	int out_bytes; // bytes waiting in the outbound queue
+	int high_water; // pause reading from the peer at this many queued bytes
+	int low_water; // resume reading once the queue drains to this many bytes
+	int throttled; // reading is paused until the queue drains
+	long backpressure_count; // times reading was paused
+	long packets_in; // packets parsed from the peer
+	long bytes_in; // bytes read from the peer
+	long bytes_out; // bytes written to the peer
+	int watched; // event flags currently watched for this client
+	struct pool *pool; // where packets for this client come from, NULL for malloc
+	int contiguous; // grow text of unknown length in one buffer instead of a chain
+	void *engine; // state kept for the client by a completion engine, if any
+	struct timer idle_timer; // checks the peer for silence every keepalive interval
+	struct timer ack_timer; // deadline for the acknowledge of the awaited status
+	int awaiting; // status sent that waits on an acknowledge, -1 if none
+	unsigned int awaiting_seq; // sequence of the packet that sent it
+	int ack_mode; // SHIFT_OUT while the peer takes acknowledges in blocks, SHIFT_IN otherwise
+	unsigned int in_seq; // packets parsed from the peer, counted from its last SHIFT_OUT
+	unsigned int out_seq; // packets queued for the peer, counted from the last SHIFT_OUT
+	unsigned int ack_seq; // sequence of the last packet in the pending block
+	int ack_pending; // acknowledges held back for the pending block
+	long idle_mark; // bytes_in when the idle timer last fired
+	long quiet_ms; // time the peer has been silent, as seen by the idle timer
+	long recv_ns; // when bytes were last read from the peer, on the monotonic clock
+	long srtt_ns; // smoothed round trip time to the peer, 0 before the first sample
+	long rttvar_ns; // how far round trips stray from srtt_ns
+	long rtt_last_ns; // latest round trip, from sending a stamp to its echo
+	long rtt_held_ns; // time the peer held the latest stamp before echoing it
+	long rtt_samples; // echoes taken into the estimate
+	struct topic_table *topics; // where subscriptions are kept, NULL if the peer cannot subscribe
+	struct subscription *subs; // topics the peer subscribed to
+	int sub_count;
+	int sub_cap;
+	int pending; // on the worker's list of clients to write out this turn
+	struct metrics *metrics; // where traffic and latencies are counted, NULL if nowhere
 };
 
-/*
- * Structure-Relevant Macros
- */
-
-#define HEADER_LEN sizeof(pack_head) + sizeof(pack_stat) + sizeof(pack_con1) + sizeof(pack_con2)
-
 /*
  * Structure Management Functions
  */
 
 int init_buffer_struct(struct buffer **target, const int size);
 
+int init_ring_struct(struct ring **target, const int size);
+
 int init_packet_struct(struct packet **target);
 
+int clear_packet_struct(struct packet *target);
+
+/*
+ * Allocates room for a serialized packet of len bytes, holding the only
+ * reference to it.
+ */
+int init_shared_struct(struct shared **target, const int len);
+
 int init_server_struct(struct server **target, const int port, const int max_conns, const int queue_len);
 
+/*
+ * Grows the server's client array to max_conns slots. Clients already held
+ * keep their slots and are never moved.
+ */
+int grow_server_struct(struct server *target, const int max_conns);
+
 int init_client_struct(struct client **target, const int size);
 
 int destroy_buffer_struct(struct buffer **target);
 
+int destroy_ring_struct(struct ring **target);
+
 int destroy_packet_struct(struct packet **target);
 
+/*
+ * Drops the given reference, deallocating the bytes once no queue holds them.
+ */
+int destroy_shared_struct(struct shared **target);
+
 int destroy_server_struct(struct server **target);
 
 int destroy_client_struct(struct client **target);
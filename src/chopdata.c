@@ -2,11 +2,22 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
+#include "chopcodec.h"
 #include "chopconst.h"
 #include "chopdata.h"
 #include "chopdebug.h"
+#include "chopmetrics.h"
 #include "choppacket.h"
+#include "choptimer.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
 
 int fill_buf(struct buffer *buffer, const int input) {
 	// check valid inputs
@@ -41,6 +52,140 @@ int fill_buf(struct buffer *buffer, const int input) {
 	return 0;
 }
 
+int fill_ring(struct client *cli) {
+	// check valid inputs
+	if (cli == NULL || cli->recv == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// ring full case
+	struct ring *ring = cli->recv;
+	int space = ring->ringsize - ring->inring;
+	if (space == 0) {
+		DEBUG_PRINT("ring full");
+		return -ENOSPC;
+	}
+
+	// open space may wrap around the end of the ring
+	int tail = (ring->start + ring->inring) % ring->ringsize;
+	int first = ring->ringsize - tail;
+	if (first > space) first = space;
+
+	struct iovec iov[2];
+	iov[0].iov_base = ring->buf + tail;
+	iov[0].iov_len = first;
+	iov[1].iov_base = ring->buf;
+	iov[1].iov_len = space - first;
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = (space > first) ? 2 : 1;
+
+	// read as much as possible without waiting
+	ssize_t readlen = recvmsg(cli->socket_fd, &msg, MSG_DONTWAIT);
+	if (readlen < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return -EAGAIN;
+		}
+		DEBUG_PRINT("read fail");
+		return -errno;
+	} else if (readlen == 0) {
+		DEBUG_PRINT("socket closed");
+		cli->inc_flag = CANCEL;
+		cli->out_flag = CANCEL;
+		return 0;
+	}
+
+	// increment ring's written space
+	ring->inring += readlen;
+	cli->bytes_in += readlen;
+	cli->recv_ns = timer_now_ns();
+
+	DEBUG_PRINT("read %d of %d open", (int) readlen, space);
+	return readlen;
+}
+
+int ring_read(struct ring *ring, char *dest, const int len) {
+	// check valid inputs
+	if (ring == NULL || dest == NULL || len < 0) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// only hand out what has been received
+	int count = (len > ring->inring) ? ring->inring : len;
+
+	// copy up to the end of the ring, then from the front
+	int first = ring->ringsize - ring->start;
+	if (first > count) first = count;
+	memcpy(dest, ring->buf + ring->start, first);
+	memcpy(dest + first, ring->buf, count - first);
+
+	// release read bytes, rewinding when empty keeps reads contiguous
+	ring->inring -= count;
+	ring->start = (ring->inring == 0) ? 0 : (ring->start + count) % ring->ringsize;
+
+	return count;
+}
+
+int ring_peek(struct ring *ring, char *dest, const int len) {
+	// check valid inputs
+	if (ring == NULL || dest == NULL || len < 0) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// copy like a read, leaving the bytes in place
+	int count = (len > ring->inring) ? ring->inring : len;
+	int first = ring->ringsize - ring->start;
+	if (first > count) first = count;
+	memcpy(dest, ring->buf + ring->start, first);
+	memcpy(dest + first, ring->buf, count - first);
+
+	return count;
+}
+
+int ring_skip(struct ring *ring, const int len) {
+	// check valid inputs
+	if (ring == NULL || len < 0) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// only release what has been received
+	int count = (len > ring->inring) ? ring->inring : len;
+
+	ring->inring -= count;
+	ring->start = (ring->inring == 0) ? 0 : (ring->start + count) % ring->ringsize;
+
+	return count;
+}
+
+int ring_write(struct ring *ring, const char *src, const int len) {
+	// check valid inputs
+	if (ring == NULL || src == NULL || len < 0) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// only fill the open space
+	int count = ring->ringsize - ring->inring;
+	if (count > len) count = len;
+
+	// open space may wrap around the end of the ring
+	int tail = (ring->start + ring->inring) % ring->ringsize;
+	int first = ring->ringsize - tail;
+	if (first > count) first = count;
+
+	memcpy(ring->buf + tail, src, first);
+	memcpy(ring->buf, src + first, count - first);
+	ring->inring += count;
+
+	return count;
+}
+
 int read_data(struct client *cli, struct packet *pack, int remaining) {
 	// check valid inputs
 	if (cli == NULL || pack == NULL || remaining < 0) {
@@ -53,47 +198,36 @@ int read_data(struct client *cli, struct packet *pack, int remaining) {
 		return 0;
 	}
 
-	int buffers = remaining / cli->window + (remaining % cli->window != 0);
+	// the tail may have room left from an earlier read
+	struct buffer *receive = pack->tail;
 
-	// loop as many times as new buffers are needed
+	// move as much of the body as has been received
 	int total = 0;
 	int expected;
 	int bytes_read;
-	struct buffer *receive;
-	for (int i = 0; i < buffers; i++) {
+	while (remaining > 0 && cli->recv->inring > 0) {
 
 		// allocate more space to hold data
-		if (append_buffer(pack, cli->window, &receive) < 0) {
-			DEBUG_PRINT("fail allocate buffer %d", i);
-			return -ENOMEM;
+		if (receive == NULL || receive->inbuf == receive->bufsize) {
+			if (append_buffer(pack, cli->window, &receive) < 0) {
+				DEBUG_PRINT("fail allocate buffer %d", pack->datalen);
+				return -ENOMEM;
+			}
 		}
 
 		// read expected bytes per data segment
-		expected = (receive->bufsize > remaining) ? remaining : receive->bufsize;
-		bytes_read = read(cli->socket_fd, receive->buf, expected);
-		if (bytes_read != expected) {
-			// in case read isn't perfect
-			if (bytes_read < 0) {
-				DEBUG_PRINT("failed data read");
-				return -errno;
-			} else if (bytes_read == 0) {
-				DEBUG_PRINT("socket closed");
-                cli->inc_flag = CANCEL;
-                cli->out_flag = CANCEL;
-				return -1;
-			} else {
-				DEBUG_PRINT("incomplete data read, %d remaining", expected - bytes_read);
-				return -1;
-			}
-		}
+		expected = receive->bufsize - receive->inbuf;
+		if (expected > remaining) expected = remaining;
+		bytes_read = ring_read(cli->recv, receive->buf + receive->inbuf, expected);
 
 		// update tracker fields
 		remaining -= bytes_read;
 		total += bytes_read;
-		receive->inbuf = bytes_read;
+		receive->inbuf += bytes_read;
+		pack->datasize += bytes_read;
 	}
 
-	DEBUG_PRINT("data section length %d, %d segments", total, buffers);
+	DEBUG_PRINT("data section read %d, %d remaining", total, remaining);
 	return total;
 }
 
@@ -104,174 +238,495 @@ int read_header(struct client *cli, struct packet *pack) {
         return -EINVAL;
     }
 
+    // header has not fully arrived yet
+    if (cli->recv->inring < HEADER_LEN) {
+        DEBUG_PRINT("incomplete header, %d buffered", cli->recv->inring);
+        return -EAGAIN;
+    }
+
     // buffer to receive header
     char header[HEADER_LEN];
-
-    // read packet from client
-    int head_read = read(cli->socket_fd, header, HEADER_LEN);
-    if (head_read != HEADER_LEN) {
-
-        // in case read isn't perfect
-        if (head_read < 0) {
-            DEBUG_PRINT("failed header read");
-            return -errno;
-        } else if (head_read == 0) {
-            DEBUG_PRINT("socket closed");
-            cli->inc_flag = CANCEL;
-            cli->out_flag = CANCEL;
-            return -1;
-        } else {
-            DEBUG_PRINT("incomplete header read");
-            return -1;
-        }
-    }
+    int head_read = ring_read(cli->recv, header, HEADER_LEN);
 
     // move buffer to packet fields
-    memmove(pack, header, HEADER_LEN);
+    struct packet_view view;
+    codec_decode_header(header, head_read, &view);
+    assemble_header(pack, view.head, view.status, view.control1, view.control2);
 
     // print incoming header
     DEBUG_PRINT(dbg_pack, pack->head, stat_to_str(pack->status), pack->control1, pack->control2);
-
-    // TODO: this is very platform dependent
     DEBUG_PRINT("read header, style %d, width %d", packet_style(pack), head_read);
     return 0;
 }
 
-int write_packet(struct client *cli, struct packet *pack) {
+int read_extent(struct client *cli, struct packet *pack) {
+	// precondition for invalid argument
+	if (cli == NULL || pack == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// length has not fully arrived yet
+	if (cli->recv->inring < DATA_LEN_BYTES) {
+		return -EAGAIN;
+	}
+
+	char len[DATA_LEN_BYTES];
+	ring_read(cli->recv, len, DATA_LEN_BYTES);
+
+	// most significant byte first, whatever the host's order
+	pack->extent = (long) codec_get_be(len, DATA_LEN_BYTES);
+
+	DEBUG_PRINT("data section of %ld", pack->extent);
+	return (pack->extent < 0) ? -EOVERFLOW : 0;
+}
+
+int send_file_body(struct client *cli, struct packet *pack) {
+	// precondition for invalid arguments
+	if (cli == NULL || pack == NULL || pack->file_fd < 0) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// the kernel moves the body from the file, it never enters the process
+	while (pack->file_left > 0) {
+		size_t count = (pack->file_left > DATA_FILE_CHUNK) ? DATA_FILE_CHUNK : pack->file_left;
+		ssize_t sent = sendfile(cli->socket_fd, pack->file_fd, &(pack->file_offset), count);
+		if (sent < 0) {
+			if (errno == EINTR) {
+				continue;
+			} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 1;
+			}
+			DEBUG_PRINT("failed file send");
+			return -errno;
+		} else if (sent == 0) {
+			// file is shorter than the length the peer was promised
+			DEBUG_PRINT("file ended, %ld left", pack->file_left);
+			return -EIO;
+		}
+
+		pack->file_left -= sent;
+		cli->bytes_out += sent;
+	}
+
+	DEBUG_PRINT("file body of %ld sent", pack->extent);
+	return 0;
+}
+
+int enqueue_packet(struct client *cli, struct packet *pack) {
     // precondition for invalid arguments
     if (cli == NULL || pack == NULL) {
         DEBUG_PRINT("invalid arguments");
         return -EINVAL;
     }
 
-    // mark client outgoing flag with status
-    cli->out_flag = pack->status;
+    // replies keep their order, acknowledges held back go out first
+    if (cli->ack_pending > 0) {
+        send_ack_block(cli);
+    }
 
-    // write header packet to target
-    ssize_t head_written = write(cli->socket_fd, (void *) pack, HEADER_LEN);
-    if (head_written != HEADER_LEN) {
-        // in case write was not perfectly successful
-        if (head_written < 0) {
-            DEBUG_PRINT("failed header write");
-            return -errno;
-        } else if (head_written == 0) {
-            DEBUG_PRINT("socket closed");
-            return -1; // TODO: what to return?
+    // count the bytes this packet puts on the wire
+    int bytes = HEADER_LEN + pack->datasize;
+
+    // the header is sent from its encoded form, not from the structure
+    codec_encode_header(pack->header, HEADER_LEN, pack->head, pack->status, pack->control1, pack->control2);
+
+    // queue takes ownership of the packet
+    pack->next = NULL;
+    if (cli->out_tail == NULL) {
+        cli->out_head = pack;
+    } else {
+        cli->out_tail->next = pack;
+    }
+    cli->out_tail = pack;
+    cli->out_bytes += bytes;
+    cli->out_seq = (pack->status == SHIFT_OUT) ? 0 : cli->out_seq + 1;
+    if (cli->metrics != NULL) {
+        pack->queued_ns = timer_now_ns();
+    }
+
+    // peer is not keeping up, stop taking requests from it
+    if (!cli->throttled && cli->out_bytes >= cli->high_water) {
+        DEBUG_PRINT("client %d over high water, %d queued", cli->socket_fd, cli->out_bytes);
+        cli->throttled = 1;
+        cli->backpressure_count++;
+    }
+
+    // print outgoing header
+    DEBUG_PRINT(dbg_pack, pack->head, stat_to_str(pack->status), pack->control1, pack->control2);
+    return 0;
+}
+
+int gather_queue(struct client *cli, struct iovec *iov, const int max) {
+    // precondition for invalid arguments
+    if (cli == NULL || iov == NULL || max < 1) {
+        DEBUG_PRINT("invalid arguments");
+        return -EINVAL;
+    }
+
+    // gather queued packets, skipping what was written by an earlier flush
+    int iovcnt = 0;
+    int skip = cli->out_offset;
+    struct packet *pack;
+    for (pack = cli->out_head; pack != NULL && iovcnt < max; pack = pack->next) {
+        // serialized packets go out as a single entry
+        if (pack->shared != NULL) {
+            if (skip < pack->shared->len) {
+                iov[iovcnt].iov_base = pack->shared->bytes + skip;
+                iov[iovcnt].iov_len = pack->shared->len - skip;
+                iovcnt++;
+                skip = 0;
+            } else {
+                skip -= pack->shared->len;
+            }
+            continue;
+        }
+
+        if (skip < HEADER_LEN) {
+            iov[iovcnt].iov_base = pack->header + skip;
+            iov[iovcnt].iov_len = HEADER_LEN - skip;
+            iovcnt++;
+            skip = 0;
         } else {
-            DEBUG_PRINT("incomplete header write");
-            return -1; // TODO: what to return?
+            skip -= HEADER_LEN;
         }
-    }
 
-    // loop through all buffers in packet's data section
-    int total = 0;
-    int tracker = 0;
-    ssize_t bytes_written;
-    struct buffer *segment;
-    for (segment = pack->data; segment != NULL; segment = segment->next) {
-
-        // write buffer to target (if any)
-        bytes_written = write(cli->socket_fd, segment->buf, segment->inbuf);
-        if (bytes_written != segment->inbuf) {
-            // in case write was not perfectly successful
-            if (bytes_written < 0) {
-                DEBUG_PRINT("failed data write, segment %d", tracker);
-                return -errno;
-            } else if (bytes_written == 0) {
-                DEBUG_PRINT("socket closed");
-                return -1; // TODO: what to return?
+        struct buffer *segment;
+        for (segment = pack->data; segment != NULL && iovcnt < max; segment = segment->next) {
+            if (skip < segment->inbuf) {
+                iov[iovcnt].iov_base = segment->buf + skip;
+                iov[iovcnt].iov_len = segment->inbuf - skip;
+                iovcnt++;
+                skip = 0;
             } else {
-                DEBUG_PRINT("incomplete data write, segment %d", tracker);
-                return -1; // TODO: what to return?
+                skip -= segment->inbuf;
             }
         }
 
-        // track depth into data section, as well as total data length
-        tracker++;
-        total += bytes_written;
+        // nothing may overtake a file body still to be sent
+        if (pack->file_left > 0) {
+            break;
+        }
     }
 
-    // demark client outgoing flag
-    cli->out_flag = 0;
+    return iovcnt;
+}
 
-    // print outgoing header
-    DEBUG_PRINT(dbg_pack, pack->head, stat_to_str(pack->status), pack->control1, pack->control2);
+int advance_queue(struct client *cli, const int written) {
+    // precondition for invalid arguments
+    if (cli == NULL || written < 0) {
+        DEBUG_PRINT("invalid arguments");
+        return -EINVAL;
+    }
+
+    // release packets that were written completely
+    cli->out_bytes -= written;
+    cli->bytes_out += written;
+    int done = cli->out_offset + written;
+    long now = (cli->metrics != NULL) ? timer_now_ns() : 0;
+    while (cli->out_head != NULL) {
+        struct packet *pack = cli->out_head;
+        int bytes = HEADER_LEN + pack->datasize;
+        if (done < bytes || pack->file_left > 0) {
+            break;
+        }
+
+        // a file body counts with the packet it followed
+        if (cli->metrics != NULL) {
+            long body = (pack->file_fd >= 0) ? pack->extent : 0;
+            metrics_packet_out(cli->metrics, pack->status, bytes + body, now - pack->queued_ns);
+        }
+
+        done -= bytes;
+        cli->out_head = pack->next;
+        destroy_packet_struct(&pack);
+    }
+    if (cli->out_head == NULL) {
+        cli->out_tail = NULL;
+    }
+    cli->out_offset = done;
 
-    // TODO: this is very platform dependent
-    DEBUG_PRINT("packet style %d, %d bytes header, %d bytes body", packet_style(pack), head_written, total);
-    return total;
+    // peer caught up, resume taking requests from it
+    if (cli->throttled && cli->out_bytes <= cli->low_water) {
+        DEBUG_PRINT("client %d under low water, %d queued", cli->socket_fd, cli->out_bytes);
+        cli->throttled = 0;
+    }
+
+    return (cli->out_head != NULL);
 }
 
-int find_newline(const char *buf, const int len) {
-	// check valid arguments
-	if (buf == NULL || len < 1) {
-		DEBUG_PRINT("invalid arguments");
-		return -EINVAL;
+int flush_queue(struct client *cli) {
+    // precondition for invalid arguments
+    if (cli == NULL) {
+        DEBUG_PRINT("invalid arguments");
+        return -EINVAL;
+    }
+
+    // everything acknowledged this turn goes out as one packet
+    send_ack_block(cli);
+
+    struct iovec iov[UIO_MAXIOV];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+
+    while (cli->out_head != NULL) {
+        // a file body goes out on its own once its header is written
+        struct packet *head = cli->out_head;
+        if (head->file_left > 0 && cli->out_offset == HEADER_LEN + head->datasize) {
+            int ret = send_file_body(cli, head);
+            if (ret == 1) {
+                DEBUG_PRINT("client %d socket full, %ld file bytes left", cli->socket_fd, head->file_left);
+                break;
+            } else if (ret < 0) {
+                DEBUG_PRINT("failed file flush");
+                cli->inc_flag = CANCEL;
+                cli->out_flag = CANCEL;
+                return ret;
+            }
+            advance_queue(cli, 0);
+            continue;
+        }
+
+        int iovcnt = gather_queue(cli, iov, UIO_MAXIOV);
+
+        // write as much as the socket will take without waiting
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        ssize_t written = sendmsg(cli->socket_fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                DEBUG_PRINT("client %d socket full, %d queued", cli->socket_fd, cli->out_bytes);
+                break;
+            }
+            DEBUG_PRINT("failed queue flush");
+            cli->inc_flag = CANCEL;
+            cli->out_flag = CANCEL;
+            return -errno;
+        }
+
+        advance_queue(cli, written);
+    }
+
+    // peer caught up, resume taking requests from it
+    if (cli->throttled && cli->out_bytes <= cli->low_water) {
+        DEBUG_PRINT("client %d under low water, %d queued", cli->socket_fd, cli->out_bytes);
+        cli->throttled = 0;
+    }
+
+    return (cli->out_head != NULL);
+}
+
+/*
+ * Byte Scanning Kernels
+ */
+
+static int scan_scalar(const char *buf, const int len, const char symbol) {
+	for (int index = 0; index < len; index++) {
+		if (buf[index] == symbol) {
+			return index;
+		}
 	}
+	return -1;
+}
 
-	// first element case
-	if (buf[0] == '\n') {
-		DEBUG_PRINT("unix newline at 0");
-		return 0;
+#ifdef SCAN_X86
+__attribute__((target("sse2")))
+static int scan_sse2(const char *buf, const int len, const char symbol) {
+	__m128i needle = _mm_set1_epi8(symbol);
+
+	// compare 16 bytes at a time, the first set mask bit is the first match
+	int index = 0;
+	for (; index + 16 <= len; index += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *) (buf + index));
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+		if (mask != 0) {
+			return index + __builtin_ctz(mask);
+		}
 	}
 
-	// loop through buffer until first newline is found
-	int index;
-	for (index = 1; index < len; index++) {
-		// network newline
-		if (buf[index - 1] == '\r' && buf[index] == '\n') {
-			DEBUG_PRINT("network newline at %d", index);
-			return index;
+	// finish the bytes that do not fill a vector
+	int rest = scan_scalar(buf + index, len - index, symbol);
+	return (rest < 0) ? -1 : index + rest;
+}
+
+__attribute__((target("avx2")))
+static int scan_avx2(const char *buf, const int len, const char symbol) {
+	__m256i needle = _mm256_set1_epi8(symbol);
+
+	// compare 64 bytes per pass, only locating the match once one is seen
+	int index = 0;
+	for (; index + 64 <= len; index += 64) {
+		__m256i low = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (buf + index)), needle);
+		__m256i high = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (buf + index + 32)), needle);
+		if (!_mm256_testz_si256(_mm256_or_si256(low, high), _mm256_or_si256(low, high))) {
+			unsigned int mask = _mm256_movemask_epi8(low);
+			if (mask != 0) {
+				return index + __builtin_ctz(mask);
+			}
+			return index + 32 + __builtin_ctz((unsigned int) _mm256_movemask_epi8(high));
+		}
+	}
+
+	for (; index + 32 <= len; index += 32) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i *) (buf + index));
+		unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+		if (mask != 0) {
+			return index + __builtin_ctz(mask);
+		}
+	}
+
+	// half vectors stay in this function, mixing in sse2 code stalls on the
+	// switch between encodings
+	__m128i half = _mm_set1_epi8(symbol);
+	for (; index + 16 <= len; index += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *) (buf + index));
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, half));
+		if (mask != 0) {
+			return index + __builtin_ctz(mask);
 		}
+	}
 
-		// unix newline
-		if (buf[index - 1] != '\r' && buf[index] == '\n') {
-			DEBUG_PRINT("unix newline at %d", index);
+	// finish the bytes that do not fill a vector
+	for (; index < len; index++) {
+		if (buf[index] == symbol) {
 			return index;
 		}
 	}
+	return -1;
+}
+#endif
+
+static const int scan_kernel_len = 3;
+static const char *scan_kernel_str[] = {
+		"scalar",
+		"sse2",
+		"avx2"};
+
+static int scan_resolve(const char *buf, const int len, const char symbol);
+
+// replaced by the fastest supported kernel on first use
+static int (*scan_kernel)(const char *, const int, const char) = scan_resolve;
+static int scan_kernel_index = 0;
+
+static int scan_supported(const int index) {
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+	switch (index) {
+		case 0:
+			return 1;
+		case 1:
+			return __builtin_cpu_supports("sse2");
+		case 2:
+			return __builtin_cpu_supports("avx2");
+	}
+#endif
+	return index == 0;
+}
+
+static void scan_install(const int index) {
+#ifdef SCAN_X86
+	if (index == 2) {
+		scan_kernel = scan_avx2;
+	} else if (index == 1) {
+		scan_kernel = scan_sse2;
+	} else {
+		scan_kernel = scan_scalar;
+	}
+#else
+	scan_kernel = scan_scalar;
+#endif
+	scan_kernel_index = index;
+}
+
+static int scan_resolve(const char *buf, const int len, const char symbol) {
+	// take the widest kernel the processor supports
+	int index = scan_kernel_len - 1;
+	while (!scan_supported(index)) {
+		index--;
+	}
+	scan_install(index);
+
+	DEBUG_PRINT("using %s scan kernel", scan_kernel_str[index]);
+	return scan_kernel(buf, len, symbol);
+}
+
+int select_scan_kernel(const char *name) {
+	// check valid arguments
+	if (name == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	for (int i = 0; i < scan_kernel_len; i++) {
+		if (strcmp(name, scan_kernel_str[i]) == 0) {
+			if (!scan_supported(i)) {
+				DEBUG_PRINT("%s unsupported", name);
+				return -ENOTSUP;
+			}
+			scan_install(i);
+			return 0;
+		}
+	}
 
-	// nothing found
-	DEBUG_PRINT("none found");
 	return -ENOENT;
 }
 
-int remove_newline(char *buf, const int len) {
+const char *scan_kernel_name(void) {
+	// resolve the default kernel if nothing was scanned yet
+	if (scan_kernel == scan_resolve) {
+		scan_resolve("", 0, 0);
+	}
+
+	return scan_kernel_str[scan_kernel_index];
+}
+
+int find_newline(const char *buf, const int len) {
 	// check valid arguments
 	if (buf == NULL || len < 1) {
 		DEBUG_PRINT("invalid arguments");
 		return -EINVAL;
 	}
 
-	// first element case
-	if (buf[0] == '\n') {
-		DEBUG_PRINT("unix newline at 0");
-		buf[0] = '\0';
-		return 0;
+	// the first '\n' ends either kind of newline
+	int index = scan_kernel(buf, len, '\n');
+	if (index < 0) {
+		DEBUG_PRINT("none found");
+		return -ENOENT;
 	}
 
-	// loop through buffer until first newline is found
-	int index;
-	for (index = 1; index < len; index++) {
-		// network newline
-		if (buf[index - 1] == '\r' && buf[index] == '\n') {
-			DEBUG_PRINT("network newline at %d", index);
-			buf[index - 1] = '\0';
-			buf[index] = '\0';
-			return index;
-		}
+	if (index > 0 && buf[index - 1] == '\r') {
+		DEBUG_PRINT("network newline at %d", index);
+	} else {
+		DEBUG_PRINT("unix newline at %d", index);
+	}
+	return index;
+}
 
-		// unix newline
-		if (buf[index - 1] != '\r' && buf[index] == '\n') {
-			DEBUG_PRINT("unix newline at %d", index);
-			buf[index] = '\0';
-			return index;
-		}
+int remove_newline(char *buf, const int len) {
+	// check valid arguments
+	if (buf == NULL || len < 1) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
 	}
 
-	// nothing found
-	DEBUG_PRINT("none found");
-	return -ENOENT;
+	// the first '\n' ends either kind of newline
+	int index = scan_kernel(buf, len, '\n');
+	if (index < 0) {
+		DEBUG_PRINT("none found");
+		return -ENOENT;
+	}
+
+	if (index > 0 && buf[index - 1] == '\r') {
+		DEBUG_PRINT("network newline at %d", index);
+		buf[index - 1] = '\0';
+	} else {
+		DEBUG_PRINT("unix newline at %d", index);
+	}
+	buf[index] = '\0';
+	return index;
 }
 
 int buf_contains_symbol(const char *buf, const int len, const char symbol) {
@@ -281,17 +736,45 @@ int buf_contains_symbol(const char *buf, const int len, const char symbol) {
 		return -EINVAL;
 	}
 
-	// loop through buffer until first symbol is found
-	int index;
-	for (index = 0; index < len; index++) {
-		if (buf[index] == symbol) {
-			DEBUG_PRINT("char %d found at %d", symbol, index);
-			return index;
+	int index = scan_kernel(buf, len, symbol);
+	if (index < 0) {
+		DEBUG_PRINT("none found");
+		return -ENOENT;
+	}
+
+	DEBUG_PRINT("char %d found at %d", symbol, index);
+	return index;
+}
+
+int ring_find(struct ring *ring, const char symbol, const int limit) {
+	// check valid inputs
+	if (ring == NULL || limit < 0) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// only look at what has been received
+	int count = (limit > ring->inring) ? ring->inring : limit;
+	if (count == 0) {
+		return -ENOENT;
+	}
+
+	// scan up to the end of the ring, then from the front
+	int first = ring->ringsize - ring->start;
+	if (first > count) first = count;
+
+	int index = scan_kernel(ring->buf + ring->start, first, symbol);
+	if (index >= 0) {
+		return index;
+	}
+
+	if (count > first) {
+		index = scan_kernel(ring->buf, count - first, symbol);
+		if (index >= 0) {
+			return first + index;
 		}
 	}
 
-	// no symbol found
-	DEBUG_PRINT("none found");
 	return -ENOENT;
 }
 
@@ -1,15 +1,108 @@
 #ifndef __CHOPDATA_H__
 #define __CHOPDATA_H__
 
+#include <sys/uio.h>
+
 #include "chopconst.h"
 
 int fill_buf(struct buffer *buffer, const int input);
 
+/*
+ * Reads as much as the client's receive ring has room for with a single
+ * non-blocking read. Returns the number of bytes read, 0 if the socket was
+ * closed, -EAGAIN if nothing was waiting, or negative on error.
+ */
+int fill_ring(struct client *cli);
+
+/*
+ * Moves up to len bytes out of the given ring into dest, returning the number
+ * of bytes moved.
+ */
+int ring_read(struct ring *ring, char *dest, const int len);
+
+/*
+ * Copies up to len bytes from the front of the given ring into dest without
+ * consuming them, returning the number of bytes copied.
+ */
+int ring_peek(struct ring *ring, char *dest, const int len);
+
+/*
+ * Drops up to len bytes from the front of the given ring, returning the number
+ * of bytes dropped.
+ */
+int ring_skip(struct ring *ring, const int len);
+
+/*
+ * Copies up to len bytes onto the back of the given ring, returning the number
+ * of bytes that fit.
+ */
+int ring_write(struct ring *ring, const char *src, const int len);
+
+/*
+ * Moves up to remaining bytes of received body into the packet's data
+ * section, continuing any partly filled segment. Returns the number of bytes
+ * moved, which is less than remaining if the rest has not arrived yet.
+ */
 int read_data(struct client *cli, struct packet *pack, int remaining);
 
+/*
+ * Takes a header off the client's receive ring. Returns -EAGAIN if a full
+ * header has not arrived yet.
+ */
 int read_header(struct client *cli, struct packet *pack);
 
-int write_packet(struct client *cli, struct packet *pack);
+/*
+ * Takes the body length following a START_DATA header off the client's
+ * receive ring into the packet's extent. Returns -EAGAIN if it has not fully
+ * arrived yet, -EOVERFLOW if it does not fit a long.
+ */
+int read_extent(struct client *cli, struct packet *pack);
+
+/*
+ * Sends as much of the packet's file body as the socket takes, straight from
+ * the file with sendfile. Returns 0 once all of it was sent, 1 if the socket
+ * is full, or negative on error, -EIO if the file ended early.
+ */
+int send_file_body(struct client *cli, struct packet *pack);
+
+/*
+ * Places the packet at the end of the client's outbound queue, which takes
+ * ownership of it. Acknowledges held back for a block are queued ahead of
+ * it. Pauses reading from the client once the queue reaches its high water
+ * mark.
+ */
+int enqueue_packet(struct client *cli, struct packet *pack);
+
+/*
+ * Queues the pending block of acknowledges, then writes as much of the
+ * client's outbound queue as the socket takes without blocking, in as few
+ * vectored sends as possible, and file bodies through sendfile once their
+ * header is out. Returns 0 if the queue was emptied, 1 if packets remain until
+ * the socket is writable, or negative on error.
+ */
+int flush_queue(struct client *cli);
+
+/*
+ * Points up to max entries of iov at the unwritten part of the client's
+ * outbound queue, oldest first. Returns the number of entries filled.
+ */
+int gather_queue(struct client *cli, struct iovec *iov, const int max);
+
+/*
+ * Releases the given number of written bytes from the front of the client's
+ * outbound queue, resuming reading once it drains to the low water mark.
+ * Returns 1 if packets remain queued, 0 otherwise.
+ */
+int advance_queue(struct client *cli, const int written);
+
+/*
+ * Selects the kernel used by the scanning functions below, one of "scalar",
+ * "sse2" or "avx2". Returns -ENOTSUP if the processor lacks it. Without a
+ * selection the widest supported kernel is picked on first use.
+ */
+int select_scan_kernel(const char *name);
+
+const char *scan_kernel_name(void);
 
 /*
  * Scans the given buffer for a newline sequence '\n' or '\r\n', returning the
@@ -34,6 +127,13 @@ int remove_newline(char *str, const int len);
  */
 int buf_contains_symbol(const char *buf, const int len, const char symbol);
 
+/*
+ * Scans the first limit bytes held in the given ring for a symbol without
+ * consuming them, returning its offset from the front of the ring. Returns
+ * negative if the symbol has not been received within the limit.
+ */
+int ring_find(struct ring *ring, const char symbol, const int limit);
+
 /*
  * Converts the given value into its binary representation within a string.
  * Places the string representation in the given buffer, which is assumed to be
@@ -6,6 +6,9 @@
 
 #include "chopdebug.h"
 #include "chopconst.h"
+#include "choplog.h"
+#include "choppacket.h"
+#include "chopsink.h"
 
 int header_type = 0;
 static const char *all_headers[] = {"[CLIENT %d]", "[SERVER %d]"};
@@ -78,15 +81,8 @@ void _debug_print(const char *function, const char *format, ...) {
 	va_list args;
 	va_start(args, format);
 
-	// printing argument
-	dprintf(debug_fd, dbg_fcn_head, function);
-	vdprintf(debug_fd, format, args);
-	dprintf(debug_fd, dbg_fcn_tail);
-
-	// in case errno is nonzero
-	if (errsav > 0) {
-		dprintf(debug_fd, dbg_err, errsav, strerror(errsav));
-	}
+	// recording argument, the drainer thread formats and prints it
+	log_record(function, format, errsav, args);
 
 	// cleaning up
 	va_end(args);
@@ -102,17 +98,17 @@ int print_text(struct client *client, struct packet *pack) {
     }
 
     // print prefix for message
-    printf(msg_header(), client->socket_fd);
+    sink_printf(message_sink, msg_header(), client->socket_fd);
 
-    printf(recv_text_start);
+    sink_printf(message_sink, recv_text_start);
     // print every buffer out sequentially
     struct buffer *cur;
     for (cur = pack->data; cur != NULL; cur = cur->next) {
-        printf(recv_text_seg, cur->inbuf, cur->buf);
+        sink_write(message_sink, cur->buf, cur->inbuf);
     }
 
     // print line end for spacing
-    printf(recv_text_end);
+    sink_printf(message_sink, recv_text_end);
 
     return 0;
 }
@@ -126,13 +122,13 @@ int print_enquiry(struct client *client, struct packet *pack) {
 
     switch (pack->control1) {
         case ENQUIRY_NORMAL:
-            printf(msg_header(), client->socket_fd);
-            printf(recv_ping_norm);
+            sink_printf(message_sink, msg_header(), client->socket_fd);
+            sink_printf(message_sink, recv_ping_norm);
             break;
 
         case ENQUIRY_RETURN:
-            printf(msg_header(), client->socket_fd);
-            printf(recv_ping_send);
+            sink_printf(message_sink, msg_header(), client->socket_fd);
+            sink_printf(message_sink, recv_ping_send);
             break;
 
         case ENQUIRY_TIME:
@@ -140,8 +136,18 @@ int print_enquiry(struct client *client, struct packet *pack) {
             break;
 
         case ENQUIRY_RTIME:
-            printf(msg_header(), client->socket_fd);
-            printf(recv_ping_time_send);
+            sink_printf(message_sink, msg_header(), client->socket_fd);
+            sink_printf(message_sink, recv_ping_time_send);
+            break;
+
+        case ENQUIRY_STAMP:
+            sink_printf(message_sink, msg_header(), client->socket_fd);
+            sink_printf(message_sink, recv_ping_stamp);
+            break;
+
+        case ENQUIRY_ECHO:
+            sink_printf(message_sink, msg_header(), client->socket_fd);
+            sink_printf(message_sink, recv_ping_echo, client->rtt_last_ns / 1000.0, client->rtt_held_ns / 1000.0);
             break;
 
         default:
@@ -167,8 +173,8 @@ int print_time(struct client *client, struct packet *pack) {
     // print time message
     time_t recv_time;
     memmove(&recv_time, pack->data->buf, sizeof(time_t));
-    printf(msg_header(), client->socket_fd);
-    printf(recv_ping_time, recv_time);
+    sink_printf(message_sink, msg_header(), client->socket_fd);
+    sink_printf(message_sink, recv_ping_time, recv_time);
 
     return 0;
 }
@@ -181,8 +187,16 @@ int print_acknowledge(struct client *client, struct packet *pack) {
     }
 
     // print acknowledge contents
-    printf(msg_header(), client->socket_fd);
-    printf(ackn_text, stat_to_str(pack->control1));
+    sink_printf(message_sink, msg_header(), client->socket_fd);
+
+    // a block confirms packets by number rather than status
+    unsigned int seq;
+    unsigned int count;
+    if (pack->control1 == END_TRANSMISSION_BLOCK && read_ack_block(pack, &seq, &count) == 0) {
+        sink_printf(message_sink, ackn_block_text, count, seq);
+        return 0;
+    }
+    sink_printf(message_sink, ackn_text, stat_to_str(pack->control1));
 
     return 0;
 }
@@ -195,8 +209,8 @@ int print_wakeup(struct client *client, struct packet *pack) {
     }
 
     // print wakeup
-    printf(msg_header(), client->socket_fd);
-    printf(wakeup_text);
+    sink_printf(message_sink, msg_header(), client->socket_fd);
+    sink_printf(message_sink, wakeup_text);
 
     return 0;
 }
@@ -209,8 +223,8 @@ int print_neg_acknowledge(struct client *client, struct packet *pack) {
     }
 
     // print negative acknowledge contents
-    printf(msg_header(), client->socket_fd);
-    printf(neg_ackn_text, stat_to_str(pack->control1));
+    sink_printf(message_sink, msg_header(), client->socket_fd);
+    sink_printf(message_sink, neg_ackn_text, stat_to_str(pack->control1));
 
     return 0;
 }
@@ -223,8 +237,8 @@ int print_idle(struct client *client, struct packet *pack) {
     }
 
     // print idle contents
-    printf(msg_header(), client->socket_fd);
-    printf(idle_text);
+    sink_printf(message_sink, msg_header(), client->socket_fd);
+    sink_printf(message_sink, idle_text);
 
     return 0;
 }
@@ -237,8 +251,62 @@ int print_escape(struct client *client, struct packet *pack) {
     }
 
     // print escape contents
-    printf(msg_header(), client->socket_fd);
-    printf(esc_text);
+    sink_printf(message_sink, msg_header(), client->socket_fd);
+    sink_printf(message_sink, esc_text);
+
+    return 0;
+}
+
+int print_deliver(struct client *client, struct packet *pack) {
+    // check valid arguments
+    if (client == NULL || pack == NULL || pack->status != DELIVER) {
+        DEBUG_PRINT("invalid arguments");
+        return -EINVAL;
+    }
+
+    // topic and message may straddle segments
+    char body[pack->control1 + pack->control2];
+    copy_body(pack, 0, body, sizeof(body));
+
+    sink_printf(message_sink, msg_header(), client->socket_fd);
+    sink_printf(message_sink, deliver_text, pack->control1, body, pack->control2, body + pack->control1);
+
+    return 0;
+}
+
+int print_data(struct client *client, struct packet *pack) {
+    // check valid arguments
+    if (client == NULL || pack == NULL || pack->status != START_DATA) {
+        DEBUG_PRINT("invalid arguments");
+        return -EINVAL;
+    }
+
+    // the body went to the stream handler, only its size is left
+    sink_printf(message_sink, msg_header(), client->socket_fd);
+    sink_printf(message_sink, data_text, pack->extent);
+
+    return 0;
+}
+
+int print_metrics(struct client *client, struct packet *pack) {
+    // check valid arguments
+    if (client == NULL || pack == NULL || pack->status != END_OF_MEDIUM) {
+        DEBUG_PRINT("invalid arguments");
+        return -EINVAL;
+    }
+
+    sink_printf(message_sink, msg_header(), client->socket_fd);
+    if (pack->control1 != METRICS_REPORT) {
+        sink_printf(message_sink, metrics_query_text);
+        return 0;
+    }
+
+    // the report is lines of text already
+    sink_printf(message_sink, metrics_report_text);
+    struct buffer *cur;
+    for (cur = pack->data; cur != NULL; cur = cur->next) {
+        sink_write(message_sink, cur->buf, cur->inbuf);
+    }
 
     return 0;
 }
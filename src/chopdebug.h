@@ -26,8 +26,11 @@ static const char recv_ping_norm[] = " ENQUIRY\n";
 static const char recv_ping_send[] = " ENQURIY Requested\n";
 static const char recv_ping_time[] = " Time ENQUIRY: \"%ld\"\n";
 static const char recv_ping_time_send[] = " Time ENQUIRY Requested\n";
+static const char recv_ping_stamp[] = " Stamped ENQUIRY\n";
+static const char recv_ping_echo[] = " ENQUIRY Echo: %.1f us round trip, %.1f us held\n";
 
 static const char ackn_text[] = " %s Confirmed\n";
+static const char ackn_block_text[] = " %u Confirmed, through %u\n";
 
 static const char wakeup_text[] = " Requesting Wakeup\n";
 
@@ -37,10 +40,18 @@ static const char idle_text[] = " Requesting Idle\n";
 
 static const char esc_text[] = " Requesting Disconnect\n";
 
+static const char deliver_text[] = " %.*s: \"%.*s\"\n";
+
+static const char data_text[] = " Data: %ld bytes\n";
+
+static const char metrics_query_text[] = " Requesting Metrics\n";
+static const char metrics_report_text[] = " Metrics:\n";
+
 /*
- * Prints requested format string into stderr, prefixing properly
+ * Records requested format string for the logging thread to print into
+ * stderr, prefixing properly
  */
-void _debug_print(const char *format, const char *function, ...);
+void _debug_print(const char *function, const char *format, ...) __attribute__((format(printf, 2, 3)));
 
 int print_text(struct client *client, struct packet *pack);
 
@@ -58,6 +69,12 @@ int print_idle(struct client *client, struct packet *pack);
 
 int print_escape(struct client *client, struct packet *pack);
 
+int print_deliver(struct client *client, struct packet *pack);
+
+int print_data(struct client *client, struct packet *pack);
+
+int print_metrics(struct client *client, struct packet *pack);
+
 const char *stat_to_str(char status);
 
 const char *enq_cont_to_str(char control1);
@@ -0,0 +1,210 @@
+#include <errno.h>
+#include <time.h>
+
+#include "chopconst.h"
+#include "chopdebug.h"
+#include "chopdispatch.h"
+#include "choppacket.h"
+
+#define DISPATCH_TABLES 3
+
+/*
+ * Structures
+ */
+
+struct dispatch_entry {
+	packet_handler handler; // acts on the packet
+	packet_handler printer; // displays the packet once handled
+};
+
+// the protocol's own handlers, replaceable through register_handler
+static struct dispatch_entry tables[DISPATCH_TABLES][DISPATCH_LEN] = {
+		[DISPATCH_STATUS] = {
+				[NULL_BYTE] = {parse_null, NULL},
+				[START_HEADER] = {parse_long_header, NULL},
+				[START_TEXT] = {parse_text, NULL},
+				[ENQUIRY] = {parse_enquiry, NULL},
+				[ACKNOWLEDGE] = {parse_acknowledge, NULL},
+				[WAKEUP] = {parse_wakeup, NULL},
+				[NEG_ACKNOWLEDGE] = {parse_neg_acknowledge, NULL},
+				[IDLE] = {parse_idle, NULL},
+				[START_DATA] = {parse_data, NULL},
+				[SHIFT_OUT] = {parse_shift_out, NULL},
+				[SHIFT_IN] = {parse_shift_in, NULL},
+				[END_OF_MEDIUM] = {parse_metrics, NULL},
+				[ESCAPE] = {parse_escape, NULL},
+				[SUBSCRIBE] = {parse_subscribe, NULL},
+				[UNSUBSCRIBE] = {parse_unsubscribe, NULL},
+				[PUBLISH] = {parse_publish, NULL},
+				[DELIVER] = {parse_deliver, NULL}},
+		[DISPATCH_ACK] = {
+				[START_TEXT] = {ack_text, NULL},
+				[START_DATA] = {ack_data, NULL},
+				[SHIFT_OUT] = {ack_shift, NULL},
+				[SHIFT_IN] = {ack_shift, NULL},
+				[END_TRANSMISSION_BLOCK] = {ack_block, NULL},
+				[ENQUIRY] = {ack_enquiry, NULL},
+				[WAKEUP] = {ack_wakeup, NULL},
+				[IDLE] = {ack_idle, NULL},
+				[ESCAPE] = {ack_escape, NULL},
+				[SUBSCRIBE] = {ack_topic, NULL},
+				[UNSUBSCRIBE] = {ack_topic, NULL}},
+		[DISPATCH_NAK] = {
+				[NULL_BYTE] = {nak_connection, NULL},
+				[START_TEXT] = {nak_refused, NULL},
+				[START_DATA] = {nak_refused, NULL},
+				[SHIFT_OUT] = {nak_refused, NULL},
+				[SHIFT_IN] = {nak_refused, NULL},
+				[ENQUIRY] = {nak_refused, NULL},
+				[WAKEUP] = {nak_refused, NULL},
+				[IDLE] = {nak_refused, NULL},
+				[END_OF_MEDIUM] = {nak_refused, NULL},
+				[ESCAPE] = {nak_refused, NULL},
+				[SUBSCRIBE] = {nak_refused, NULL},
+				[UNSUBSCRIBE] = {nak_refused, NULL},
+				[PUBLISH] = {nak_refused, NULL},
+				[DELIVER] = {nak_refused, NULL}}};
+
+// where streamed bodies go, shared like the tables
+static stream_handler stream_sink = NULL;
+
+// counters are kept by every thread that dispatches, so handlers never share them
+static __thread struct handler_stats thread_stats[DISPATCH_TABLES][DISPATCH_LEN];
+
+/*
+ * Dispatch Helpers
+ */
+
+static long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static struct dispatch_entry *find_entry(const int table, const int code) {
+	if (table < 0 || table >= DISPATCH_TABLES || code < 0 || code >= DISPATCH_LEN) {
+		return NULL;
+	}
+
+	return &(tables[table][code]);
+}
+
+/*
+ * Registration Functions
+ */
+
+int register_handler(const int table, const int code, packet_handler handler) {
+	// check valid arguments
+	struct dispatch_entry *entry = find_entry(table, code);
+	if (entry == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	entry->handler = handler;
+	return 0;
+}
+
+int register_printer(const int table, const int code, packet_handler printer) {
+	// check valid arguments
+	struct dispatch_entry *entry = find_entry(table, code);
+	if (entry == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	entry->printer = printer;
+	return 0;
+}
+
+int register_stream_handler(stream_handler handler) {
+	stream_sink = handler;
+	return 0;
+}
+
+void register_default_printers(void) {
+	register_printer(DISPATCH_STATUS, START_TEXT, print_text);
+	register_printer(DISPATCH_STATUS, ENQUIRY, print_enquiry);
+	register_printer(DISPATCH_STATUS, ACKNOWLEDGE, print_acknowledge);
+	register_printer(DISPATCH_STATUS, WAKEUP, print_wakeup);
+	register_printer(DISPATCH_STATUS, NEG_ACKNOWLEDGE, print_neg_acknowledge);
+	register_printer(DISPATCH_STATUS, IDLE, print_idle);
+	register_printer(DISPATCH_STATUS, ESCAPE, print_escape);
+	register_printer(DISPATCH_STATUS, START_DATA, print_data);
+	register_printer(DISPATCH_STATUS, DELIVER, print_deliver);
+	register_printer(DISPATCH_STATUS, END_OF_MEDIUM, print_metrics);
+}
+
+/*
+ * Dispatch Functions
+ */
+
+int dispatch_packet(const int table, const int code, struct client *cli, struct packet *pack) {
+	// check valid arguments
+	if (cli == NULL || pack == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// unsupported/invalid
+	struct dispatch_entry *entry = find_entry(table, code);
+	if (entry == NULL || entry->handler == NULL) {
+		DEBUG_PRINT("no handler for %d in table %d", code, table);
+		return -1;
+	}
+
+	DEBUG_PRINT("dispatching %s in table %d", stat_to_str(code), table);
+
+	long start = now_ns();
+	int status = entry->handler(cli, pack);
+	long elapsed = now_ns() - start;
+
+	// account the call to its handler
+	struct handler_stats *stats = &(thread_stats[table][code]);
+	stats->calls++;
+	stats->total_ns += elapsed;
+	if (elapsed > stats->max_ns) {
+		stats->max_ns = elapsed;
+	}
+	if (status < 0) {
+		stats->failures++;
+	}
+
+	// display the packet
+	if (entry->printer != NULL && entry->printer(cli, pack) < 0) {
+		DEBUG_PRINT("failed print");
+		return -1;
+	}
+
+	return status;
+}
+
+int dispatch_stream(struct client *cli, struct packet *pack, const char *chunk, const int len) {
+	// check valid arguments
+	if (cli == NULL || pack == NULL || chunk == NULL || len < 0) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// nobody wants the body
+	if (stream_sink == NULL) {
+		return 0;
+	}
+
+	return stream_sink(cli, pack, chunk, len);
+}
+
+/*
+ * Dispatch Utility Functions
+ */
+
+int dispatch_stats(const int table, const int code, struct handler_stats *out) {
+	// check valid arguments
+	struct dispatch_entry *entry = find_entry(table, code);
+	if (entry == NULL || out == NULL) {
+		return -EINVAL;
+	}
+
+	*out = thread_stats[table][code];
+	return 0;
+}
@@ -0,0 +1,92 @@
+#ifndef __CHOPDISPATCH_H__
+#define __CHOPDISPATCH_H__
+
+#include "chopconst.h"
+
+/*
+ * Dispatch Macros
+ */
+
+#define DISPATCH_LEN 32 // one entry for every status byte below 32
+
+/// Dispatch Tables
+#define DISPATCH_STATUS 0 // indexed by a packet's status
+#define DISPATCH_ACK 1 // indexed by control1 of an ACKNOWLEDGE
+#define DISPATCH_NAK 2 // indexed by control1 of a NEG_ACKNOWLEDGE
+
+/*
+ * Type Definitions
+ */
+
+typedef int (*packet_handler)(struct client *cli, struct packet *pack);
+
+typedef int (*stream_handler)(struct client *cli, struct packet *pack, const char *chunk, const int len);
+
+/*
+ * Structures
+ */
+
+struct handler_stats {
+	long calls; // packets handed to the handler
+	long failures; // calls that returned negative
+	long total_ns; // time spent in the handler
+	long max_ns; // longest single call
+};
+
+/*
+ * Registration Functions
+ */
+
+/*
+ * Replaces the handler for a code in one of the dispatch tables, NULL makes
+ * the code invalid. Returns -EINVAL if the table or code is out of range.
+ * Tables are shared by every thread, so register before any worker starts.
+ */
+int register_handler(const int table, const int code, packet_handler handler);
+
+/*
+ * Replaces the function that displays packets after a code's handler ran,
+ * NULL displays nothing. The server and client install the print_* functions.
+ */
+int register_printer(const int table, const int code, packet_handler printer);
+
+/*
+ * Replaces the function START_DATA bodies are handed to as they arrive, a
+ * chunk of whatever has been received at a time, NULL drops them. The packet
+ * is dispatched as usual once its whole body went through.
+ */
+int register_stream_handler(stream_handler handler);
+
+/*
+ * Installs the print_* function for every status that has one.
+ */
+void register_default_printers(void);
+
+/*
+ * Dispatch Functions
+ */
+
+/*
+ * Runs the handler and then the printer registered for the given code of a
+ * table. Returns the handler's result, or -1 if the code has no handler or
+ * printing failed.
+ */
+int dispatch_packet(const int table, const int code, struct client *cli, struct packet *pack);
+
+/*
+ * Hands a chunk of the packet's streamed body to the stream handler. Returns
+ * the handler's result, or 0 if there is none.
+ */
+int dispatch_stream(struct client *cli, struct packet *pack, const char *chunk, const int len);
+
+/*
+ * Dispatch Utility Functions
+ */
+
+/*
+ * Copies the call and latency counters the calling thread kept for a table
+ * entry into out.
+ */
+int dispatch_stats(const int table, const int code, struct handler_stats *out);
+
+#endif
@@ -0,0 +1,368 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/epoll.h>
+
+#include "chopconst.h"
+#include "chopdebug.h"
+#include "chopevent.h"
+
+static const int backend_str_len = 3;
+static const char *backend_str[] = {
+		"epoll",
+		"poll",
+		"uring"};
+
+/*
+ * Backend Translation Helpers
+ */
+
+static unsigned int to_epoll_events(const int events) {
+	// always edge-triggered, callers drain descriptors until they would block
+	unsigned int ret = EPOLLET;
+	if (events & EVENT_READ) ret |= EPOLLIN | EPOLLRDHUP;
+	if (events & EVENT_WRITE) ret |= EPOLLOUT;
+	return ret;
+}
+
+static int from_epoll_events(const unsigned int events) {
+	int ret = 0;
+	if (events & (EPOLLIN | EPOLLRDHUP)) ret |= EVENT_READ;
+	if (events & EPOLLOUT) ret |= EVENT_WRITE;
+	if (events & (EPOLLERR | EPOLLHUP)) ret |= EVENT_ERROR;
+	return ret;
+}
+
+static short to_poll_events(const int events) {
+	short ret = 0;
+	if (events & EVENT_READ) ret |= POLLIN;
+	if (events & EVENT_WRITE) ret |= POLLOUT;
+	return ret;
+}
+
+static int from_poll_events(const short events) {
+	int ret = 0;
+	if (events & POLLIN) ret |= EVENT_READ;
+	if (events & POLLOUT) ret |= EVENT_WRITE;
+	if (events & (POLLERR | POLLHUP | POLLNVAL)) ret |= EVENT_ERROR;
+	return ret;
+}
+
+/*
+ * Poll Backend Storage Helpers
+ */
+
+static int grow_poll_index(struct event_loop *loop, const int fd) {
+	// index already covers descriptor
+	if (fd < loop->index_cap) {
+		return 0;
+	}
+
+	// double until the descriptor fits
+	int cap = (loop->index_cap > 0) ? loop->index_cap : 64;
+	while (cap <= fd) cap *= 2;
+
+	int *mem = (int *) realloc(loop->poll_index, sizeof(int) * cap);
+	if (mem == NULL) {
+		DEBUG_PRINT("realloc, index");
+		return -ENOMEM;
+	}
+
+	// mark new descriptors as unregistered
+	for (int i = loop->index_cap; i < cap; i++) {
+		mem[i] = -1;
+	}
+
+	loop->poll_index = mem;
+	loop->index_cap = cap;
+	return 0;
+}
+
+static int grow_poll_fds(struct event_loop *loop) {
+	// space remaining
+	if (loop->poll_count < loop->poll_cap) {
+		return 0;
+	}
+
+	int cap = (loop->poll_cap > 0) ? loop->poll_cap * 2 : 64;
+
+	struct pollfd *fds = (struct pollfd *) realloc(loop->poll_fds, sizeof(struct pollfd) * cap);
+	if (fds == NULL) {
+		DEBUG_PRINT("realloc, descriptors");
+		return -ENOMEM;
+	}
+	loop->poll_fds = fds;
+
+	void **owners = (void **) realloc(loop->poll_owners, sizeof(void *) * cap);
+	if (owners == NULL) {
+		DEBUG_PRINT("realloc, owners");
+		return -ENOMEM;
+	}
+	loop->poll_owners = owners;
+
+	loop->poll_cap = cap;
+	return 0;
+}
+
+/*
+ * Event Loop Management Functions
+ */
+
+int init_event_loop(struct event_loop **target, const int backend, const int max_events) {
+	// check valid argument
+	if (target == NULL || max_events < 1 || (backend != EVENT_BACKEND_EPOLL && backend != EVENT_BACKEND_POLL)) {
+		return -EINVAL;
+	}
+
+	// allocate structure
+	struct event_loop *init = (struct event_loop *) malloc(sizeof(struct event_loop));
+	if (init == NULL) {
+		DEBUG_PRINT("malloc, structure");
+		return -ENOMEM;
+	}
+
+	// initialize structure fields
+	init->backend = backend;
+	init->max_events = max_events;
+	init->epoll_fd = -1;
+	init->epoll_events = NULL;
+	init->poll_fds = NULL;
+	init->poll_owners = NULL;
+	init->poll_count = 0;
+	init->poll_cap = 0;
+	init->poll_index = NULL;
+	init->index_cap = 0;
+
+	if (backend == EVENT_BACKEND_EPOLL) {
+		// create kernel event table
+		init->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (init->epoll_fd < 0) {
+			DEBUG_PRINT("epoll_create1 fail");
+			free(init);
+			return -errno;
+		}
+
+		// allocate ready event array
+		init->epoll_events = (struct epoll_event *) malloc(sizeof(struct epoll_event) * max_events);
+		if (init->epoll_events == NULL) {
+			DEBUG_PRINT("malloc, events");
+			close(init->epoll_fd);
+			free(init);
+			return -ENOMEM;
+		}
+	}
+
+	DEBUG_PRINT("%s event loop, %d events per wait", event_backend_to_str(backend), max_events);
+
+	// set given pointer to new struct
+	*target = init;
+	return 0;
+}
+
+int destroy_event_loop(struct event_loop **target) {
+	// check valid argument
+	if (target == NULL) {
+		return -EINVAL;
+	}
+
+	// struct already doesn't exist
+	if (*target == NULL) {
+		return 0;
+	}
+
+	// direct reference to structure
+	struct event_loop *old = *target;
+
+	// close kernel event table
+	if (old->epoll_fd > MIN_FD) {
+		close(old->epoll_fd);
+	}
+
+	// deallocate backend storage
+	free(old->epoll_events);
+	free(old->poll_fds);
+	free(old->poll_owners);
+	free(old->poll_index);
+
+	// deallocate structure
+	free(old);
+
+	// dereference holder
+	*target = NULL;
+	return 0;
+}
+
+int event_loop_add(struct event_loop *loop, const int fd, const int events, void *owner) {
+	// check valid arguments
+	if (loop == NULL || fd < MIN_FD) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	if (loop->backend == EVENT_BACKEND_EPOLL) {
+		struct epoll_event ev;
+		ev.events = to_epoll_events(events);
+		ev.data.ptr = owner;
+		if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			DEBUG_PRINT("epoll_ctl add fail, fd %d", fd);
+			return -errno;
+		}
+		return 0;
+	}
+
+	// make room for descriptor
+	if (grow_poll_index(loop, fd) < 0 || grow_poll_fds(loop) < 0) {
+		return -ENOMEM;
+	}
+
+	// descriptor already registered
+	if (loop->poll_index[fd] >= 0) {
+		DEBUG_PRINT("fd %d already registered", fd);
+		return -EEXIST;
+	}
+
+	// append to dense array
+	int index = loop->poll_count++;
+	loop->poll_fds[index].fd = fd;
+	loop->poll_fds[index].events = to_poll_events(events);
+	loop->poll_fds[index].revents = 0;
+	loop->poll_owners[index] = owner;
+	loop->poll_index[fd] = index;
+	return 0;
+}
+
+int event_loop_modify(struct event_loop *loop, const int fd, const int events, void *owner) {
+	// check valid arguments
+	if (loop == NULL || fd < MIN_FD) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	if (loop->backend == EVENT_BACKEND_EPOLL) {
+		struct epoll_event ev;
+		ev.events = to_epoll_events(events);
+		ev.data.ptr = owner;
+		if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+			DEBUG_PRINT("epoll_ctl modify fail, fd %d", fd);
+			return -errno;
+		}
+		return 0;
+	}
+
+	// descriptor not registered
+	if (fd >= loop->index_cap || loop->poll_index[fd] < 0) {
+		DEBUG_PRINT("fd %d not registered", fd);
+		return -ENOENT;
+	}
+
+	int index = loop->poll_index[fd];
+	loop->poll_fds[index].events = to_poll_events(events);
+	loop->poll_owners[index] = owner;
+	return 0;
+}
+
+int event_loop_remove(struct event_loop *loop, const int fd) {
+	// check valid arguments
+	if (loop == NULL || fd < MIN_FD) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	if (loop->backend == EVENT_BACKEND_EPOLL) {
+		if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL) < 0) {
+			DEBUG_PRINT("epoll_ctl remove fail, fd %d", fd);
+			return -errno;
+		}
+		return 0;
+	}
+
+	// descriptor not registered
+	if (fd >= loop->index_cap || loop->poll_index[fd] < 0) {
+		DEBUG_PRINT("fd %d not registered", fd);
+		return -ENOENT;
+	}
+
+	// move last entry into the removed entry's place to keep the array dense
+	int index = loop->poll_index[fd];
+	int last = --loop->poll_count;
+	if (index != last) {
+		loop->poll_fds[index] = loop->poll_fds[last];
+		loop->poll_owners[index] = loop->poll_owners[last];
+		loop->poll_index[loop->poll_fds[index].fd] = index;
+	}
+	loop->poll_index[fd] = -1;
+	return 0;
+}
+
+int event_loop_wait(struct event_loop *loop, struct event *ready, const int max_ready, const int timeout) {
+	// check valid arguments
+	if (loop == NULL || ready == NULL || max_ready < 1) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	int limit = (max_ready < loop->max_events) ? max_ready : loop->max_events;
+
+	if (loop->backend == EVENT_BACKEND_EPOLL) {
+		int nready = epoll_wait(loop->epoll_fd, loop->epoll_events, limit, timeout);
+		if (nready < 0) {
+			return -errno;
+		}
+
+		// translate only the descriptors that are ready
+		for (int i = 0; i < nready; i++) {
+			ready[i].owner = loop->epoll_events[i].data.ptr;
+			ready[i].events = from_epoll_events(loop->epoll_events[i].events);
+			ready[i].fd = -1; // epoll only hands back the owner
+		}
+		return nready;
+	}
+
+	int nready = poll(loop->poll_fds, loop->poll_count, timeout);
+	if (nready < 0) {
+		return -errno;
+	}
+
+	// collect ready entries, scanning every registered descriptor
+	int count = 0;
+	for (int i = 0; i < loop->poll_count && count < nready && count < limit; i++) {
+		if (loop->poll_fds[i].revents == 0) {
+			continue;
+		}
+
+		ready[count].fd = loop->poll_fds[i].fd;
+		ready[count].events = from_poll_events(loop->poll_fds[i].revents);
+		ready[count].owner = loop->poll_owners[i];
+		count++;
+	}
+	return count;
+}
+
+/*
+ * Event Utility Functions
+ */
+
+int event_backend_from_str(const char *str) {
+	// check valid argument
+	if (str == NULL) {
+		return -EINVAL;
+	}
+
+	for (int i = 0; i < backend_str_len; i++) {
+		if (strcmp(str, backend_str[i]) == 0) {
+			return i;
+		}
+	}
+
+	return -ENOENT;
+}
+
+const char *event_backend_to_str(const int backend) {
+	if (backend < 0 || backend >= backend_str_len) {
+		return NULL;
+	}
+
+	return backend_str[backend];
+}
@@ -0,0 +1,87 @@
+#ifndef __CHOPEVENT_H__
+#define __CHOPEVENT_H__
+
+#include <poll.h>
+#include <sys/epoll.h>
+
+/*
+ * Event Macros
+ */
+
+/// Event Backends
+#define EVENT_BACKEND_EPOLL 0 // edge-triggered epoll, O(ready) per wakeup
+#define EVENT_BACKEND_POLL 1 // level-triggered poll, O(registered) per wakeup
+#define EVENT_BACKEND_URING 2 // io_uring completions, run by chopuring rather than an event_loop
+
+/// Event Flags
+#define EVENT_READ 0x1 // descriptor can be read from
+#define EVENT_WRITE 0x2 // descriptor can be written to
+#define EVENT_ERROR 0x4 // hangup or error, only ever reported
+
+/*
+ * Structures
+ */
+
+struct event {
+	int fd; // descriptor the event happened on
+	int events; // mask of event flags that are ready
+	void *owner; // pointer given when the descriptor was registered
+};
+
+struct event_loop {
+	int backend;
+	int max_events; // most events returned by a single wait
+
+	// epoll backend
+	int epoll_fd;
+	struct epoll_event *epoll_events;
+
+	// poll backend
+	struct pollfd *poll_fds; // dense array of registered descriptors
+	void **poll_owners; // owner of each entry in poll_fds
+	int poll_count;
+	int poll_cap;
+	int *poll_index; // descriptor to poll_fds index, -1 if unregistered
+	int index_cap;
+};
+
+/*
+ * Event Loop Management Functions
+ */
+
+int init_event_loop(struct event_loop **target, const int backend, const int max_events);
+
+int destroy_event_loop(struct event_loop **target);
+
+/*
+ * Starts watching the given descriptor for the given event flags. The owner
+ * pointer is handed back with every event on this descriptor.
+ */
+int event_loop_add(struct event_loop *loop, const int fd, const int events, void *owner);
+
+/*
+ * Replaces the event flags watched on an already registered descriptor.
+ */
+int event_loop_modify(struct event_loop *loop, const int fd, const int events, void *owner);
+
+/*
+ * Stops watching the given descriptor, must be called before it is closed.
+ */
+int event_loop_remove(struct event_loop *loop, const int fd);
+
+/*
+ * Waits up to timeout milliseconds (negative for forever) for registered
+ * descriptors to become ready, filling the given array with at most max_ready
+ * events. Returns the number of events, or negative on error.
+ */
+int event_loop_wait(struct event_loop *loop, struct event *ready, const int max_ready, const int timeout);
+
+/*
+ * Event Utility Functions
+ */
+
+int event_backend_from_str(const char *str);
+
+const char *event_backend_to_str(const int backend);
+
+#endif
@@ -0,0 +1,404 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "chopdebug.h"
+#include "choplog.h"
+
+#define LOG_OUT_LEN 16384 // formatted bytes the drainer writes at once
+
+/*
+ * Format Walking
+ */
+
+struct log_spec {
+	const char *start; // the '%'
+	int len; // bytes from the '%' through the conversion
+	int stars; // '*' width and precision, each taking an int argument
+	char length; // 'h', 'H' (hh), 'l', 'q' (ll), 'z', 'j', 't', 'L' or 0
+	char conv;
+};
+
+/*
+ * Finds the next conversion in format, skipping "%%". Returns the position
+ * after it, or NULL if there is none.
+ */
+static const char *next_spec(const char *format, struct log_spec *spec) {
+	const char *cur = format;
+	while ((cur = strchr(cur, '%')) != NULL) {
+		if (cur[1] == '%') {
+			cur += 2;
+			continue;
+		}
+
+		spec->start = cur++;
+		spec->stars = 0;
+		spec->length = 0;
+
+		// flags, width and precision
+		while (*cur != '\0' && strchr("-+ #0123456789.*'", *cur) != NULL) {
+			if (*cur == '*') {
+				spec->stars++;
+			}
+			cur++;
+		}
+
+		// length modifier
+		if (*cur == 'h' || *cur == 'l') {
+			spec->length = *cur++;
+			if (*cur == spec->length) {
+				spec->length = (spec->length == 'h') ? 'H' : 'q';
+				cur++;
+			}
+		} else if (*cur != '\0' && strchr("zjtLq", *cur) != NULL) {
+			spec->length = *cur++;
+		}
+
+		// malformed, treat the rest as text
+		if (*cur == '\0') {
+			return NULL;
+		}
+
+		spec->conv = *cur++;
+		spec->len = cur - spec->start;
+		return cur;
+	}
+
+	return NULL;
+}
+
+static int spec_type(const struct log_spec *spec) {
+	switch (spec->conv) {
+		case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+			if (spec->length == 'q') return LOG_ARG_LLONG;
+			if (spec->length == 'l' || spec->length == 'z' || spec->length == 'j' || spec->length == 't') return LOG_ARG_LONG;
+			return LOG_ARG_INT;
+
+		case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+			return LOG_ARG_DOUBLE;
+
+		case 's':
+			return LOG_ARG_STR;
+
+		default:
+			return LOG_ARG_PTR;
+	}
+}
+
+/*
+ * Ring Registry
+ */
+
+static __thread struct log_ring *thread_ring = NULL;
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct log_ring *_Atomic all_rings = NULL;
+
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t drainer_once = PTHREAD_ONCE_INIT;
+static pthread_t drainer;
+static atomic_int drainer_running = 0;
+
+// the drainer blocks on wake_fd once it found every ring empty, and sets
+// drainer_idle so the next record written wakes it
+static int wake_fd = -1;
+static atomic_int drainer_idle = 0;
+
+static void log_shutdown(void);
+static void *drain_loop(void *arg);
+
+static void start_drainer(void) {
+	// without an eventfd the drainer falls back to polling
+	wake_fd = eventfd(0, EFD_CLOEXEC);
+
+	atomic_store(&drainer_running, 1);
+	if (pthread_create(&drainer, NULL, drain_loop, NULL) != 0) {
+		// records are still written out by log_flush
+		atomic_store(&drainer_running, 0);
+	}
+	atexit(log_shutdown);
+}
+
+static struct log_ring *own_ring(void) {
+	if (thread_ring != NULL) {
+		return thread_ring;
+	}
+
+	struct log_ring *ring = (struct log_ring *) calloc(1, sizeof(struct log_ring));
+	if (ring == NULL) {
+		return NULL;
+	}
+
+	// only registration is locked, the drainer walks rings without it
+	pthread_mutex_lock(&registry_lock);
+	ring->next = atomic_load(&all_rings);
+	atomic_store(&all_rings, ring);
+	pthread_mutex_unlock(&registry_lock);
+
+	thread_ring = ring;
+	pthread_once(&drainer_once, start_drainer);
+	return ring;
+}
+
+/*
+ * Drainer
+ */
+
+static void out_flush(char *out, int *inout) {
+	int written = 0;
+	while (written < *inout) {
+		ssize_t ret = write(debug_fd, out + written, *inout - written);
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		} else if (ret <= 0) {
+			break;
+		}
+		written += ret;
+	}
+	*inout = 0;
+}
+
+static void out_printf(char *out, int *inout, const char *format, ...) {
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(out + *inout, LOG_OUT_LEN - *inout, format, args);
+	va_end(args);
+
+	if (len >= LOG_OUT_LEN - *inout) {
+		// did not fit, make room and try again
+		out_flush(out, inout);
+		va_start(args, format);
+		len = vsnprintf(out, LOG_OUT_LEN, format, args);
+		va_end(args);
+		if (len >= LOG_OUT_LEN) {
+			len = LOG_OUT_LEN - 1;
+		}
+	}
+
+	if (len > 0) {
+		*inout += len;
+	}
+}
+
+#define OUT_ARG(value) \
+	((spec.stars == 0) ? (out_printf(out, inout, piece, value), 0) : \
+	(spec.stars == 1) ? (out_printf(out, inout, piece, star[0], value), 0) : \
+	(out_printf(out, inout, piece, star[0], star[1], value), 0))
+
+static void format_record(const struct log_record *rec, char *out, int *inout) {
+	out_printf(out, inout, dbg_fcn_head, rec->function);
+
+	int arg = 0;
+	struct log_spec spec;
+	const char *cur = rec->format;
+	const char *next;
+	while ((next = next_spec(cur, &spec)) != NULL && arg + spec.stars < rec->argc) {
+		// literal text before the conversion, "%%" stays as it is
+		char piece[64];
+		int text = spec.start - cur;
+		for (int i = 0; i < text; i += sizeof(piece) - 1) {
+			int len = (text - i < (int) sizeof(piece) - 1) ? text - i : (int) sizeof(piece) - 1;
+			memcpy(piece, cur + i, len);
+			piece[len] = '\0';
+			out_printf(out, inout, piece);
+		}
+
+		// conversion by itself, with the arguments it was recorded with
+		int len = (spec.len < (int) sizeof(piece)) ? spec.len : (int) sizeof(piece) - 1;
+		memcpy(piece, spec.start, len);
+		piece[len] = '\0';
+
+		int star[2] = {0, 0};
+		for (int i = 0; i < spec.stars; i++) {
+			star[i] = (int) rec->args[arg++].i;
+		}
+
+		switch (rec->types[arg]) {
+			case LOG_ARG_INT: OUT_ARG((int) rec->args[arg].i); break;
+			case LOG_ARG_LONG: OUT_ARG((long) rec->args[arg].i); break;
+			case LOG_ARG_LLONG: OUT_ARG(rec->args[arg].i); break;
+			case LOG_ARG_DOUBLE: OUT_ARG(rec->args[arg].d); break;
+			case LOG_ARG_STR: OUT_ARG(rec->strings + rec->args[arg].i); break;
+			default: OUT_ARG(rec->args[arg].p); break;
+		}
+		arg++;
+		cur = next;
+	}
+
+	// whatever follows the last recorded argument
+	out_printf(out, inout, "%s", cur);
+	out_printf(out, inout, dbg_fcn_tail);
+
+	if (rec->errsav > 0) {
+		out_printf(out, inout, dbg_err, rec->errsav, strerror(rec->errsav));
+	}
+}
+
+/*
+ * Formats every waiting record. Returns how many there were.
+ */
+static int drain_rings(void) {
+	static char out[LOG_OUT_LEN];
+	int inout = 0;
+	int drained = 0;
+
+	pthread_mutex_lock(&drain_lock);
+	for (struct log_ring *ring = atomic_load(&all_rings); ring != NULL; ring = ring->next) {
+		unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		unsigned long head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+		for (; tail != head; tail++) {
+			format_record(&(ring->records[tail & (LOG_RING_LEN - 1)]), out, &inout);
+			drained++;
+		}
+		atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+		// say how much was lost since the last report
+		long dropped = atomic_load(&ring->dropped);
+		if (dropped > ring->reported) {
+			out_printf(out, &inout, "%s%ld records dropped\n", dbg_head, dropped - ring->reported);
+			ring->reported = dropped;
+		}
+	}
+	out_flush(out, &inout);
+	pthread_mutex_unlock(&drain_lock);
+
+	return drained;
+}
+
+static void wake_drainer(void) {
+	uint64_t one = 1;
+	if (wake_fd >= 0 && write(wake_fd, &one, sizeof(one)) < 0) {
+		// already signalled, the counter is full
+	}
+}
+
+static void *drain_loop(void *arg) {
+	(void) arg;
+
+	struct timespec idle = {0, LOG_DRAIN_MS * 1000000L};
+	while (atomic_load(&drainer_running)) {
+		if (drain_rings() > 0) {
+			continue;
+		}
+
+		if (wake_fd < 0) {
+			nanosleep(&idle, NULL);
+			continue;
+		}
+
+		// announce the wait, then look once more, a record written in between
+		// either is seen here or sees drainer_idle set and wakes the drainer
+		atomic_store(&drainer_idle, 1);
+		atomic_thread_fence(memory_order_seq_cst);
+		if (drain_rings() > 0 || !atomic_load(&drainer_running)) {
+			atomic_store(&drainer_idle, 0);
+			continue;
+		}
+
+		uint64_t wakes;
+		if (read(wake_fd, &wakes, sizeof(wakes)) < 0 && errno != EINTR) {
+			// never expected, but must not turn into a busy loop
+			nanosleep(&idle, NULL);
+		}
+		atomic_store(&drainer_idle, 0);
+	}
+	return NULL;
+}
+
+static void log_shutdown(void) {
+	if (atomic_exchange(&drainer_running, 0)) {
+		wake_drainer();
+		pthread_join(drainer, NULL);
+	}
+	drain_rings();
+}
+
+/*
+ * Logging Functions
+ */
+
+void log_record(const char *function, const char *format, const int errsav, va_list args) {
+	struct log_ring *ring = own_ring();
+	if (ring == NULL || format == NULL) {
+		return;
+	}
+
+	// full, drop rather than wait for the drainer
+	unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	if (head - tail == LOG_RING_LEN) {
+		atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+		return;
+	}
+
+	struct log_record *rec = &(ring->records[head & (LOG_RING_LEN - 1)]);
+	rec->function = function;
+	rec->format = format;
+	rec->errsav = errsav;
+	rec->argc = 0;
+	rec->strlen = 0;
+
+	// take arguments off the list in the types the format names
+	struct log_spec spec;
+	const char *cur = format;
+	while ((cur = next_spec(cur, &spec)) != NULL && rec->argc + spec.stars < LOG_ARGS_MAX) {
+		for (int i = 0; i < spec.stars; i++) {
+			rec->types[rec->argc] = LOG_ARG_INT;
+			rec->args[rec->argc++].i = va_arg(args, int);
+		}
+
+		int type = spec_type(&spec);
+		rec->types[rec->argc] = type;
+		switch (type) {
+			case LOG_ARG_INT: rec->args[rec->argc].i = va_arg(args, int); break;
+			case LOG_ARG_LONG: rec->args[rec->argc].i = va_arg(args, long); break;
+			case LOG_ARG_LLONG: rec->args[rec->argc].i = va_arg(args, long long); break;
+			case LOG_ARG_DOUBLE: rec->args[rec->argc].d = va_arg(args, double); break;
+			case LOG_ARG_STR: {
+				// strings may not outlive the call, copy what fits
+				const char *str = va_arg(args, const char *);
+				if (str == NULL) str = "(null)";
+				int room = LOG_STR_LEN - 1 - rec->strlen;
+				int len = strnlen(str, room);
+				memcpy(rec->strings + rec->strlen, str, len);
+				rec->strings[rec->strlen + len] = '\0';
+				rec->args[rec->argc].i = rec->strlen;
+
+				// once full, later strings share the last terminator
+				rec->strlen += len + 1;
+				if (rec->strlen > LOG_STR_LEN - 1) {
+					rec->strlen = LOG_STR_LEN - 1;
+				}
+				break;
+			}
+			default: rec->args[rec->argc].p = va_arg(args, void *); break;
+		}
+		rec->argc++;
+	}
+
+	// publish the record to the drainer, waking it if it went idle
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&drainer_idle, memory_order_relaxed) && atomic_exchange(&drainer_idle, 0)) {
+		wake_drainer();
+	}
+}
+
+void log_flush(void) {
+	drain_rings();
+}
+
+long log_dropped(void) {
+	long dropped = 0;
+	for (struct log_ring *ring = atomic_load(&all_rings); ring != NULL; ring = ring->next) {
+		dropped += atomic_load(&ring->dropped);
+	}
+	return dropped;
+}
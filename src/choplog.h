@@ -0,0 +1,78 @@
+#ifndef __CHOPLOG_H__
+#define __CHOPLOG_H__
+
+#include <stdarg.h>
+#include <stdatomic.h>
+
+/*
+ * Log Macros
+ */
+
+#define LOG_RING_LEN 1024 // records a thread can have waiting, a power of two
+#define LOG_ARGS_MAX 8 // arguments kept from a single record
+#define LOG_STR_LEN 128 // bytes of copied %s arguments kept from a single record
+#define LOG_DRAIN_MS 1 // how long the drainer sleeps between polls if it cannot be woken
+
+/// Argument Types
+#define LOG_ARG_INT 0
+#define LOG_ARG_LONG 1
+#define LOG_ARG_LLONG 2
+#define LOG_ARG_DOUBLE 3
+#define LOG_ARG_PTR 4
+#define LOG_ARG_STR 5 // offset of a copied string
+
+/*
+ * Structures
+ */
+
+struct log_record {
+	const char *function;
+	const char *format; // must outlive the record, normally a literal
+	int errsav; // errno when the record was made
+	int argc;
+	unsigned char types[LOG_ARGS_MAX];
+	union {
+		long long i;
+		double d;
+		const void *p;
+	} args[LOG_ARGS_MAX];
+	int strlen; // bytes used in strings
+	char strings[LOG_STR_LEN];
+};
+
+/*
+ * Single producer, single consumer ring owned by one thread and emptied by the
+ * drainer. Rings live until the process exits.
+ */
+struct log_ring {
+	struct log_record records[LOG_RING_LEN];
+	_Atomic unsigned long head; // next record the owner writes
+	_Atomic unsigned long tail; // next record the drainer formats
+	_Atomic long dropped; // records lost to a full ring
+	long reported; // drops the drainer has already reported
+	struct log_ring *next; // every ring, for the drainer to walk
+};
+
+/*
+ * Logging Functions
+ */
+
+/*
+ * Copies the function, format and arguments into the calling thread's ring
+ * without formatting them. Never blocks: when the ring is full the record is
+ * dropped and counted. The drainer is started by the first record.
+ */
+void log_record(const char *function, const char *format, const int errsav, va_list args);
+
+/*
+ * Formats and writes out every waiting record from the calling thread,
+ * used before the process exits so nothing is lost.
+ */
+void log_flush(void);
+
+/*
+ * Returns how many records every thread has dropped.
+ */
+long log_dropped(void);
+
+#endif
@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+
+#include "chopconst.h"
+#include "chopdebug.h"
+#include "chopmetrics.h"
+
+const char metrics_connections[] = "Connections: %ld accepted, %ld refused.\n";
+const char metrics_packets[] = "Packets: %ld parse errors, %ld acknowledged.\n";
+const char metrics_traffic[] = "%s: %ld in, %ld bytes; %ld out, %ld bytes.\n";
+const char metrics_latency[] = "%s: %ld packets, %ld ns median, %ld ns p99, %ld ns p99.9, %ld ns max.\n";
+
+// every worker's metrics, registered before any of them start
+static struct metrics *sources[METRICS_SOURCES];
+static int source_count = 0;
+
+/*
+ * Histogram Helpers
+ */
+
+static int bucket_of(const long value) {
+	// small values are exact
+	if (value < HIST_SUB_COUNT) {
+		return (int) value;
+	}
+
+	// larger ones keep their top HIST_SUB_BITS bits
+	int shift = 63 - __builtin_clzl(value) - HIST_SUB_BITS + 1;
+	return shift * HIST_HALF + (int) (value >> shift);
+}
+
+/*
+ * Returns the highest value that falls in the bucket.
+ */
+static long bucket_ceiling(const int index) {
+	if (index < HIST_SUB_COUNT) {
+		return index;
+	}
+
+	int shift = index / HIST_HALF - 1;
+	return (((long) (index - shift * HIST_HALF)) << shift) + (1L << shift) - 1;
+}
+
+static long peek(const long *counter) {
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static void merge_histogram(struct histogram *dest, const struct histogram *src) {
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		dest->counts[i] += peek(src->counts + i);
+	}
+	dest->total += peek(&(src->total));
+
+	long max = peek(&(src->max));
+	if (max > dest->max) {
+		dest->max = max;
+	}
+}
+
+/*
+ * Appends to the text at used, returning where it ends now.
+ */
+static int append(char *buf, const int used, const int len, const char *format, ...) {
+	if (used >= len - 1) {
+		return used;
+	}
+
+	va_list args;
+	va_start(args, format);
+	int wrote = vsnprintf(buf + used, len - used, format, args);
+	va_end(args);
+
+	// truncated text ends the buffer
+	if (wrote < 0 || wrote >= len - used) {
+		return len - 1;
+	}
+	return used + wrote;
+}
+
+/*
+ * Metrics Management Functions
+ */
+
+int init_metrics_struct(struct metrics **target) {
+	// check valid argument
+	if (target == NULL) {
+		return -EINVAL;
+	}
+
+	// every counter and bucket starts at zero
+	struct metrics *init = (struct metrics *) calloc(1, sizeof(struct metrics));
+	if (init == NULL) {
+		DEBUG_PRINT("calloc, structure");
+		return -ENOMEM;
+	}
+
+	// set given pointer to new struct
+	*target = init;
+	return 0;
+}
+
+int destroy_metrics_struct(struct metrics **target) {
+	// check valid argument
+	if (target == NULL) {
+		return -EINVAL;
+	}
+
+	// struct already doesn't exist
+	if (*target == NULL) {
+		return 0;
+	}
+
+	// forget it if it was registered
+	for (int i = 0; i < source_count; i++) {
+		if (sources[i] == *target) {
+			sources[i] = sources[--source_count];
+			break;
+		}
+	}
+
+	// deallocate structure
+	free(*target);
+
+	// dereference holder
+	*target = NULL;
+	return 0;
+}
+
+int metrics_register(struct metrics *metrics) {
+	// check valid argument
+	if (metrics == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	if (source_count == METRICS_SOURCES) {
+		DEBUG_PRINT("too many metrics registered");
+		return -ENOSPC;
+	}
+
+	sources[source_count++] = metrics;
+	return 0;
+}
+
+/*
+ * Counting Functions
+ */
+
+void metrics_add(long *counter, const long n) {
+	// a single writer, readers only need to never see a torn value
+	__atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+void metrics_packet_in(struct metrics *metrics, const int status, const long bytes, const long took_ns) {
+	if (status >= 0 && status < METRICS_STATUSES) {
+		metrics_add(metrics->packets_in + status, 1);
+		metrics_add(metrics->bytes_in + status, bytes);
+	}
+	histogram_record(&(metrics->handling), took_ns);
+}
+
+void metrics_packet_out(struct metrics *metrics, const int status, const long bytes, const long took_ns) {
+	if (status >= 0 && status < METRICS_STATUSES) {
+		metrics_add(metrics->packets_out + status, 1);
+		metrics_add(metrics->bytes_out + status, bytes);
+	}
+	histogram_record(&(metrics->queueing), took_ns);
+}
+
+void histogram_record(struct histogram *hist, const long value) {
+	// a packet read before the clock was taken counts as instant
+	long clamped = (value < 0) ? 0 : value;
+
+	metrics_add(hist->counts + bucket_of(clamped), 1);
+	metrics_add(&(hist->total), 1);
+	if (clamped > hist->max) {
+		__atomic_store_n(&(hist->max), clamped, __ATOMIC_RELAXED);
+	}
+}
+
+long histogram_value_at(struct histogram *hist, const double quantile) {
+	// check valid arguments
+	if (hist == NULL || hist->total == 0) {
+		return 0;
+	}
+
+	// rank of the value, rounded up, at least the first
+	long rank = (long) (quantile * hist->total);
+	if (rank < quantile * hist->total) rank++;
+	if (rank < 1) rank = 1;
+
+	long seen = 0;
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		seen += hist->counts[i];
+		if (seen >= rank) {
+			long ceiling = bucket_ceiling(i);
+			return (ceiling < hist->max) ? ceiling : hist->max;
+		}
+	}
+
+	return hist->max;
+}
+
+/*
+ * Reporting Functions
+ */
+
+int metrics_collect(struct metrics *out) {
+	// check valid argument
+	if (out == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// workers keep counting meanwhile, every counter is read once
+	memset(out, 0, sizeof(struct metrics));
+	for (int i = 0; i < source_count; i++) {
+		struct metrics *cur = sources[i];
+		for (int code = 0; code < METRICS_STATUSES; code++) {
+			out->packets_in[code] += peek(cur->packets_in + code);
+			out->bytes_in[code] += peek(cur->bytes_in + code);
+			out->packets_out[code] += peek(cur->packets_out + code);
+			out->bytes_out[code] += peek(cur->bytes_out + code);
+		}
+		out->parse_errors += peek(&(cur->parse_errors));
+		out->acknowledged += peek(&(cur->acknowledged));
+		out->accepted += peek(&(cur->accepted));
+		out->refused += peek(&(cur->refused));
+		merge_histogram(&(out->handling), &(cur->handling));
+		merge_histogram(&(out->queueing), &(cur->queueing));
+	}
+
+	return 0;
+}
+
+int metrics_format(struct metrics *metrics, char *buf, const int len) {
+	// check valid arguments
+	if (metrics == NULL || buf == NULL || len < 1) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	buf[0] = '\0';
+	int used = append(buf, 0, len, metrics_connections, metrics->accepted, metrics->refused);
+	used = append(buf, used, len, metrics_packets, metrics->parse_errors, metrics->acknowledged);
+
+	for (int code = 0; code < METRICS_STATUSES; code++) {
+		if (metrics->packets_in[code] == 0 && metrics->packets_out[code] == 0) {
+			continue;
+		}
+		used = append(buf, used, len, metrics_traffic, stat_to_str(code), metrics->packets_in[code], metrics->bytes_in[code], metrics->packets_out[code], metrics->bytes_out[code]);
+	}
+
+	struct histogram *hists[] = {&(metrics->handling), &(metrics->queueing)};
+	const char *names[] = {"Handling", "Queueing"};
+	for (int i = 0; i < 2; i++) {
+		used = append(buf, used, len, metrics_latency, names[i], hists[i]->total, histogram_value_at(hists[i], 0.5), histogram_value_at(hists[i], 0.99), histogram_value_at(hists[i], 0.999), hists[i]->max);
+	}
+
+	return used;
+}
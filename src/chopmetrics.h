@@ -0,0 +1,108 @@
+#ifndef __CHOPMETRICS_H__
+#define __CHOPMETRICS_H__
+
+#include "chopconst.h"
+
+/*
+ * Metrics Macros
+ */
+
+#define METRICS_STATUSES 32 // traffic is counted for every status byte below 32
+#define METRICS_SOURCES 256 // most metrics that can be registered, one per worker
+#define METRICS_TEXT_MAX 4096 // longest text metrics_format writes
+
+#define HIST_SUB_BITS 6 // values below 2^6 get a bucket each
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_HALF (HIST_SUB_COUNT / 2) // buckets every later power of two is split into
+#define HIST_BUCKETS ((65 - HIST_SUB_BITS) * HIST_HALF) // enough for any positive long
+
+/*
+ * Structures
+ */
+
+/*
+ * Counts of values in buckets a fixed fraction wide, so a recorded value is
+ * known to within about 3% whatever its size. Recording is one increment.
+ */
+struct histogram {
+	long counts[HIST_BUCKETS];
+	long total; // values recorded
+	long max; // largest value recorded
+};
+
+/*
+ * Counters of a single worker. Only the worker writes them, any thread may
+ * read them at any time without taking a lock.
+ */
+struct metrics {
+	long packets_in[METRICS_STATUSES]; // packets parsed, by status
+	long bytes_in[METRICS_STATUSES];
+	long packets_out[METRICS_STATUSES]; // packets written out, by status
+	long bytes_out[METRICS_STATUSES];
+	long parse_errors; // packets that could not be parsed or handled
+	long acknowledged; // packets acknowledged to peers, each one in a block included
+	long accepted; // connections taken in
+	long refused; // connections turned away
+	struct histogram handling; // from reading a header to its handler returning, in ns
+	struct histogram queueing; // from queuing a packet to writing its last byte, in ns
+};
+
+/*
+ * Metrics Management Functions
+ */
+
+int init_metrics_struct(struct metrics **target);
+
+int destroy_metrics_struct(struct metrics **target);
+
+/*
+ * Adds the metrics to those metrics_collect sums up. The list is shared by
+ * every thread, so register before any worker starts.
+ */
+int metrics_register(struct metrics *metrics);
+
+/*
+ * Counting Functions
+ */
+
+/*
+ * Adds n to a counter of the calling thread's own metrics, readable by other
+ * threads while it changes.
+ */
+void metrics_add(long *counter, const long n);
+
+/*
+ * Counts a parsed packet of the given status and size, and how long it took
+ * from reading its header to handling it.
+ */
+void metrics_packet_in(struct metrics *metrics, const int status, const long bytes, const long took_ns);
+
+/*
+ * Counts a packet written out, and how long it waited in the queue.
+ */
+void metrics_packet_out(struct metrics *metrics, const int status, const long bytes, const long took_ns);
+
+void histogram_record(struct histogram *hist, const long value);
+
+/*
+ * Returns the highest value the bucket holding the given quantile stands
+ * for, no more than the largest recorded. Returns 0 if nothing was recorded.
+ */
+long histogram_value_at(struct histogram *hist, const double quantile);
+
+/*
+ * Reporting Functions
+ */
+
+/*
+ * Sums every registered metrics into out, merging their histograms.
+ */
+int metrics_collect(struct metrics *out);
+
+/*
+ * Writes the metrics as lines of text, traffic only for statuses that saw
+ * any. Returns the number of bytes written, never more than len - 1.
+ */
+int metrics_format(struct metrics *metrics, char *buf, const int len);
+
+#endif
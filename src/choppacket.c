@@ -5,10 +5,29 @@
 #include <errno.h>
 #include <time.h>
 
+#include "chopcodec.h"
 #include "chopconst.h"
+#include "chopconn.h"
 #include "chopdata.h"
 #include "chopdebug.h"
+#include "chopdispatch.h"
+#include "chopmetrics.h"
 #include "choppacket.h"
+#include "choppool.h"
+#include "choptimer.h"
+#include "choptopic.h"
+
+/*
+* Time Stamp Helpers
+*/
+
+static void put_stamp(char *dest, const long value) {
+	codec_put_be(dest, STAMP_LEN, value);
+}
+
+static long get_stamp(const char *src) {
+	return (long) codec_get_be(src, STAMP_LEN);
+}
 
 /*
 * Sending functions
@@ -23,7 +42,7 @@ int write_dataless(struct client *cli, const pack_head head, const pack_stat sta
 
 	// initalize packet
 	struct packet *out;
-	if (init_packet_struct(&out) < 0) {
+	if (pool_alloc_packet(cli->pool, &out) < 0) {
 		DEBUG_PRINT("failed init packet");
 		return -1;
 	}
@@ -34,19 +53,14 @@ int write_dataless(struct client *cli, const pack_head head, const pack_stat sta
 		return -1;
 	}
 
-	// write to client
-	int ret = write_packet(cli, out);
+	// queue for client, written once the socket has room
+	int ret = enqueue_packet(cli, out);
 	if (ret < 0) {
-		DEBUG_PRINT("failed write");
+		DEBUG_PRINT("failed enqueue");
+		destroy_packet_struct(&out);
 		return ret;
 	}
 
-	// destroy allocated packet
-	if (destroy_packet_struct(&out) < 0) {
-		DEBUG_PRINT("failed packet destroy");
-		return -1;
-	}
-
 	return ret;
 }
 
@@ -59,7 +73,7 @@ int write_datapack(struct client *cli, const pack_head head, const pack_stat sta
 
 	// initalize packet
 	struct packet *out;
-	if (init_packet_struct(&out) < 0) {
+	if (pool_alloc_packet(cli->pool, &out) < 0) {
 		DEBUG_PRINT("failed init packet");
 		return -ENOMEM;
 	}
@@ -70,28 +84,17 @@ int write_datapack(struct client *cli, const pack_head head, const pack_stat sta
 		return -EINVAL;
 	}
 
-	// allocate data segment
-	struct buffer *segment;
-	if (append_buffer(out, buflen, &segment) < 0) {
-		DEBUG_PRINT("failed data expansion");
-		return -1;
-	}
-
-	// place data in section
-	if (assemble_body(segment, buf, buflen) < 0) {
+	// place data in a segment sized to fit
+	if (append_data(out, buf, buflen, buflen) < 0) {
 		DEBUG_PRINT("failed body assemble");
+		destroy_packet_struct(&out);
 		return -1;
 	}
 
-	// write to client
-	if (write_packet(cli, out) < 0) {
-		DEBUG_PRINT("failed write");
-		return -1;
-	}
-
-	// destroy allocated packet
-	if (destroy_packet_struct(&out) < 0) {
-		DEBUG_PRINT("failed packet destroy");
+	// queue for client, written once the socket has room
+	if (enqueue_packet(cli, out) < 0) {
+		DEBUG_PRINT("failed enqueue");
+		destroy_packet_struct(&out);
 		return -1;
 	}
 
@@ -107,7 +110,7 @@ int write_wordpack(struct client *cli, const pack_head head, const pack_stat sta
 
 	// initalize packet
 	struct packet *out;
-	if (init_packet_struct(&out) < 0) {
+	if (pool_alloc_packet(cli->pool, &out) < 0) {
 		DEBUG_PRINT("failed init packet");
 		return -1;
 	}
@@ -118,44 +121,170 @@ int write_wordpack(struct client *cli, const pack_head head, const pack_stat sta
 		return -1;
 	}
 
-	// allocate data segment
-	struct buffer *segment;
-	if (append_buffer(out, sizeof(unsigned long int), &segment) < 0) {
-		DEBUG_PRINT("failed data expansion");
-		return -1;
-	}
-
 	// create buffer to place value in
 	char buffer[sizeof(unsigned long int)];
 
 	// move value into buffer
 	memmove(buffer, &value, sizeof(unsigned long int));
 
-	// place data in section
-	if (assemble_body(segment, buffer, sizeof(unsigned long int)) < 0) {
+	// place data in a segment sized to fit
+	if (append_data(out, buffer, sizeof(unsigned long int), sizeof(unsigned long int)) < 0) {
 		DEBUG_PRINT("failed body assemble");
+		destroy_packet_struct(&out);
 		return -1;
 	}
 
-	// write to client
-	if (write_packet(cli, out) < 0) {
-		DEBUG_PRINT("failed write");
+	// queue for client, written once the socket has room
+	if (enqueue_packet(cli, out) < 0) {
+		DEBUG_PRINT("failed enqueue");
+		destroy_packet_struct(&out);
 		return -1;
 	}
 
-	// destroy allocated packet
-	if (destroy_packet_struct(&out) < 0) {
-		DEBUG_PRINT("failed packet destroy");
-		return -1;
+	return 0;
+}
+
+int write_shared(struct client *cli, struct shared *payload) {
+	// check valid arguments
+	if (cli == NULL || payload == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
 	}
 
-	return 0;
+	// the queue entry only carries the header fields and a reference
+	struct packet *out;
+	if (pool_alloc_packet(cli->pool, &out) < 0) {
+		DEBUG_PRINT("failed init packet");
+		return -ENOMEM;
+	}
+	struct packet_view view;
+	codec_decode_header(payload->bytes, payload->len, &view);
+	assemble_header(out, view.head, view.status, view.control1, view.control2);
+	out->shared = payload;
+	out->datasize = payload->len - HEADER_LEN;
+	payload->refs++;
+
+	// queue for client, written once the socket has room
+	int ret = enqueue_packet(cli, out);
+	if (ret < 0) {
+		DEBUG_PRINT("failed enqueue");
+		destroy_packet_struct(&out);
+		return ret;
+	}
+
+	return ret;
+}
+
+int write_file(struct client *cli, const pack_head head, const int fd, const long offset, const long len) {
+	// check valid arguments
+	if (cli == NULL || fd < 0 || offset < 0 || len < 0) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// initalize packet, which owns the file from here on
+	struct packet *out;
+	if (pool_alloc_packet(cli->pool, &out) < 0) {
+		DEBUG_PRINT("failed init packet");
+		close(fd);
+		return -ENOMEM;
+	}
+	out->file_fd = fd;
+	out->file_offset = offset;
+	out->file_left = len;
+	out->extent = len;
+
+	// setting header value
+	assemble_header(out, head, START_DATA, 0, 0);
+
+	// body length travels ahead of the body, most significant byte first
+	char extent[DATA_LEN_BYTES];
+	codec_put_be(extent, DATA_LEN_BYTES, len);
+	if (append_data(out, extent, DATA_LEN_BYTES, DATA_LEN_BYTES) < 0) {
+		DEBUG_PRINT("failed length assemble");
+		destroy_packet_struct(&out);
+		return -ENOMEM;
+	}
+
+	// queue for client, the body is sent from the file after the header
+	int ret = enqueue_packet(cli, out);
+	if (ret < 0) {
+		DEBUG_PRINT("failed enqueue");
+		destroy_packet_struct(&out);
+		return ret;
+	}
+
+	return ret;
+}
+
+int write_stamp(struct client *cli) {
+	// check valid argument
+	if (cli == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	char stamp[STAMP_LEN];
+	put_stamp(stamp, timer_now_ns());
+	return write_datapack(cli, 0, ENQUIRY, ENQUIRY_STAMP, STAMP_LEN, stamp, STAMP_LEN);
 }
 
 /*
 * Receiving Functions
 */
 
+/*
+ * Stops the deadline of an awaited status once the peer answered it.
+ */
+static void answer_awaited(struct client *cli, const int status) {
+	if (cli->awaiting == status) {
+		timer_cancel(&(cli->ack_timer));
+		cli->awaiting = -1;
+	}
+}
+
+/*
+ * Folds a round trip into the client's estimate the way TCP smooths its own,
+ * a gain of 1/8 for the mean and 1/4 for the variation.
+ */
+static void record_rtt(struct client *cli, const long rtt, const long held) {
+	if (cli->rtt_samples == 0) {
+		cli->srtt_ns = rtt;
+		cli->rttvar_ns = rtt / 2;
+	} else {
+		long error = cli->srtt_ns - rtt;
+		cli->rttvar_ns += (((error < 0) ? -error : error) - cli->rttvar_ns) / 4;
+		cli->srtt_ns += (rtt - cli->srtt_ns) / 8;
+	}
+
+	cli->rtt_last_ns = rtt;
+	cli->rtt_held_ns = held;
+	cli->rtt_samples++;
+}
+
+/*
+ * Acknowledges the packet being parsed, or holds the acknowledge back for the
+ * next block if the peer shifted out.
+ */
+static int acknowledge(struct client *cli, const pack_stat status) {
+	if (cli->ack_mode == SHIFT_OUT) {
+		cli->ack_seq = cli->in_seq;
+		cli->ack_pending++;
+		return 0;
+	}
+
+	if (cli->metrics != NULL) {
+		metrics_add(&(cli->metrics->acknowledged), 1);
+	}
+	return write_dataless(cli, 0, ACKNOWLEDGE, status, 0);
+}
+
+static void count_parse_error(struct client *cli) {
+	if (cli->metrics != NULL) {
+		metrics_add(&(cli->metrics->parse_errors), 1);
+	}
+}
+
 int parse_header(struct client *cli, struct packet *pack) {
 	// precondition for invalid arguments
 	if (cli == NULL || pack == NULL) {
@@ -163,123 +292,147 @@ int parse_header(struct client *cli, struct packet *pack) {
 		return -EINVAL;
 	}
 
-	// parse the status
-	int status = 0;
-	switch (pack->status) {
-		case NULL_BYTE:
-			DEBUG_PRINT("received NULL header");
-			break;
+	// hand the packet to the handler registered for its status
+	return dispatch_packet(DISPATCH_STATUS, pack->status, cli, pack);
+}
 
-		case START_HEADER:
-			DEBUG_PRINT("received extended header");
-			status = parse_long_header(cli, pack);
-			break;
+int parse_stream(struct client *cli) {
+	// precondition for invalid arguments
+	if (cli == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
 
-		case START_TEXT:
-			DEBUG_PRINT("received text header");
-			status = parse_text(cli, pack);
+	// extract every packet that has fully arrived
+	int parsed = 0;
+	int failed = 0;
+	while (!is_client_status(cli, CANCEL) && !cli->throttled) {
 
-			// print incoming text
-			if (print_text(cli, pack) < 0) {
-				DEBUG_PRINT("failed print");
-				return -1;
+		// start a new packet once its header is buffered
+		if (cli->partial == NULL) {
+			if (cli->recv->inring < HEADER_LEN) {
+				break;
 			}
-			break;
-
-		case ENQUIRY:
-			DEBUG_PRINT("received enquiry header");
-			status = parse_enquiry(cli, pack);
 
-			// print incoming enquiry
-			if (print_enquiry(cli, pack) < 0) {
-				DEBUG_PRINT("failed print");
-				return -1;
+			// START_DATA is only taken once its length has arrived with it
+			char header[HEADER_LEN];
+			ring_peek(cli->recv, header, HEADER_LEN);
+			if (header[PACKET_STATUS] == START_DATA && cli->recv->inring < HEADER_LEN + DATA_LEN_BYTES) {
+				break;
 			}
-			break;
 
-		case ACKNOWLEDGE:
-			DEBUG_PRINT("received acknowledge header");
-			status = parse_acknowledge(cli, pack);
-
-			// print incoming acknowledge
-			if (print_acknowledge(cli, pack) < 0) {
-				DEBUG_PRINT("failed print");
-				return -1;
+			if (pool_alloc_packet(cli->pool, &(cli->partial)) < 0) {
+				DEBUG_PRINT("failed packet init");
+				return -ENOMEM;
 			}
-			break;
-
-		case WAKEUP:
-			DEBUG_PRINT("received wakeup header");
-			status = parse_wakeup(cli, pack);
 
-			// print incoming wakeup
-			if (print_wakeup(cli, pack) < 0) {
-				DEBUG_PRINT("failed print");
-				return -1;
+			read_header(cli, cli->partial);
+			cli->partial->recv_ns = cli->recv_ns;
+			cli->remaining = packet_body_len(cli->partial);
+
+			// streamed bodies are never held, their length does not fit remaining
+			if (cli->partial->status == START_DATA) {
+				if (read_extent(cli, cli->partial) < 0) {
+					DEBUG_PRINT("invalid data length");
+					count_parse_error(cli);
+					cli->inc_flag = CANCEL;
+					cli->out_flag = CANCEL;
+					return -EOVERFLOW;
+				}
+				cli->streaming = cli->partial->extent;
 			}
-			break;
 
-		case NEG_ACKNOWLEDGE:
-			DEBUG_PRINT("received negative acknowledge header");
-			status = parse_neg_acknowledge(cli, pack);
-
-			// print incoming negative acknowledge
-			if (print_neg_acknowledge(cli, pack) < 0) {
-				DEBUG_PRINT("failed print");
-				return -1;
+			// text of unknown length can be kept in one growing buffer
+			if (cli->remaining == BODY_DELIMITED && cli->contiguous) {
+				cli->partial->flags |= PACKET_CONTIGUOUS;
 			}
-			break;
-
-		case IDLE:
-			DEBUG_PRINT("received idle header");
-			status = parse_idle(cli, pack);
-
-			// print incoming idle
-			if (print_idle(cli, pack) < 0) {
-				DEBUG_PRINT("failed print");
-				return -1;
+		}
+		struct packet *pack = cli->partial;
+
+		// continue the body where the last read left off
+		if (cli->remaining == BODY_DELIMITED) {
+			int found = read_long_text(cli, pack);
+			if (found < 0) {
+				DEBUG_PRINT("long text failed");
+				count_parse_error(cli);
+				return found;
+			} else if (found == 0) {
+				break;
 			}
-			break;
+			cli->remaining = 0;
+		} else if (cli->remaining > 0) {
+			int moved = read_data(cli, pack, cli->remaining);
+			if (moved < 0) {
+				DEBUG_PRINT("failed data read");
+				count_parse_error(cli);
+				return moved;
+			}
+			cli->remaining -= moved;
+			if (cli->remaining > 0) {
+				break;
+			}
+		} else if (cli->streaming > 0) {
+			if (stream_data(cli, pack) < 0) {
+				DEBUG_PRINT("failed data stream");
+				count_parse_error(cli);
+				failed = 1;
+			}
+			if (cli->streaming > 0) {
+				break;
+			}
+		}
 
-		case ESCAPE:
-			DEBUG_PRINT("received escape header");
-			status = parse_escape(cli, pack);
+		// packet is complete, hand it off numbered
+		cli->partial = NULL;
+		cli->in_seq = (pack->status == SHIFT_OUT) ? 0 : cli->in_seq + 1;
+		if (parse_header(cli, pack) < 0) {
+			DEBUG_PRINT("failed parse");
+			count_parse_error(cli);
+			failed = 1;
+		}
 
-			// print incoming escape
-			if (print_escape(cli, pack) < 0) {
-				DEBUG_PRINT("failed print");
-				return -1;
+		// the streamed body and its length were never held in the packet
+		if (cli->metrics != NULL) {
+			long bytes = HEADER_LEN + pack->datasize;
+			if (pack->status == START_DATA) {
+				bytes += DATA_LEN_BYTES + pack->extent;
 			}
-			break;
+			metrics_packet_in(cli->metrics, pack->status, bytes, timer_now_ns() - pack->recv_ns);
+		}
 
-		default: // unsupported/invalid
-			DEBUG_PRINT("received invalid header");
-			status = -1;
-			break;
+		if (destroy_packet_struct(&pack) < 0) {
+			DEBUG_PRINT("failed packet destroy");
+			return -1;
+		}
+		parsed++;
+		cli->packets_in++;
 	}
 
-	return status;
+	DEBUG_PRINT("parsed %d packets, %d bytes left", parsed, cli->recv->inring);
+	return (failed) ? -1 : parsed;
 }
 
-int parse_long_header(struct client *cli, struct packet *pack) {
+int parse_null(struct client *cli, struct packet *pack) {
 	// precondition for invalid arguments
 	if (cli == NULL || pack == NULL) {
 		DEBUG_PRINT("invalid arguments");
 		return -EINVAL;
 	}
 
-	int packetcount = pack->control1;
-	DEBUG_PRINT("long header of %d", packetcount);
+	DEBUG_PRINT("received NULL header");
+	return 0;
+}
 
-	// TODO: adapt to new code
-	int status = 0;
-	for (int i = 0; i < packetcount; i++) {
-		status = read_header(cli, pack);
-		if (status) break;
-		status = parse_header(cli, pack);
-		if (status) break;
+int parse_long_header(struct client *cli, struct packet *pack) {
+	// precondition for invalid arguments
+	if (cli == NULL || pack == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
 	}
 
+	// the headers that follow are parsed off the stream like any other
+	DEBUG_PRINT("long header of %d", pack->control1);
+
 	return 0;
 }
 
@@ -296,26 +449,13 @@ int parse_text(struct client *cli, struct packet *pack) {
 
 	// signals set to unknown length read
 	if (count == 0 && width == 0) {
-		int long_len = read_long_text(cli, pack);
-		if (long_len < 0) {
-			DEBUG_PRINT("long text failed");
-			return -1;
-		}
-
-		DEBUG_PRINT("long text section length %d, %d segments", long_len, pack->datalen);
+		DEBUG_PRINT("long text section, %d segments", pack->datalen);
 		return 0;
-	} else {
-
-		// read normally
-		int remaining = count * width;
-		int received = read_data(cli, pack, remaining);
-		if (received < 0) {
-			DEBUG_PRINT("failed normal read");
-			return -1;
-		}
 	}
 
-	if (write_dataless(cli, 0, ACKNOWLEDGE, START_TEXT, 0) < 0) {
+	DEBUG_PRINT("text section length %d, %d segments", count * width, pack->datalen);
+
+	if (acknowledge(cli, START_TEXT) < 0) {
 		DEBUG_PRINT("failed confirm packet");
 		return -1;
 	}
@@ -330,41 +470,94 @@ int read_long_text(struct client *cli, struct packet *pack) {
 		return -EINVAL;
 	}
 
-	int found = 1;
-	int total = 0;
-	while (found) {
+	while (cli->recv->inring > 0) {
+
+		// look for the end of the text without consuming what follows it
+		int stop_len = ring_find(cli->recv, END_TEXT, cli->window);
+		int take = stop_len;
+		if (stop_len < 0) {
+			take = (cli->recv->inring < cli->window) ? cli->recv->inring : cli->window;
+		}
+
+		if (take > 0) {
+			// make room behind what is already held
+			struct buffer *receive = pack->tail;
+			if (pack->flags & PACKET_CONTIGUOUS) {
+				if (grow_buffer(pack, take) < 0) {
+					return -ENOSPC;
+				}
+				receive = pack->tail;
+			} else if (receive == NULL || receive->inbuf == receive->bufsize) {
+				if (append_buffer(pack, cli->window, &receive) < 0) {
+					return -ENOSPC;
+				}
+			}
 
-		// allocate buffer to hold incoming data
-		struct buffer *receive;
-		if (append_buffer(pack, cli->window, &receive) < 0) {
-			return -ENOSPC;
+			int room = receive->bufsize - receive->inbuf;
+			int bytes_read = ring_read(cli->recv, receive->buf + receive->inbuf, (take < room) ? take : room);
+			receive->inbuf += bytes_read;
+			pack->datasize += bytes_read;
+
+			// more text before the end than the segment had room for
+			if (bytes_read < take) {
+				continue;
+			}
 		}
 
-		// read data into new buffer
-		int bytes_read = read(cli->socket_fd, receive->buf, cli->window);
-		if (bytes_read < 0) {
-			DEBUG_PRINT("failed to read long text section");
-			return -errno;
-		} else if (bytes_read == 0) {
-			DEBUG_PRINT("long text section empty");
-			return 0;
+		// found the end of the long text, leave what follows for the next packet
+		if (stop_len >= 0) {
+			ring_skip(cli->recv, 1);
+			return 1;
 		}
+	}
+
+	// end of the long text has not arrived yet
+	return 0;
+}
 
-		total += bytes_read;
+long stream_data(struct client *cli, struct packet *pack) {
+	// precondition for invalid arguments
+	if (cli == NULL || pack == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
 
-		int stop_len = buf_contains_symbol(receive->buf, bytes_read, END_TEXT);
-		if (stop_len < 0) {
-			// did not find the end of the long text
-			receive->inbuf = bytes_read;
-			found = 1; // TODO: might be extraneous
-		} else {
-			// found the end of the long text
-			receive->inbuf = stop_len;
-			found = 0;
+	// hand over the ring's bytes in place, a contiguous run at a time
+	long total = 0;
+	int failed = 0;
+	struct ring *ring = cli->recv;
+	while (cli->streaming > 0 && ring->inring > 0) {
+		int count = ring->ringsize - ring->start;
+		if (count > ring->inring) count = ring->inring;
+		if (count > cli->streaming) count = cli->streaming;
+
+		if (dispatch_stream(cli, pack, ring->buf + ring->start, count) < 0) {
+			failed = 1;
 		}
+		ring_skip(ring, count);
+		cli->streaming -= count;
+		total += count;
 	}
 
-	return total;
+	DEBUG_PRINT("streamed %ld, %ld remaining", total, cli->streaming);
+	return (failed) ? -1 : total;
+}
+
+int parse_data(struct client *cli, struct packet *pack) {
+	// precondition for invalid arguments
+	if (cli == NULL || pack == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	DEBUG_PRINT("data section length %ld", pack->extent);
+
+	if (acknowledge(cli, START_DATA) < 0) {
+		DEBUG_PRINT("failed confirm packet");
+		return -1;
+	}
+
+	return 0;
 }
 
 int parse_enquiry(struct client *cli, struct packet *pack) {
@@ -379,7 +572,7 @@ int parse_enquiry(struct client *cli, struct packet *pack) {
 			DEBUG_PRINT("normal enquiry");
 
 			// just return an acknowledge
-			if (write_dataless(cli, 0, ACKNOWLEDGE, ENQUIRY, 0) < 0) {
+			if (acknowledge(cli, ENQUIRY) < 0) {
 				DEBUG_PRINT("failed acknowledge packet");
 				return -1;
 			}
@@ -397,14 +590,9 @@ int parse_enquiry(struct client *cli, struct packet *pack) {
 
 		case ENQUIRY_TIME:
 			DEBUG_PRINT("time enquiry %d wide", pack->control2);
-			// read packet data
-			if (read_data(cli, pack, pack->control2) < 0) {
-				DEBUG_PRINT("failed time data read");
-				return -1;
-			}
 
 			// return acknowledge
-			if (write_dataless(cli, 0, ACKNOWLEDGE, ENQUIRY, 0) < 0) {
+			if (acknowledge(cli, ENQUIRY) < 0) {
 				DEBUG_PRINT("failed acknowledge packet");
 				return -1;
 			}
@@ -420,6 +608,38 @@ int parse_enquiry(struct client *cli, struct packet *pack) {
 			}
 			break;
 
+		case ENQUIRY_STAMP: {
+			// echo the stamp with when it was read and when it is answered
+			char stamps[3 * STAMP_LEN];
+			if (pack->control2 != STAMP_LEN || copy_body(pack, 0, stamps, STAMP_LEN) < STAMP_LEN) {
+				DEBUG_PRINT("short stamp");
+				return -1;
+			}
+			put_stamp(stamps + STAMP_LEN, (cli->recv_ns > 0) ? cli->recv_ns : timer_now_ns());
+			put_stamp(stamps + 2 * STAMP_LEN, timer_now_ns());
+
+			if (write_datapack(cli, 0, ENQUIRY, ENQUIRY_ECHO, sizeof(stamps), stamps, sizeof(stamps)) < 0) {
+				DEBUG_PRINT("failed stamp echo");
+				return -1;
+			}
+			break;
+		}
+
+		case ENQUIRY_ECHO: {
+			// only differences of the peer's own times mean anything here
+			long now = timer_now_ns();
+			char stamps[3 * STAMP_LEN];
+			if (pack->control2 != sizeof(stamps) || copy_body(pack, 0, stamps, sizeof(stamps)) < (int) sizeof(stamps)) {
+				DEBUG_PRINT("short echo");
+				return -1;
+			}
+			long held = get_stamp(stamps + 2 * STAMP_LEN) - get_stamp(stamps + STAMP_LEN);
+			record_rtt(cli, now - get_stamp(stamps), held);
+
+			DEBUG_PRINT("round trip %ld ns, held %ld ns", cli->rtt_last_ns, held);
+			break;
+		}
+
 		default:
 			DEBUG_PRINT("invalid/unsupported control signal");
 			return -1;
@@ -435,41 +655,85 @@ int parse_acknowledge(struct client *cli, struct packet *pack) {
 		return -EINVAL;
 	}
 
-	switch (pack->control1) {
-		case START_TEXT: // text confirmed
-			DEBUG_PRINT("text confirmed");
-			break;
+	// hand the packet to the handler registered for the confirmed status
+	return dispatch_packet(DISPATCH_ACK, pack->control1, cli, pack);
+}
 
-		case ENQUIRY:
-			// TODO: ping was received
-			DEBUG_PRINT("ping confirmed");
-			break;
+int ack_text(struct client *cli, struct packet *pack) {
+	// precondition for invalid argument
+	if (cli == NULL || pack == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
 
-		case WAKEUP:
-			// TODO: the sender says it has woken up
-			DEBUG_PRINT("wakeup confirmed");
-			cli->inc_flag = NULL_BYTE;
-			break;
+	DEBUG_PRINT("text confirmed");
+	return 0;
+}
 
-		case IDLE:
-			// TODO: the sender says it has gone asleep
-			DEBUG_PRINT("idle confirmed");
-			cli->inc_flag = IDLE;
-			break;
+int ack_data(struct client *cli, struct packet *pack) {
+	// precondition for invalid argument
+	if (cli == NULL || pack == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
 
-		case ESCAPE:
-			// TODO: the sender knows you're stopping
-			DEBUG_PRINT("escape confirmed");
-			// marking this client as closed
-			cli->inc_flag = CANCEL;
-			cli->out_flag = CANCEL;
-			break;
+	DEBUG_PRINT("data confirmed");
+	return 0;
+}
 
-		default:
-			DEBUG_PRINT("invalid/unsupported control signal");
-			return -1;
+int ack_enquiry(struct client *cli, struct packet *pack) {
+	// precondition for invalid argument
+	if (cli == NULL || pack == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	answer_awaited(cli, ENQUIRY);
+	DEBUG_PRINT("ping confirmed");
+	return 0;
+}
+
+int ack_wakeup(struct client *cli, struct packet *pack) {
+	// precondition for invalid argument
+	if (cli == NULL || pack == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// TODO: the sender says it has woken up
+	answer_awaited(cli, WAKEUP);
+	DEBUG_PRINT("wakeup confirmed");
+	cli->inc_flag = NULL_BYTE;
+	return 0;
+}
+
+int ack_idle(struct client *cli, struct packet *pack) {
+	// precondition for invalid argument
+	if (cli == NULL || pack == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// TODO: the sender says it has gone asleep
+	answer_awaited(cli, IDLE);
+	DEBUG_PRINT("idle confirmed");
+	cli->inc_flag = IDLE;
+	return 0;
+}
+
+int ack_escape(struct client *cli, struct packet *pack) {
+	// precondition for invalid argument
+	if (cli == NULL || pack == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
 	}
 
+	// TODO: the sender knows you're stopping
+	answer_awaited(cli, ESCAPE);
+	DEBUG_PRINT("escape confirmed");
+	// marking this client as closed
+	cli->inc_flag = CANCEL;
+	cli->out_flag = CANCEL;
 	return 0;
 }
 
@@ -486,7 +750,7 @@ int parse_wakeup(struct client *cli, struct packet *pack) {
 		cli->inc_flag = NULL_BYTE;
 
 		// confirm client wake
-		if (write_dataless(cli, 0, ACKNOWLEDGE, WAKEUP, 0) < 0) {
+		if (acknowledge(cli, WAKEUP) < 0) {
 			DEBUG_PRINT("failed confirm packet");
 			return -1;
 		}
@@ -512,32 +776,33 @@ int parse_neg_acknowledge(struct client *cli, struct packet *pack) {
 		return -EINVAL;
 	}
 
-	switch (pack->control1) {
-		case START_TEXT: // text arguments are invalid/message is invalid
-			DEBUG_PRINT("client %d refused text", cli->socket_fd);
-			break;
-
-		case ENQUIRY: // ping refused
-			DEBUG_PRINT("client %d refused ping", cli->socket_fd);
-			break;
-
-		case WAKEUP: // sender is already awake/cannot wakeup
-			DEBUG_PRINT("client %d refused wakeup", cli->socket_fd);
-			break;
+	// hand the packet to the handler registered for the refused status
+	return dispatch_packet(DISPATCH_NAK, pack->control1, cli, pack);
+}
 
-		case IDLE: // sender is already sleeping/cannot sleep
-			DEBUG_PRINT("client %d refused idle", cli->socket_fd);
-			break;
+int nak_refused(struct client *cli, struct packet *pack) {
+	// precondition for invalid argument
+	if (cli == NULL || pack == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
 
-		case ESCAPE: // you cannot disconnect
-			DEBUG_PRINT("client %d refused disconnect", cli->socket_fd);
-			break;
+	answer_awaited(cli, pack->control1);
+	DEBUG_PRINT("client %d refused %s", cli->socket_fd, stat_to_str(pack->control1));
+	return 0;
+}
 
-		default: // invalid/unsupported packet status
-			DEBUG_PRINT("invalid packet %d refused", pack->control1);
-			return -1;
+int nak_connection(struct client *cli, struct packet *pack) {
+	// precondition for invalid argument
+	if (cli == NULL || pack == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
 	}
 
+	// the server turned the connection away, nothing more will be read
+	DEBUG_PRINT("connection refused, reason %d", pack->control2);
+	cli->inc_flag = CANCEL;
+	cli->out_flag = CANCEL;
 	return 0;
 }
 
@@ -554,7 +819,7 @@ int parse_idle(struct client *cli, struct packet *pack) {
 		cli->inc_flag = IDLE;
 
 		// confirm client idle
-		if (write_dataless(cli, 0, ACKNOWLEDGE, IDLE, 0) < 0) {
+		if (acknowledge(cli, IDLE) < 0) {
 			DEBUG_PRINT("failed confirm packet");
 			return -1;
 		}
@@ -573,6 +838,265 @@ int parse_idle(struct client *cli, struct packet *pack) {
 	return 0;
 }
 
+int parse_subscribe(struct client *cli, struct packet *pack) {
+	// precondition for invalid arguments
+	if (cli == NULL || pack == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	char name[TOPIC_NAME_MAX];
+	int len = copy_body(pack, 0, name, pack->control1);
+
+	// only peers of a server keep subscriptions
+	int ret = (cli->topics != NULL) ? topic_subscribe(cli->topics, cli, name, len) : -ENOTSUP;
+	if (ret < 0) {
+		DEBUG_PRINT("client %d cannot subscribe", cli->socket_fd);
+		if (write_dataless(cli, 0, NEG_ACKNOWLEDGE, SUBSCRIBE, 0) < 0) {
+			DEBUG_PRINT("failed deny packet");
+		}
+		return ret;
+	}
+
+	if (acknowledge(cli, SUBSCRIBE) < 0) {
+		DEBUG_PRINT("failed confirm packet");
+		return -1;
+	}
+
+	return 0;
+}
+
+int parse_unsubscribe(struct client *cli, struct packet *pack) {
+	// precondition for invalid arguments
+	if (cli == NULL || pack == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	char name[TOPIC_NAME_MAX];
+	int len = copy_body(pack, 0, name, pack->control1);
+
+	// refuse topics the client never subscribed to
+	int ret = (cli->topics != NULL) ? topic_unsubscribe(cli->topics, cli, name, len) : -ENOTSUP;
+	if (ret < 0) {
+		if (write_dataless(cli, 0, NEG_ACKNOWLEDGE, UNSUBSCRIBE, 0) < 0) {
+			DEBUG_PRINT("failed deny packet");
+		}
+		return ret;
+	}
+
+	if (acknowledge(cli, UNSUBSCRIBE) < 0) {
+		DEBUG_PRINT("failed confirm packet");
+		return -1;
+	}
+
+	return 0;
+}
+
+int parse_publish(struct client *cli, struct packet *pack) {
+	// precondition for invalid arguments
+	if (cli == NULL || pack == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// a publish needs somewhere to go and a topic to go to
+	if (cli->topics == NULL || pack->control1 == 0) {
+		DEBUG_PRINT("client %d cannot publish", cli->socket_fd);
+		if (write_dataless(cli, 0, NEG_ACKNOWLEDGE, PUBLISH, 0) < 0) {
+			DEBUG_PRINT("failed deny packet");
+		}
+		return -EINVAL;
+	}
+
+	// serialized once, subscribers only take references
+	struct shared *payload;
+	if (serialize_packet(pack, &payload) < 0) {
+		DEBUG_PRINT("failed serializing publish");
+		return -ENOMEM;
+	}
+	payload->bytes[PACKET_STATUS] = DELIVER;
+
+	// the table counts deliveries, only a failure matters here
+	int queued = topic_publish(cli->topics, payload);
+	if (queued < 0) {
+		DEBUG_PRINT("failed publish from client %d", cli->socket_fd);
+		destroy_shared_struct(&payload);
+		return queued;
+	}
+
+	if (cli->topics->on_publish != NULL) {
+		cli->topics->on_publish(cli->topics, payload);
+	}
+	destroy_shared_struct(&payload);
+
+	DEBUG_PRINT("client %d published to %d subscribers", cli->socket_fd, queued);
+	return 0;
+}
+
+int parse_deliver(struct client *cli, struct packet *pack) {
+	// precondition for invalid arguments
+	if (cli == NULL || pack == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// deliveries only flow from the server
+	if (cli->topics != NULL) {
+		if (write_dataless(cli, 0, NEG_ACKNOWLEDGE, DELIVER, 0) < 0) {
+			DEBUG_PRINT("failed deny packet");
+		}
+		return -EINVAL;
+	}
+
+	DEBUG_PRINT("delivery of %d bytes on a %d byte topic", pack->control2, pack->control1);
+	return 0;
+}
+
+int ack_topic(struct client *cli, struct packet *pack) {
+	// precondition for invalid argument
+	if (cli == NULL || pack == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	DEBUG_PRINT("%s confirmed", stat_to_str(pack->control1));
+	return 0;
+}
+
+int parse_shift_out(struct client *cli, struct packet *pack) {
+	// precondition for invalid arguments
+	if (cli == NULL || pack == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// already shifted out, nothing to change
+	if (cli->ack_mode == SHIFT_OUT) {
+		if (write_dataless(cli, 0, NEG_ACKNOWLEDGE, SHIFT_OUT, 0) < 0) {
+			DEBUG_PRINT("failed deny packet");
+			return -1;
+		}
+		return 0;
+	}
+
+	// confirmed on its own, the packets after it are acknowledged in blocks
+	if (write_dataless(cli, 0, ACKNOWLEDGE, SHIFT_OUT, 0) < 0) {
+		DEBUG_PRINT("failed confirm packet");
+		return -1;
+	}
+	cli->ack_mode = SHIFT_OUT;
+
+	DEBUG_PRINT("client %d acknowledged in blocks", cli->socket_fd);
+	return 0;
+}
+
+int parse_shift_in(struct client *cli, struct packet *pack) {
+	// precondition for invalid arguments
+	if (cli == NULL || pack == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// never shifted out, nothing to change
+	if (cli->ack_mode != SHIFT_OUT) {
+		if (write_dataless(cli, 0, NEG_ACKNOWLEDGE, SHIFT_IN, 0) < 0) {
+			DEBUG_PRINT("failed deny packet");
+			return -1;
+		}
+		return 0;
+	}
+
+	// close the last block before acknowledging one by one again
+	send_ack_block(cli);
+	cli->ack_mode = SHIFT_IN;
+	if (write_dataless(cli, 0, ACKNOWLEDGE, SHIFT_IN, 0) < 0) {
+		DEBUG_PRINT("failed confirm packet");
+		return -1;
+	}
+
+	DEBUG_PRINT("client %d acknowledged one by one", cli->socket_fd);
+	return 0;
+}
+
+int ack_shift(struct client *cli, struct packet *pack) {
+	// precondition for invalid argument
+	if (cli == NULL || pack == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	DEBUG_PRINT("%s confirmed", stat_to_str(pack->control1));
+	return 0;
+}
+
+int ack_block(struct client *cli, struct packet *pack) {
+	// precondition for invalid argument
+	if (cli == NULL || pack == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	unsigned int seq;
+	unsigned int count;
+	if (read_ack_block(pack, &seq, &count) < 0) {
+		DEBUG_PRINT("short acknowledge block");
+		return -EINVAL;
+	}
+
+	// the awaited status is answered once the block reaches its packet
+	if (cli->awaiting >= 0 && (int) (seq - cli->awaiting_seq) >= 0) {
+		DEBUG_PRINT("block answers %s", stat_to_str(cli->awaiting));
+		return dispatch_packet(DISPATCH_ACK, cli->awaiting, cli, pack);
+	}
+
+	DEBUG_PRINT("%u confirmed through %u", count, seq);
+	return 0;
+}
+
+int parse_metrics(struct client *cli, struct packet *pack) {
+	// precondition for invalid argument
+	if (cli == NULL || pack == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// a report is only taken by a peer that keeps none, a query only by one that does
+	if (pack->control1 == METRICS_REPORT && cli->metrics == NULL) {
+		DEBUG_PRINT("metrics report of %d bytes", pack->datasize);
+		return 0;
+	} else if (pack->control1 != METRICS_QUERY || cli->metrics == NULL) {
+		if (write_dataless(cli, 0, NEG_ACKNOWLEDGE, END_OF_MEDIUM, 0) < 0) {
+			DEBUG_PRINT("failed deny packet");
+		}
+		return -EINVAL;
+	}
+
+	struct metrics *snapshot;
+	if (init_metrics_struct(&snapshot) < 0) {
+		DEBUG_PRINT("failed metrics snapshot");
+		return -ENOMEM;
+	}
+	metrics_collect(snapshot);
+
+	// every worker's metrics, then what this connection alone did
+	char text[METRICS_TEXT_MAX + 1];
+	int len = metrics_format(snapshot, text, METRICS_TEXT_MAX);
+	destroy_metrics_struct(&snapshot);
+	len += snprintf(text + len, METRICS_TEXT_MAX - len, "Connection: %ld packets in, %ld bytes in, %ld bytes out, %d bytes queued.\n", cli->packets_in, cli->bytes_in, cli->bytes_out, cli->out_bytes);
+	if (len >= METRICS_TEXT_MAX) {
+		len = METRICS_TEXT_MAX - 1;
+	}
+	text[len++] = END_TEXT;
+
+	if (write_datapack(cli, 0, END_OF_MEDIUM, METRICS_REPORT, 0, text, len) < 0) {
+		DEBUG_PRINT("failed metrics report");
+		return -1;
+	}
+
+	return 0;
+}
+
 int parse_escape(struct client *cli, struct packet *pack) {
 	// precondition for invalid argument
 	if (cli == NULL || pack == NULL) {
@@ -641,38 +1165,234 @@ int append_buffer(struct packet *pack, const int bufsize, struct buffer **out) {
 		return -EINVAL;
 	}
 
-	// data section is empty
-	if (pack->data == NULL) {
-		if (init_buffer_struct(&(pack->data), bufsize) < 0) {
+	// allocate new empty data segment
+	struct buffer *segment;
+	if (pool_alloc_buffer(pack->pool, bufsize, &segment) < 0) {
+		DEBUG_PRINT("failed buffer init");
+		return -1;
+	}
+
+	// link after the tail, or start the data section if it is empty
+	if (pack->tail == NULL) {
+		pack->data = segment;
+	} else {
+		pack->tail->next = segment;
+	}
+	pack->tail = segment;
+
+	// return reference to new buffer
+	if (out != NULL) {
+		*out = segment;
+	}
+
+	pack->datalen++;
+	return 0;
+}
+
+int append_data(struct packet *pack, const char *data, const int len, const int bufsize) {
+	// check valid arguments
+	if (pack == NULL || data == NULL || len < 0 || bufsize < 1) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	int copied = 0;
+	while (copied < len) {
+		// make room behind the tail
+		if (pack->flags & PACKET_CONTIGUOUS) {
+			if (grow_buffer(pack, len - copied) < 0) {
+				DEBUG_PRINT("failed data growth");
+				return -ENOMEM;
+			}
+		} else if (pack->tail == NULL || pack->tail->inbuf == pack->tail->bufsize) {
+			if (append_buffer(pack, bufsize, NULL) < 0) {
+				DEBUG_PRINT("failed data expansion");
+				return -ENOMEM;
+			}
+		}
+
+		// copy as much as fits in the tail
+		struct buffer *tail = pack->tail;
+		int count = tail->bufsize - tail->inbuf;
+		if (count > len - copied) count = len - copied;
+		memmove(tail->buf + tail->inbuf, data + copied, count);
+
+		tail->inbuf += count;
+		pack->datasize += count;
+		copied += count;
+	}
+
+	return copied;
+}
+
+int grow_buffer(struct packet *pack, const int need) {
+	// check valid arguments, only a single segment can grow in place
+	if (pack == NULL || need < 0 || pack->datalen > 1) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// first segment is exactly what is needed
+	if (pack->tail == NULL) {
+		return append_buffer(pack, (need > 0) ? need : 1, NULL);
+	}
+
+	// enough room already
+	struct buffer *old = pack->tail;
+	if (old->bufsize - old->inbuf >= need) {
+		return 0;
+	}
+
+	// double until the new bytes fit
+	int size = old->bufsize;
+	while (size - old->inbuf < need) {
+		size *= 2;
+	}
+
+	struct buffer *grown;
+	if (old->origin != NULL) {
+		// pooled slots are fixed size, move the data to its own allocation
+		if (init_buffer_struct(&grown, size) < 0) {
 			DEBUG_PRINT("failed buffer init");
-			return -1;
+			return -ENOMEM;
 		}
+		memmove(grown->buf, old->buf, old->inbuf);
+		grown->inbuf = old->inbuf;
+		destroy_buffer_struct(&old);
+	} else {
+		// structure and data share an allocation, so both move together
+		grown = (struct buffer *) realloc(old, sizeof(struct buffer) + sizeof(char) * size);
+		if (grown == NULL) {
+			DEBUG_PRINT("realloc");
+			return -ENOMEM;
+		}
+		grown->buf = (char *) (grown + 1);
+		grown->bufsize = size;
+	}
+
+	pack->data = grown;
+	pack->tail = grown;
+
+	DEBUG_PRINT("grew data to %d", size);
+	return 0;
+}
+
+int packet_body_len(struct packet *pack) {
+	// check valid argument
+	if (pack == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	return codec_body_len(pack->status, pack->control1, pack->control2);
+}
+
+int serialize_packet(struct packet *pack, struct shared **out) {
+	// check valid arguments
+	if (pack == NULL || out == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// a packet that is already serialized only gains a holder
+	if (pack->shared != NULL) {
+		pack->shared->refs++;
+		*out = pack->shared;
+		return 0;
+	}
 
-		// return reference to new buffer
-		if (out != NULL) {
-			*out = pack->data;
+	struct shared *init;
+	if (init_shared_struct(&init, HEADER_LEN + pack->datasize) < 0) {
+		DEBUG_PRINT("failed shared init");
+		return -ENOMEM;
+	}
+
+	// header first, then the segments back to back
+	int offset = codec_encode_header(init->bytes, init->len, pack->head, pack->status, pack->control1, pack->control2);
+	struct buffer *segment;
+	for (segment = pack->data; segment != NULL; segment = segment->next) {
+		memcpy(init->bytes + offset, segment->buf, segment->inbuf);
+		offset += segment->inbuf;
+	}
+
+	*out = init;
+	return 0;
+}
+
+int copy_body(struct packet *pack, const int offset, char *dest, const int len) {
+	// check valid arguments
+	if (pack == NULL || dest == NULL || offset < 0 || len < 0) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// skip whole segments before the offset, then copy across the rest
+	int skip = offset;
+	int copied = 0;
+	struct buffer *segment;
+	for (segment = pack->data; segment != NULL && copied < len; segment = segment->next) {
+		if (skip >= segment->inbuf) {
+			skip -= segment->inbuf;
+			continue;
 		}
 
-		pack->datalen++;
+		int count = segment->inbuf - skip;
+		if (count > len - copied) count = len - copied;
+		memcpy(dest + copied, segment->buf + skip, count);
+		copied += count;
+		skip = 0;
+	}
+
+	return copied;
+}
+
+int send_ack_block(struct client *cli) {
+	// precondition for invalid argument
+	if (cli == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// nothing held back
+	if (cli->ack_pending == 0) {
 		return 0;
 	}
 
-	// loop to end of data section
-	struct buffer *cur;
-	for (cur = pack->data; cur->next != NULL; cur = cur->next);
+	// taken first, queuing the block must not queue it again
+	unsigned int count = cli->ack_pending;
+	cli->ack_pending = 0;
+	if (cli->metrics != NULL) {
+		metrics_add(&(cli->metrics->acknowledged), count);
+	}
 
-	// append new empty data segment
-	if (init_buffer_struct(&(cur->next), bufsize) < 0) {
-		DEBUG_PRINT("failed buffer init");
+	// sequence then count, most significant byte first
+	char block[ACK_BLOCK_LEN];
+	codec_put_be(block, ACK_BLOCK_LEN / 2, cli->ack_seq);
+	codec_put_be(block + ACK_BLOCK_LEN / 2, ACK_BLOCK_LEN / 2, count);
+
+	if (write_datapack(cli, 0, ACKNOWLEDGE, END_TRANSMISSION_BLOCK, ACK_BLOCK_LEN, block, ACK_BLOCK_LEN) < 0) {
+		DEBUG_PRINT("failed block packet");
 		return -1;
 	}
 
-	// return reference to new buffer
-	if (out != NULL) {
-		*out = cur->next;
+	DEBUG_PRINT("acknowledged %u through %u", count, cli->ack_seq);
+	return count;
+}
+
+int read_ack_block(struct packet *pack, unsigned int *seq, unsigned int *count) {
+	// check valid arguments
+	if (pack == NULL || seq == NULL || count == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
 	}
 
-	pack->datalen++;
+	char block[ACK_BLOCK_LEN];
+	if (copy_body(pack, 0, block, ACK_BLOCK_LEN) < ACK_BLOCK_LEN) {
+		return -EINVAL;
+	}
+
+	*seq = (unsigned int) codec_get_be(block, ACK_BLOCK_LEN / 2);
+	*count = (unsigned int) codec_get_be(block + ACK_BLOCK_LEN / 2, ACK_BLOCK_LEN / 2);
 	return 0;
 }
 
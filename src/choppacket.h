@@ -13,40 +13,203 @@ int write_datapack(struct client *cli, const pack_head head, const pack_stat sta
 
 int write_wordpack(struct client *cli, const pack_head head, const pack_stat status, const pack_con1 control1, const pack_con2 control2, unsigned long int value);
 
+/*
+ * Queues an already serialized packet for the client without copying it,
+ * taking a reference the queue drops once the bytes are written.
+ */
+int write_shared(struct client *cli, struct shared *payload);
+
+/*
+ * Queues a START_DATA whose len byte body is sent from fd, starting at offset,
+ * with sendfile rather than read into the process. The queue takes ownership
+ * of fd and closes it once the packet is gone, even if queuing fails.
+ */
+int write_file(struct client *cli, const pack_head head, const int fd, const long offset, const long len);
+
+/*
+ * Sends an ENQUIRY_STAMP of the current monotonic time. The peer's echo is
+ * folded into the client's round trip estimate when it arrives.
+ */
+int write_stamp(struct client *cli);
+
 /*
  * Receiving functions
  */
 
+/*
+ * Parses every packet that has fully arrived in the client's receive ring,
+ * keeping a partly received packet on the client until the rest arrives.
+ * Stops early while the client is throttled by its outbound queue. Returns the number of packets parsed, or negative if any failed.
+ */
+int parse_stream(struct client *cli);
+
+/*
+ * Hands the packet to the handler registered for its status in the dispatch
+ * table. Returns the handler's result, or negative for unsupported statuses.
+ */
 int parse_header(struct client *cli, struct packet *pack);
 
+int parse_null(struct client *cli, struct packet *pack);
+
 int parse_long_header(struct client *cli, struct packet *pack);
 
 int parse_text(struct client *cli, struct packet *pack);
 
+/*
+ * Moves received text into the packet until END_TEXT is found, dropping the
+ * END_TEXT and leaving any bytes after it in the receive ring for the next
+ * packet. Returns 1 once the end was found, 0 if more of the text has yet to
+ * arrive.
+ */
 int read_long_text(struct client *cli, struct packet *pack);
 
+/*
+ * Hands the START_DATA body waiting in the receive ring to the stream handler
+ * without copying it, until the client is streaming nothing more. Returns the
+ * number of bytes handed over, or negative if the handler failed.
+ */
+long stream_data(struct client *cli, struct packet *pack);
+
+int parse_data(struct client *cli, struct packet *pack);
+
 int parse_enquiry(struct client *cli, struct packet *pack);
 
 int parse_acknowledge(struct client *cli, struct packet *pack);
 
+int ack_text(struct client *cli, struct packet *pack);
+
+int ack_data(struct client *cli, struct packet *pack);
+
+int ack_enquiry(struct client *cli, struct packet *pack);
+
+int ack_wakeup(struct client *cli, struct packet *pack);
+
+int ack_idle(struct client *cli, struct packet *pack);
+
+int ack_escape(struct client *cli, struct packet *pack);
+
 int parse_wakeup(struct client *cli, struct packet *pack);
 
 int parse_neg_acknowledge(struct client *cli, struct packet *pack);
 
+int nak_refused(struct client *cli, struct packet *pack);
+
+/*
+ * Handles the server refusing the connection itself, a NEG_ACKNOWLEDGE of
+ * NULL_BYTE whose control2 gives the reason. Marks the client as closed.
+ */
+int nak_connection(struct client *cli, struct packet *pack);
+
 int parse_idle(struct client *cli, struct packet *pack);
 
+/*
+ * Adds the client to the topic named in the data section, acknowledging it,
+ * or refuses if the client cannot subscribe.
+ */
+int parse_subscribe(struct client *cli, struct packet *pack);
+
+int parse_unsubscribe(struct client *cli, struct packet *pack);
+
+/*
+ * Serializes the packet once as a DELIVER and queues it for every subscriber
+ * of its topic, then hands it to the table's on_publish. Publishes are not
+ * acknowledged, only refused.
+ */
+int parse_publish(struct client *cli, struct packet *pack);
+
+/*
+ * Takes a delivery from the server. Peers that can subscribe are refused, only
+ * the server delivers.
+ */
+int parse_deliver(struct client *cli, struct packet *pack);
+
+int ack_topic(struct client *cli, struct packet *pack);
+
+/*
+ * Switches the client to acknowledges in blocks, confirming the switch itself
+ * on its own. Every packet after it is numbered from 1, and acknowledges for
+ * them go out together as one END_TRANSMISSION_BLOCK per turn.
+ */
+int parse_shift_out(struct client *cli, struct packet *pack);
+
+/*
+ * Sends the last block, then acknowledges every packet on its own again.
+ */
+int parse_shift_in(struct client *cli, struct packet *pack);
+
+int ack_shift(struct client *cli, struct packet *pack);
+
+/*
+ * Takes an acknowledge for a block of packets, answering the awaited status
+ * through its own handler if the block reaches the packet that sent it.
+ */
+int ack_block(struct client *cli, struct packet *pack);
+
+/*
+ * Answers a METRICS_QUERY with a METRICS_REPORT of every worker's metrics and
+ * the asking connection's own counters, or takes a report on a peer that keeps
+ * no metrics. Anything else is refused.
+ */
+int parse_metrics(struct client *cli, struct packet *pack);
+
 int parse_escape(struct client *cli, struct packet *pack);
 
 /*
  * Packet Utility functions
  */
 
+/*
+ * Queues the acknowledges held back for the client as one
+ * END_TRANSMISSION_BLOCK. Returns how many it acknowledged, 0 if none were
+ * held back.
+ */
+int send_ack_block(struct client *cli);
+
+/*
+ * Reads the sequence and count out of an acknowledge for a block.
+ */
+int read_ack_block(struct packet *pack, unsigned int *seq, unsigned int *count);
+
 int assemble_header(struct packet *pack, pack_head head, pack_stat status, pack_con1 control1, pack_con2 control2);
 
 int assemble_body(struct buffer *buffer, const char *data, const int len);
 
+/*
+ * Links a new empty segment of the given size after the packet's tail.
+ */
 int append_buffer(struct packet *pack, const int bufsize, struct buffer **out);
 
+/*
+ * Copies data behind the packet's tail, filling any room left in the tail
+ * before appending segments of bufsize. Contiguous packets grow their single
+ * segment instead. Returns the number of bytes copied.
+ */
+int append_data(struct packet *pack, const char *data, const int len, const int bufsize);
+
+/*
+ * Ensures the packet's only segment has room for need more bytes, doubling
+ * its size as often as required.
+ */
+int grow_buffer(struct packet *pack, const int need);
+
+/*
+ * Returns how many body bytes follow the given header, or BODY_DELIMITED if
+ * the body runs until an END_TEXT symbol.
+ */
+int packet_body_len(struct packet *pack);
+
+/*
+ * Copies the packet's header and every data segment into one shared buffer,
+ * returned holding the only reference.
+ */
+int serialize_packet(struct packet *pack, struct shared **out);
+
 int packet_style(struct packet *pack);
 
+/*
+ * Copies len bytes of the data section, starting offset bytes in, across
+ * segments. Returns the number of bytes copied.
+ */
+int copy_body(struct packet *pack, const int offset, char *dest, const int len);
+
 #endif
@@ -0,0 +1,283 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "chopconst.h"
+#include "chopdebug.h"
+#include "choppool.h"
+
+/*
+ * Slab Helpers
+ */
+
+static int stride_of(const int bufsize) {
+	// struct and payload share one slot, rounded so the next slot is aligned
+	int stride = sizeof(struct buffer) + bufsize;
+	return (stride + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1);
+}
+
+static void *new_slab(struct pool *pool, const size_t size) {
+	// make room to remember the slab
+	if (pool->slab_count == pool->slab_cap) {
+		int cap = (pool->slab_cap > 0) ? pool->slab_cap * 2 : 16;
+		void **mem = (void **) realloc(pool->slabs, sizeof(void *) * cap);
+		if (mem == NULL) {
+			DEBUG_PRINT("realloc, slab list");
+			return NULL;
+		}
+		pool->slabs = mem;
+		pool->slab_cap = cap;
+	}
+
+	void *slab = malloc(size);
+	if (slab == NULL) {
+		DEBUG_PRINT("malloc, slab");
+		return NULL;
+	}
+
+	pool->slabs[pool->slab_count++] = slab;
+	return slab;
+}
+
+static void count_out(struct pool_stats *stats, const int hit) {
+	if (hit) {
+		stats->hits++;
+	} else {
+		stats->misses++;
+	}
+
+	stats->in_use++;
+	if (stats->in_use > stats->high_water) {
+		stats->high_water = stats->in_use;
+	}
+}
+
+/*
+ * Pool Management Functions
+ */
+
+int init_pool_struct(struct pool **target) {
+	// check valid argument
+	if (target == NULL) {
+		return -EINVAL;
+	}
+
+	// allocate structure
+	struct pool *init = (struct pool *) malloc(sizeof(struct pool));
+	if (init == NULL) {
+		DEBUG_PRINT("malloc");
+		return -ENOMEM;
+	}
+
+	// initialize structure fields
+	memset(init, 0, sizeof(struct pool));
+
+	// set given pointer to new struct
+	*target = init;
+	return 0;
+}
+
+int destroy_pool_struct(struct pool **target) {
+	// check valid argument
+	if (target == NULL) {
+		return -EINVAL;
+	}
+
+	// struct already doesn't exist
+	if (*target == NULL) {
+		return 0;
+	}
+
+	// direct reference to structure
+	struct pool *old = *target;
+
+	// deallocate every slab, which holds all pooled objects
+	for (int i = 0; i < old->slab_count; i++) {
+		free(old->slabs[i]);
+	}
+	free(old->slabs);
+
+	// deallocate structure
+	free(old);
+
+	// dereference holder
+	*target = NULL;
+	return 0;
+}
+
+int pool_add_class(struct pool *pool, const int bufsize) {
+	// check valid arguments
+	if (pool == NULL || bufsize < 1) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// class already exists
+	for (int i = 0; i < pool->class_count; i++) {
+		if (pool->classes[i].bufsize == bufsize) {
+			return 0;
+		}
+	}
+
+	// no room for another class
+	if (pool->class_count == POOL_CLASSES) {
+		DEBUG_PRINT("no room for class %d", bufsize);
+		return -ENOSPC;
+	}
+
+	// classes never move, buffers point back at the class they came from
+	struct slab_class *class = pool->classes + pool->class_count++;
+	memset(class, 0, sizeof(struct slab_class));
+	class->bufsize = bufsize;
+
+	DEBUG_PRINT("slab class %d of %d", bufsize, pool->class_count);
+	return 0;
+}
+
+/*
+ * Allocation Functions
+ */
+
+int pool_alloc_packet(struct pool *pool, struct packet **target) {
+	// check valid argument
+	if (target == NULL) {
+		return -EINVAL;
+	}
+
+	// unpooled allocation
+	if (pool == NULL) {
+		return init_packet_struct(target);
+	}
+
+	// free list is empty, carve a new slab into it
+	int hit = (pool->free_packets != NULL);
+	if (!hit) {
+		struct packet *slab = (struct packet *) new_slab(pool, sizeof(struct packet) * POOL_SLAB_LEN);
+		if (slab == NULL) {
+			return -ENOMEM;
+		}
+
+		for (int i = 0; i < POOL_SLAB_LEN; i++) {
+			slab[i].next = pool->free_packets;
+			pool->free_packets = slab + i;
+		}
+	}
+
+	// take packet off the free list
+	struct packet *init = pool->free_packets;
+	pool->free_packets = init->next;
+	count_out(&(pool->packet_stats), hit);
+
+	// initialize structure fields
+	clear_packet_struct(init);
+	init->pool = pool;
+
+	// set given pointer to new struct
+	*target = init;
+	return 0;
+}
+
+int pool_release_packet(struct packet *pack) {
+	// check valid argument
+	if (pack == NULL || pack->pool == NULL) {
+		return -EINVAL;
+	}
+
+	// return packet to the free list
+	struct pool *pool = pack->pool;
+	pack->next = pool->free_packets;
+	pool->free_packets = pack;
+	pool->packet_stats.in_use--;
+	return 0;
+}
+
+int pool_alloc_buffer(struct pool *pool, const int size, struct buffer **target) {
+	// check valid argument
+	if (target == NULL || size < 1) {
+		return -EINVAL;
+	}
+
+	// unpooled allocation
+	if (pool == NULL) {
+		return init_buffer_struct(target, size);
+	}
+
+	// find smallest class the size fits in
+	struct slab_class *class = NULL;
+	for (int i = 0; i < pool->class_count; i++) {
+		if (pool->classes[i].bufsize >= size && (class == NULL || pool->classes[i].bufsize < class->bufsize)) {
+			class = pool->classes + i;
+		}
+	}
+
+	// too large to pool
+	if (class == NULL) {
+		DEBUG_PRINT("no class for %d", size);
+		return init_buffer_struct(target, size);
+	}
+
+	// free list is empty, carve a new slab into it
+	int hit = (class->free != NULL);
+	if (!hit) {
+		int stride = stride_of(class->bufsize);
+		char *slab = (char *) new_slab(pool, (size_t) stride * POOL_SLAB_LEN);
+		if (slab == NULL) {
+			return -ENOMEM;
+		}
+
+		for (int i = 0; i < POOL_SLAB_LEN; i++) {
+			struct buffer *cur = (struct buffer *) (slab + (size_t) stride * i);
+			cur->buf = (char *) (cur + 1);
+			cur->bufsize = class->bufsize;
+			cur->origin = class;
+			cur->next = class->free;
+			class->free = cur;
+		}
+	}
+
+	// take buffer off the free list
+	struct buffer *init = class->free;
+	class->free = init->next;
+	count_out(&(class->stats), hit);
+
+	// initialize structure fields
+	init->inbuf = 0;
+	init->next = NULL;
+
+	// set given pointer to new struct
+	*target = init;
+	return 0;
+}
+
+int pool_release_buffer(struct buffer *buffer) {
+	// check valid argument
+	if (buffer == NULL || buffer->origin == NULL) {
+		return -EINVAL;
+	}
+
+	// return buffer to its class' free list
+	struct slab_class *class = buffer->origin;
+	buffer->next = class->free;
+	class->free = buffer;
+	class->stats.in_use--;
+	return 0;
+}
+
+/*
+ * Pool Utility Functions
+ */
+
+void pool_buffer_stats(struct pool *pool, struct pool_stats *out) {
+	// check valid arguments
+	if (pool == NULL || out == NULL) {
+		return;
+	}
+
+	memset(out, 0, sizeof(struct pool_stats));
+	for (int i = 0; i < pool->class_count; i++) {
+		out->hits += pool->classes[i].stats.hits;
+		out->misses += pool->classes[i].stats.misses;
+		out->in_use += pool->classes[i].stats.in_use;
+		out->high_water += pool->classes[i].stats.high_water;
+	}
+}
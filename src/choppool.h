@@ -0,0 +1,84 @@
+#ifndef __CHOPPOOL_H__
+#define __CHOPPOOL_H__
+
+#include "chopconst.h"
+
+/*
+ * Pool Macros
+ */
+
+#define POOL_CLASSES 4 // distinct buffer sizes a pool keeps slabs for
+#define POOL_SLAB_LEN 64 // objects carved out of every slab allocation
+#define POOL_ALIGN 16 // alignment of every object carved from a slab
+
+/*
+ * Structures
+ */
+
+struct pool_stats {
+	long hits; // requests served from a free list
+	long misses; // requests that needed a new slab carved
+	int in_use; // objects handed out and not yet released
+	int high_water; // most objects in use at once
+};
+
+struct slab_class {
+	int bufsize; // payload size of every buffer in this class
+	struct buffer *free; // released buffers, linked through next
+	struct pool_stats stats;
+};
+
+struct pool {
+	struct slab_class classes[POOL_CLASSES]; // in order of registration
+	int class_count;
+	struct packet *free_packets; // released packets, linked through next
+	struct pool_stats packet_stats;
+	void **slabs; // every slab allocation, freed with the pool
+	int slab_count;
+	int slab_cap;
+};
+
+/*
+ * Pool Management Functions
+ */
+
+int init_pool_struct(struct pool **target);
+
+int destroy_pool_struct(struct pool **target);
+
+/*
+ * Registers a slab class for buffers of the given size, normally a client's
+ * window. Registering a size that already has a class does nothing.
+ */
+int pool_add_class(struct pool *pool, const int bufsize);
+
+/*
+ * Allocation Functions
+ */
+
+/*
+ * Takes a cleared packet from the pool, which it returns to when destroyed.
+ * A NULL pool falls back to init_packet_struct.
+ */
+int pool_alloc_packet(struct pool *pool, struct packet **target);
+
+int pool_release_packet(struct packet *pack);
+
+/*
+ * Takes an empty buffer of at least the given size from the smallest class
+ * that fits. Sizes larger than every class fall back to init_buffer_struct.
+ */
+int pool_alloc_buffer(struct pool *pool, const int size, struct buffer **target);
+
+int pool_release_buffer(struct buffer *buffer);
+
+/*
+ * Pool Utility Functions
+ */
+
+/*
+ * Sums the statistics of every slab class into the given structure.
+ */
+void pool_buffer_stats(struct pool *pool, struct pool_stats *out);
+
+#endif
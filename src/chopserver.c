@@ -5,13 +5,25 @@
 #include <signal.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
 
 #include "chopconn.h"
 #include "chopconst.h"
 #include "chopdata.h"
 #include "chopdebug.h"
+#include "chopdispatch.h"
+#include "chopevent.h"
+#include "chopmetrics.h"
 #include "choppacket.h"
+#include "choppool.h"
+#include "chopsink.h"
 #include "chopsocket.h"
+#include "choptimer.h"
+#include "choptopic.h"
+#include "chopuring.h"
 
 #ifndef PORT
 #define PORT 50001
@@ -20,6 +32,12 @@
 #define BUFSIZE 255
 #define CONNECTION_QUEUE 5
 #define MAX_CONNECTIONS 20
+#define MAX_EVENTS 256
+#define MAX_WORKERS 256
+#define ADMIT_REFUSE_BURST 64 // queued connections refused at once when the server fills
+#define IDLE_TIMEOUT_MS 60000 // silence after which a client is closed
+#define KEEPALIVE_MS 15000 // silence after which a client is pinged
+#define ACK_DEADLINE_MS 5000 // time a client has to acknowledge a ping
 
 const char server_header[] = "[SERVER] %s\n";
 const char client_header[] = "[CLIENT %d] %s\n";
@@ -28,110 +46,997 @@ const char server_shutdown[] = "[SERVER] Shutting down.\n";
 
 const char client_closed[] = "[CLIENT %d] Connection closed.\n";
 const char connection_accept[] = "[CLIENT %d] Connected.\n";
+const char client_idle[] = "[CLIENT %d] Silent for %ld ms, closing.\n";
+const char client_deadline[] = "[CLIENT %d] Keepalive not acknowledged, closing.\n";
 
-int sigint_received;
+const char server_usage[] = "usage: %s [-a ack_ms] [-b epoll|poll|uring] [-c max_connections] [-H high_water] [-k keepalive_ms] [-L low_water] [-g] [-m connection_limit] [-M metrics_ms] [-o none|batch|console] [-t idle_ms] [-w workers]\n";
+const char server_workers[] = "[SERVER] Listening with %d workers.\n";
+const char server_worker[] = "[SERVER] Worker %d: %ld connections, %ld packets, %ld bytes in, %ld bytes out.\n";
+const char server_total[] = "[SERVER] Total: %ld connections, %ld packets, %ld bytes in, %ld bytes out.\n";
+const char server_uring[] = "[SERVER] Worker %d: %ld io_uring_enter calls over %ld loop turns.\n";
+const char server_uring_fallback[] = "[SERVER] io_uring unsupported, falling back to epoll.\n";
+const char server_timers[] = "[SERVER] Timers: %ld fired, %ld cascaded, %ld keepalives sent, %ld idle closes, %ld missed deadlines.\n";
+const char server_admission[] = "[SERVER] Admission: %ld connections refused, accepting paused %ld times.\n";
+const char server_topics[] = "[SERVER] Topics: %ld published, %ld delivered, %ld relayed between workers.\n";
+const char server_backpressure[] = "[SERVER] Reading paused %ld times for backed up clients.\n";
+const char server_pool[] = "[SERVER] %s pool: %ld hits, %ld misses, %d high water.\n";
+const char server_handler[] = "[SERVER] %s handler: %ld calls, %ld failed, %ld ns average, %ld ns max.\n";
+const char server_metrics[] = "[SERVER] Metrics:\n%s";
 
-struct server *host;
+/*
+ * Deliveries published on other workers, waiting to be handed to this
+ * worker's subscribers. The only state workers write to each other.
+ */
+struct inbox {
+	pthread_mutex_t lock;
+	struct shared *head; // oldest first
+	struct shared *tail;
+	int fd; // eventfd raised when the inbox stops being empty
+	long received; // deliveries taken out of the inbox
+};
 
-void sigint_handler(int code);
+/*
+ * Every worker owns a listening socket on the shared port, an event loop (or
+ * an io_uring) and a client table, so nothing on the packet path is shared
+ * between threads.
+ */
+struct worker {
+	int id;
+	pthread_t thread;
+	struct server *host;
+	struct event_loop *loop;
+	struct uring *ring; // set instead of loop for the uring backend
+	struct timer_wheel *wheel; // idle, keepalive and acknowledge timers of every client
+	long keepalives; // pings sent to silent clients
+	long idle_closes; // clients closed for silence
+	long missed_deadlines; // clients closed for not acknowledging a ping
+	int wake_fd[2]; // written to once the worker has to stop
+	struct inbox inbox;
+	struct client **pending; // clients given deliveries, written out at the end of the turn
+	int pending_count;
+	int pending_cap;
+	int sink; // sink type the worker displays packets through
+	struct handler_stats handlers[DISPATCH_LEN]; // status handler counters, once stopped
+	struct metrics *metrics; // counted while running, read by any worker asking for them
+	struct timer dump_timer; // prints every worker's metrics, only armed on the first
+};
 
-void sigint_handler(int code) {
-	DEBUG_PRINT("received SIGINT, setting flag");
-	sigint_received = 1;
-}
+/*
+ * Counters summed over removed and remaining clients of a worker.
+ */
+struct worker_stats {
+	long connections;
+	long packets_in;
+	long bytes_in;
+	long bytes_out;
+	long backpressure;
+	long refused;
+	long admission_pauses;
+};
 
-int main(void) {
-	// Reset SIGINT received flag.
-	sigint_received = 0;
+int init_worker(struct worker *worker, const int id, const int backend, const int max_connections);
 
-	// mark debug statements as serverside
-	header_type = 0;
+void destroy_worker(struct worker *worker);
 
-	// setup SIGINT handler
-	struct sigaction act1;
-	act1.sa_handler = sigint_handler;
-	sigemptyset(&act1.sa_mask);
-	act1.sa_flags = SA_RESTART; // ensures interrupted calls dont error out
-	if (sigaction(SIGINT, &act1, NULL) < 0) {
-		DEBUG_PRINT("sigaction: error");
-		exit(1);
-	}
-	DEBUG_PRINT("sigint_handler attached");
+void *run_worker(void *arg);
+
+void run_events(struct worker *worker);
+
+void run_uring(struct worker *worker);
+
+void uring_accepted(struct uring *ring, struct client *client);
+
+void uring_closed(struct uring *ring, struct client *client);
+
+int soonest(const int a, const int b);
+
+long idle_interval(void);
+
+void start_timers(struct worker *worker, struct client *client);
+
+void idle_expired(struct timer_wheel *wheel, struct timer *timer);
+
+void ack_expired(struct timer_wheel *wheel, struct timer *timer);
+
+void kick_client(struct worker *worker, struct client *client);
+
+void deliver_later(struct topic_table *table, struct client *client);
+
+void flush_pending(struct worker *worker);
+
+void forget_pending(struct worker *worker, struct client *client);
 
-	if (init_server_struct(&host, PORT, MAX_CONNECTIONS, CONNECTION_QUEUE) < 0) {
+void relay_publish(struct topic_table *table, struct shared *payload);
+
+void drain_inbox(struct worker *worker);
+
+void uring_notified(struct uring *ring);
+
+void accept_clients(struct worker *worker);
+
+void pause_admission(struct worker *worker);
+
+void resume_admission(struct worker *worker);
+
+void serve_client(struct worker *worker, struct client *client, const int events);
+
+void watch_client(struct worker *worker, struct client *client);
+
+void collect_stats(struct worker *worker, struct worker_stats *out);
+
+void dump_metrics(struct timer_wheel *wheel, struct timer *timer);
+
+void print_metrics_text(void);
+
+int high_water = OUT_HIGH_WATER;
+int low_water = OUT_LOW_WATER;
+int contiguous = 0;
+long idle_ms = IDLE_TIMEOUT_MS;
+long keepalive_ms = KEEPALIVE_MS;
+long ack_ms = ACK_DEADLINE_MS;
+long metrics_ms = 0; // interval of the metrics dump, 0 for none
+int connection_limit = 0;
+struct worker *workers = NULL;
+int worker_count = 0;
+
+int init_worker(struct worker *worker, const int id, const int backend, const int max_connections) {
+	memset(worker, 0, sizeof(struct worker));
+	worker->id = id;
+	worker->wake_fd[0] = -1;
+	worker->wake_fd[1] = -1;
+	worker->inbox.fd = -1;
+
+	if (init_server_struct(&(worker->host), PORT, max_connections, CONNECTION_QUEUE) < 0) {
 		DEBUG_PRINT("failed server struct init");
-		exit(1);
+		return -ENOMEM;
 	}
-	DEBUG_PRINT("server struct on %d slots", MAX_CONNECTIONS);
+	worker->host->high_water = high_water;
+	worker->host->low_water = low_water;
+	worker->host->contiguous = contiguous;
+	worker->host->connection_limit = (connection_limit > max_connections) ? connection_limit : max_connections;
+	DEBUG_PRINT("worker %d server struct on %d slots", id, max_connections);
 
-	// setup server socket
-	host->server_fd = setup_server_socket(&(host->address), host->server_port, host->connect_queue);
-	if (host->server_fd < 0) {
+	// every worker listens on the same port, the kernel picks one per connection
+	worker->host->server_fd = setup_shared_server_socket(&(worker->host->address), worker->host->server_port, worker->host->connect_queue);
+	if (worker->host->server_fd < 0) {
 		DEBUG_PRINT("failed server socket init");
-		exit(host->server_fd);
+		return worker->host->server_fd;
 	}
-	DEBUG_PRINT("server listening on all interfaces");
 
-	// setup fd set for selecting
-	int max_fd = host->server_fd;
-	fd_set all_fds, listen_fds;
-	FD_ZERO(&all_fds);
-	FD_SET(host->server_fd, &all_fds);
+	// accepting is done until the queue is drained, so it must never block
+	if (set_nonblocking(worker->host->server_fd) < 0) {
+		DEBUG_PRINT("failed nonblocking server socket");
+		return -1;
+	}
 
-	int run = 1;
-	while (run) {
-		printf("\n");
+	// every client's timers share one wheel, its callbacks find the worker through it
+	if (init_timer_wheel(&(worker->wheel), TIMER_TICK_MS, NULL) < 0) {
+		DEBUG_PRINT("failed timer wheel init");
+		return -ENOMEM;
+	}
+	worker->wheel->owner = worker;
 
-		// closing connections and freeing memory before the process ends
-		if (sigint_received) {
-			DEBUG_PRINT("caught SIGINT, exiting");
-			exit(1);
+	// clients count into the worker's metrics, which every worker can report
+	if (init_metrics_struct(&(worker->metrics)) < 0 || metrics_register(worker->metrics) < 0) {
+		DEBUG_PRINT("failed metrics init");
+		return -ENOMEM;
+	}
+	worker->host->metrics = worker->metrics;
+
+	// one worker is enough to print what all of them counted
+	if (id == 0 && metrics_ms > 0) {
+		timer_setup(&(worker->dump_timer), dump_metrics, NULL);
+		timer_arm(worker->wheel, &(worker->dump_timer), metrics_ms);
+	}
+
+	// the wake pipe is owned by the worker itself
+	if (pipe(worker->wake_fd) < 0) {
+		DEBUG_PRINT("failed wake pipe");
+		return -errno;
+	}
+
+	// subscribers are written out once per turn, publishes reach every other worker
+	worker->host->topics->owner = worker;
+	worker->host->topics->on_deliver = deliver_later;
+	if (worker_count > 1) {
+		worker->host->topics->on_publish = relay_publish;
+	}
+	pthread_mutex_init(&(worker->inbox.lock), NULL);
+	worker->inbox.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (worker->inbox.fd < 0) {
+		DEBUG_PRINT("failed inbox eventfd");
+		return -errno;
+	}
+
+	// io_uring accepts, reads and writes on its own, no event loop needed
+	if (backend == EVENT_BACKEND_URING) {
+		if (init_uring_struct(&(worker->ring), worker->host, BUFSIZE) < 0) {
+			DEBUG_PRINT("failed io_uring init");
+			return -1;
+		}
+		worker->ring->on_accept = uring_accepted;
+		worker->ring->on_close = uring_closed;
+		worker->ring->owner = worker;
+		if (uring_watch_wake(worker->ring, worker->wake_fd[0]) < 0) {
+			DEBUG_PRINT("failed watching wake pipe");
+			return -1;
+		}
+		worker->ring->on_notify = uring_notified;
+		if (uring_watch_notify(worker->ring, worker->inbox.fd) < 0) {
+			DEBUG_PRINT("failed watching inbox");
+			return -1;
 		}
+		return 0;
+	}
+
+	// setup event loop, the server socket is the only descriptor without an owner
+	if (init_event_loop(&(worker->loop), backend, MAX_EVENTS) < 0) {
+		DEBUG_PRINT("failed event loop init");
+		return -1;
+	}
+	if (event_loop_add(worker->loop, worker->host->server_fd, EVENT_READ, NULL) < 0) {
+		DEBUG_PRINT("failed watching server socket");
+		return -1;
+	}
+
+	if (event_loop_add(worker->loop, worker->wake_fd[0], EVENT_READ, worker) < 0) {
+		DEBUG_PRINT("failed watching wake pipe");
+		return -1;
+	}
+
+	if (event_loop_add(worker->loop, worker->inbox.fd, EVENT_READ, &(worker->inbox)) < 0) {
+		DEBUG_PRINT("failed watching inbox");
+		return -1;
+	}
+
+	return 0;
+}
+
+void destroy_worker(struct worker *worker) {
+	if (worker->wake_fd[0] > MIN_FD) {
+		close(worker->wake_fd[0]);
+		close(worker->wake_fd[1]);
+	}
+	if (worker->inbox.fd > MIN_FD) {
+		close(worker->inbox.fd);
+		pthread_mutex_destroy(&(worker->inbox.lock));
+	}
+
+	// deliveries nobody took
+	while (worker->inbox.head != NULL) {
+		struct shared *next = worker->inbox.head->next;
+		destroy_shared_struct(&(worker->inbox.head));
+		worker->inbox.head = next;
+	}
+	free(worker->pending);
+
+	destroy_event_loop(&(worker->loop));
+	destroy_uring_struct(&(worker->ring));
+	destroy_server_struct(&(worker->host));
+	destroy_timer_wheel(&(worker->wheel));
+	destroy_metrics_struct(&(worker->metrics));
+}
+
+void *run_worker(void *arg) {
+	struct worker *worker = (struct worker *) arg;
+
+	// display every packet through this thread's own sink
+	if (init_sink_struct(&message_sink, worker->sink, STDOUT_FILENO) < 0) {
+		DEBUG_PRINT("failed sink init");
+		return NULL;
+	}
 
-		// selecting
-		listen_fds = all_fds;
-		int nready = select(max_fd + 1, &listen_fds, NULL, NULL, NULL);
+	// the uring backend replaces the event loop entirely
+	if (worker->ring != NULL) {
+		run_uring(worker);
+	} else {
+		run_events(worker);
+	}
+
+	// displayed packets come before the report
+	destroy_sink_struct(&message_sink);
+
+	// counters are per thread, keep them for the report
+	for (int code = 0; code < DISPATCH_LEN; code++) {
+		dispatch_stats(DISPATCH_STATUS, code, worker->handlers + code);
+	}
+
+	DEBUG_PRINT("worker %d stopped", worker->id);
+	return NULL;
+}
+
+void run_events(struct worker *worker) {
+	struct event ready[MAX_EVENTS];
+	int run = 1;
+	while (run) {
+		sink_printf(message_sink, "\n");
+
+		// waiting, but waking in time to write out batched messages and run timers
+		int timeout = soonest(sink_tick(message_sink), timer_next_ms(worker->wheel));
+		int nready = event_loop_wait(worker->loop, ready, MAX_EVENTS, timeout);
 		if (nready < 0) {
-			if (errno == EINTR) {
+			if (nready == -EINTR) {
 				continue;
 			} else {
-				DEBUG_PRINT("failed select");
-				exit(1);
+				DEBUG_PRINT("failed wait");
+				break;
 			}
 		}
 
-		// check all clients if they can read
-		for (int index = 0; index < host->max_connections; index++) {
-			struct client *client = host->clients[index];
+		// only the ready descriptors are visited
+		for (int i = 0; i < nready; i++) {
+			if (ready[i].owner == NULL) {
+				accept_clients(worker);
+			} else if (ready[i].owner == worker) {
+				run = 0;
+			} else if (ready[i].owner == &(worker->inbox)) {
+				drain_inbox(worker);
+			} else {
+				serve_client(worker, (struct client *) ready[i].owner, ready[i].events);
+			}
+		}
+
+		// subscribers write out everything delivered this turn at once
+		flush_pending(worker);
+
+		timer_advance(worker->wheel);
+
+		// enough clients left a full server
+		if (admission_can_resume(worker->host)) {
+			resume_admission(worker);
+		}
+	}
+}
+
+void run_uring(struct worker *worker) {
+	while (1) {
+		sink_printf(message_sink, "\n");
+
+		// a single io_uring_enter submits and waits, in time for batched messages and timers
+		int timeout = soonest(sink_tick(message_sink), timer_next_ms(worker->wheel));
+		int ret = uring_run(worker->ring, timeout);
+		if (ret == 0) {
+			break;
+		} else if (ret < 0) {
+			DEBUG_PRINT("failed io_uring turn");
+			break;
+		}
+
+		timer_advance(worker->wheel);
+	}
+}
+
+void uring_accepted(struct uring *ring, struct client *client) {
+	printf(connection_accept, client->socket_fd);
+	start_timers((struct worker *) ring->owner, client);
+}
+
+void uring_closed(struct uring *ring, struct client *client) {
+	// same signature as on_accept, the worker is not needed here
+	(void) ring;
+	printf(client_closed, client->socket_fd);
+}
+
+int soonest(const int a, const int b) {
+	// negative timeouts wait forever
+	if (a < 0) return b;
+	if (b < 0) return a;
+	return (a < b) ? a : b;
+}
+
+long idle_interval(void) {
+	// silence is checked often enough for both the keepalive and the timeout
+	if (keepalive_ms > 0 && (idle_ms == 0 || keepalive_ms < idle_ms)) {
+		return keepalive_ms;
+	}
+	return idle_ms;
+}
 
-			// relies on short circuting
-			if (client != NULL && FD_ISSET(client->socket_fd, &listen_fds)) {
-				if (process_request(client, &all_fds) < 0) {
-					//exit(1); // TODO: remove once failing a packet isn't really bad
+void start_timers(struct worker *worker, struct client *client) {
+	timer_setup(&(client->idle_timer), idle_expired, client);
+	timer_setup(&(client->ack_timer), ack_expired, client);
+
+	long interval = idle_interval();
+	if (interval > 0 && timer_arm(worker->wheel, &(client->idle_timer), interval) < 0) {
+		DEBUG_PRINT("failed idle timer for client %d", client->socket_fd);
+	}
+}
+
+void idle_expired(struct timer_wheel *wheel, struct timer *timer) {
+	struct worker *worker = (struct worker *) wheel->owner;
+	struct client *client = (struct client *) timer->arg;
+	long interval = idle_interval();
+
+	// anything read since the last check means the client is alive
+	if (client->bytes_in != client->idle_mark) {
+		client->idle_mark = client->bytes_in;
+		client->quiet_ms = 0;
+	} else {
+		client->quiet_ms += interval;
+	}
+
+	if (idle_ms > 0 && client->quiet_ms >= idle_ms) {
+		printf(client_idle, client->socket_fd, client->quiet_ms);
+		worker->idle_closes++;
+		client->inc_flag = CANCEL;
+		client->out_flag = CANCEL;
+		kick_client(worker, client);
+		return;
+	}
+
+	// rearm before kicking, kicking can remove the client
+	timer_arm(wheel, timer, interval);
+
+	// ask a silent client to prove it is still there
+	if (keepalive_ms > 0 && client->quiet_ms > 0 && client->awaiting < 0) {
+		if (write_dataless(client, 0, ENQUIRY, ENQUIRY_NORMAL, 0) < 0) {
+			DEBUG_PRINT("failed keepalive for client %d", client->socket_fd);
+			return;
+		}
+		worker->keepalives++;
+		client->awaiting = ENQUIRY;
+		client->awaiting_seq = client->out_seq;
+		if (ack_ms > 0) {
+			timer_arm(wheel, &(client->ack_timer), ack_ms);
+		}
+		kick_client(worker, client);
+	}
+}
+
+void ack_expired(struct timer_wheel *wheel, struct timer *timer) {
+	struct worker *worker = (struct worker *) wheel->owner;
+	struct client *client = (struct client *) timer->arg;
+
+	printf(client_deadline, client->socket_fd);
+	worker->missed_deadlines++;
+	client->inc_flag = CANCEL;
+	client->out_flag = CANCEL;
+	kick_client(worker, client);
+}
+
+void kick_client(struct worker *worker, struct client *client) {
+	// write out what was queued, or close the client if it was cancelled
+	if (worker->ring != NULL) {
+		uring_touch(worker->ring, client);
+	} else {
+		serve_client(worker, client, EVENT_WRITE);
+	}
+}
+
+void deliver_later(struct topic_table *table, struct client *client) {
+	struct worker *worker = (struct worker *) table->owner;
+
+	// the uring engine already settles touched clients once per turn
+	if (worker->ring != NULL) {
+		uring_touch(worker->ring, client);
+		return;
+	}
+
+	if (client->pending) {
+		return;
+	}
+
+	if (worker->pending_count == worker->pending_cap) {
+		int cap = (worker->pending_cap > 0) ? worker->pending_cap * 2 : MAX_EVENTS;
+		struct client **pending = (struct client **) realloc(worker->pending, sizeof(struct client *) * cap);
+		if (pending == NULL) {
+			// write it out right away rather than lose it
+			DEBUG_PRINT("realloc, pending");
+			flush_queue(client);
+			return;
+		}
+		worker->pending = pending;
+		worker->pending_cap = cap;
+	}
+
+	worker->pending[worker->pending_count++] = client;
+	client->pending = 1;
+}
+
+void flush_pending(struct worker *worker) {
+	// serving a client can deliver to more of them, the list may grow meanwhile
+	for (int i = 0; i < worker->pending_count; i++) {
+		struct client *client = worker->pending[i];
+		if (client == NULL) {
+			continue;
+		}
+
+		client->pending = 0;
+		worker->pending[i] = NULL;
+		serve_client(worker, client, EVENT_WRITE);
+	}
+	worker->pending_count = 0;
+}
+
+void forget_pending(struct worker *worker, struct client *client) {
+	if (!client->pending) {
+		return;
+	}
+
+	for (int i = 0; i < worker->pending_count; i++) {
+		if (worker->pending[i] == client) {
+			worker->pending[i] = NULL;
+		}
+	}
+	client->pending = 0;
+}
+
+void relay_publish(struct topic_table *table, struct shared *payload) {
+	struct worker *worker = (struct worker *) table->owner;
+
+	// references are counted by one thread only, every worker gets its own copy
+	for (int i = 0; i < worker_count; i++) {
+		struct worker *peer = workers + i;
+		if (peer == worker) {
+			continue;
+		}
+
+		struct shared *copy;
+		if (init_shared_struct(&copy, payload->len) < 0) {
+			DEBUG_PRINT("failed relay copy for worker %d", i);
+			continue;
+		}
+		memcpy(copy->bytes, payload->bytes, payload->len);
+
+		pthread_mutex_lock(&(peer->inbox.lock));
+		int was_empty = (peer->inbox.head == NULL);
+		if (was_empty) {
+			peer->inbox.head = copy;
+		} else {
+			peer->inbox.tail->next = copy;
+		}
+		peer->inbox.tail = copy;
+		pthread_mutex_unlock(&(peer->inbox.lock));
+
+		// a busy inbox was raised already and is drained before sleeping again
+		uint64_t one = 1;
+		if (was_empty && write(peer->inbox.fd, &one, sizeof(one)) < 0) {
+			DEBUG_PRINT("failed raising inbox of worker %d", i);
+		}
+	}
+}
+
+void drain_inbox(struct worker *worker) {
+	// lower the eventfd before taking the list, a later append raises it again
+	uint64_t raised;
+	if (read(worker->inbox.fd, &raised, sizeof(raised)) < 0) {
+		DEBUG_PRINT("inbox not raised");
+	}
+
+	pthread_mutex_lock(&(worker->inbox.lock));
+	struct shared *cur = worker->inbox.head;
+	worker->inbox.head = NULL;
+	worker->inbox.tail = NULL;
+	pthread_mutex_unlock(&(worker->inbox.lock));
+
+	while (cur != NULL) {
+		struct shared *next = cur->next;
+		topic_publish(worker->host->topics, cur);
+		destroy_shared_struct(&cur);
+		worker->inbox.received++;
+		cur = next;
+	}
+}
+
+void uring_notified(struct uring *ring) {
+	drain_inbox((struct worker *) ring->owner);
+}
+
+void accept_clients(struct worker *worker) {
+	// listening socket is edge-triggered, accept until the queue is empty
+	while (1) {
+		// stop accepting before anything is allocated for a client without room
+		if (!server_has_room(worker->host)) {
+			pause_admission(worker);
+			break;
+		}
+
+		struct client *client;
+		int client_fd = accept_new_client(worker->host, BUFSIZE, &client);
+		if (client_fd == -EAGAIN || client_fd == -EWOULDBLOCK) {
+			break;
+		} else if (client_fd == -ENOSPC) {
+			continue; // refused for lack of space, keep draining
+		} else if (client_fd < 0) {
+			DEBUG_PRINT("failed accept");
+			break;
+		}
+
+		// watch new client for incoming packets
+		client->watched = EVENT_READ;
+		if (event_loop_add(worker->loop, client_fd, client->watched, client) < 0) {
+			DEBUG_PRINT("failed watching client %d", client_fd);
+			remove_client_index(find_client_index(worker->host, client), worker->host);
+			continue;
+		}
+
+		printf(connection_accept, client_fd);
+		start_timers(worker, client);
+	}
+}
+
+void pause_admission(struct worker *worker) {
+	struct server *host = worker->host;
+	host->admitting = 0;
+	host->admission_pauses++;
+
+	// peers already queued hear no rather than waiting on a full server
+	for (int i = 0; i < ADMIT_REFUSE_BURST && refuse_connection(host->server_fd) == 0; i++) {
+		host->refused++;
+		if (host->metrics != NULL) {
+			metrics_add(&(host->metrics->refused), 1);
+		}
+	}
+
+	// later ones wait in the listen queue until room frees up
+	if (event_loop_modify(worker->loop, host->server_fd, 0, NULL) < 0) {
+		DEBUG_PRINT("failed pausing server socket");
+	}
+	DEBUG_PRINT("worker %d full, accepting paused", worker->id);
+}
+
+void resume_admission(struct worker *worker) {
+	worker->host->admitting = 1;
+
+	// watching again reports what queued up during the pause
+	if (event_loop_modify(worker->loop, worker->host->server_fd, EVENT_READ, NULL) < 0) {
+		DEBUG_PRINT("failed resuming server socket");
+	}
+	DEBUG_PRINT("worker %d accepting resumed", worker->id);
+}
+
+void serve_client(struct worker *worker, struct client *client, const int events) {
+	int was_throttled = client->throttled;
+
+	// write out queued packets once the socket has room
+	if ((events & EVENT_WRITE) && flush_queue(client) < 0) {
+		DEBUG_PRINT("failed flush");
+	}
+
+	// read when ready, or when draining the queue just lifted a pause
+	if (!client->throttled && ((events & (EVENT_READ | EVENT_ERROR)) || was_throttled)) {
+		// reads and parses until the socket is drained, as required by edge-triggering
+		if (process_request(client) < 0) {
+			//exit(1); // TODO: remove once failing a packet isn't really bad
+		}
+	}
+
+	// if a client requested a cancel
+	if (is_client_status(client, CANCEL)) {
+		forget_pending(worker, client);
+		event_loop_remove(worker->loop, client->socket_fd);
+		printf(client_closed, client->socket_fd);
+		remove_client_index(find_client_index(worker->host, client), worker->host);
+		return;
+	}
+
+	watch_client(worker, client);
+}
+
+void watch_client(struct worker *worker, struct client *client) {
+	// stop reading from a throttled client, wait for room while packets are queued
+	int events = 0;
+	if (!client->throttled) events |= EVENT_READ;
+	if (client->out_head != NULL) events |= EVENT_WRITE;
+
+	if (events == client->watched) {
+		return;
+	}
+
+	if (event_loop_modify(worker->loop, client->socket_fd, events, client) < 0) {
+		DEBUG_PRINT("failed watching client %d", client->socket_fd);
+		return;
+	}
+	client->watched = events;
+}
+
+void collect_stats(struct worker *worker, struct worker_stats *out) {
+	struct server *host = worker->host;
+	out->connections = host->accepted;
+	out->packets_in = host->packets_in;
+	out->bytes_in = host->bytes_in;
+	out->bytes_out = host->bytes_out;
+	out->backpressure = host->backpressure_count;
+	out->refused = host->refused;
+	out->admission_pauses = host->admission_pauses;
+
+	for (int index = 0; index < host->cur_connections; index++) {
+		struct client *cli = host->live[index];
+		out->packets_in += cli->packets_in;
+		out->bytes_in += cli->bytes_in;
+		out->bytes_out += cli->bytes_out;
+		out->backpressure += cli->backpressure_count;
+	}
+}
+
+void dump_metrics(struct timer_wheel *wheel, struct timer *timer) {
+	timer_arm(wheel, timer, metrics_ms);
+	print_metrics_text();
+	fflush(stdout);
+}
+
+void print_metrics_text(void) {
+	struct metrics *snapshot;
+	if (init_metrics_struct(&snapshot) < 0) {
+		DEBUG_PRINT("failed metrics snapshot");
+		return;
+	}
+
+	// workers may be counting meanwhile, the sum is taken without stopping them
+	char text[METRICS_TEXT_MAX];
+	metrics_collect(snapshot);
+	metrics_format(snapshot, text, sizeof(text));
+	printf(server_metrics, text);
+	destroy_metrics_struct(&snapshot);
+}
+
+int main(int argc, char **argv) {
+	// mark debug statements as serverside
+	header_type = 0;
+
+	// parse command line options
+	int opt;
+	int backend = EVENT_BACKEND_EPOLL;
+	int max_connections = MAX_CONNECTIONS;
+	int sink = SINK_CONSOLE;
+	worker_count = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((opt = getopt(argc, argv, "a:b:c:H:k:L:gm:M:o:t:w:")) != -1) {
+		switch (opt) {
+			case 'a':
+				ack_ms = strtol(optarg, NULL, 10);
+				if (ack_ms < 0) {
+					fprintf(stderr, server_usage, argv[0]);
+					exit(1);
 				}
+				break;
 
-				// if a client requested a cancel
-				if (is_client_status(client, CANCEL)) {
-					FD_CLR(client->socket_fd, &all_fds);
-					printf(client_closed, client->socket_fd);
-					remove_client_index(index, host);
+			case 'b':
+				backend = event_backend_from_str(optarg);
+				if (backend < 0) {
+					fprintf(stderr, server_usage, argv[0]);
+					exit(1);
 				}
-			}
+				break;
+
+			case 'c':
+				max_connections = strtol(optarg, NULL, 10);
+				if (max_connections < 1) {
+					fprintf(stderr, server_usage, argv[0]);
+					exit(1);
+				}
+				break;
+
+			case 'H':
+				high_water = strtol(optarg, NULL, 10);
+				break;
+
+			case 'k':
+				keepalive_ms = strtol(optarg, NULL, 10);
+				if (keepalive_ms < 0) {
+					fprintf(stderr, server_usage, argv[0]);
+					exit(1);
+				}
+				break;
+
+			case 'L':
+				low_water = strtol(optarg, NULL, 10);
+				break;
+
+			case 'g':
+				contiguous = 1;
+				break;
+
+			case 'm':
+				connection_limit = strtol(optarg, NULL, 10);
+				if (connection_limit < 1) {
+					fprintf(stderr, server_usage, argv[0]);
+					exit(1);
+				}
+				break;
+
+			case 'M':
+				metrics_ms = strtol(optarg, NULL, 10);
+				if (metrics_ms < 0) {
+					fprintf(stderr, server_usage, argv[0]);
+					exit(1);
+				}
+				break;
+
+			case 'o':
+				sink = sink_from_str(optarg);
+				if (sink < 0) {
+					fprintf(stderr, server_usage, argv[0]);
+					exit(1);
+				}
+				break;
+
+			case 't':
+				idle_ms = strtol(optarg, NULL, 10);
+				if (idle_ms < 0) {
+					fprintf(stderr, server_usage, argv[0]);
+					exit(1);
+				}
+				break;
+
+			case 'w':
+				worker_count = strtol(optarg, NULL, 10);
+				if (worker_count < 1 || worker_count > MAX_WORKERS) {
+					fprintf(stderr, server_usage, argv[0]);
+					exit(1);
+				}
+				break;
+
+			default:
+				fprintf(stderr, server_usage, argv[0]);
+				exit(1);
 		}
+	}
 
-		// accept new client
-		if (FD_ISSET(host->server_fd, &listen_fds)) {
-			int client_fd = accept_new_client(host, BUFSIZE);
-			if (client_fd < 0) {
-				DEBUG_PRINT("failed accept");
-				continue;
+	// reading must be able to resume before the queue empties completely, and tables can only grow
+	if (low_water < 0 || high_water <= low_water || (connection_limit > 0 && connection_limit < max_connections)) {
+		fprintf(stderr, server_usage, argv[0]);
+		exit(1);
+	}
+
+	// online processor count can be unknown
+	if (worker_count < 1) {
+		worker_count = 1;
+	} else if (worker_count > MAX_WORKERS) {
+		worker_count = MAX_WORKERS;
+	}
+
+	// workers inherit a blocked SIGINT, only this thread waits for it
+	sigset_t sigint;
+	sigemptyset(&sigint);
+	sigaddset(&sigint, SIGINT);
+	if (pthread_sigmask(SIG_BLOCK, &sigint, NULL) != 0) {
+		DEBUG_PRINT("pthread_sigmask: error");
+		exit(1);
+	}
+	DEBUG_PRINT("SIGINT blocked for workers");
+
+	// older kernels lack what the io_uring engine relies on
+	if (backend == EVENT_BACKEND_URING && !uring_supported()) {
+		printf(server_uring_fallback);
+		backend = EVENT_BACKEND_EPOLL;
+	}
+
+	// settle everything workers share before any of them start
+	if (sink != SINK_NONE) {
+		register_default_printers();
+	}
+	DEBUG_PRINT("scanning with %s", scan_kernel_name());
+
+	workers = (struct worker *) calloc(worker_count, sizeof(struct worker));
+	if (workers == NULL) {
+		DEBUG_PRINT("calloc, workers");
+		exit(1);
+	}
+
+	for (int i = 0; i < worker_count; i++) {
+		int ret = init_worker(workers + i, i, backend, max_connections);
+		if (ret < 0) {
+			DEBUG_PRINT("failed worker %d init", i);
+			exit(1);
+		}
+		workers[i].sink = sink;
+	}
+
+	// workers relay to each other, so every one is set up before any starts
+	for (int i = 0; i < worker_count; i++) {
+		if (pthread_create(&(workers[i].thread), NULL, run_worker, workers + i) != 0) {
+			DEBUG_PRINT("failed worker %d start", i);
+			exit(1);
+		}
+	}
+	printf(server_workers, worker_count);
+	fflush(stdout);
+
+	// wait for the signal to shut down
+	int sig;
+	while (sigwait(&sigint, &sig) != 0 || sig != SIGINT) {
+		// any other signal sent here is ignored
+	}
+	DEBUG_PRINT("caught SIGINT, exiting");
+
+	// stop every worker before reading what they counted
+	for (int i = 0; i < worker_count; i++) {
+		char wake = 0;
+		if (write(workers[i].wake_fd[1], &wake, sizeof(wake)) < 0) {
+			DEBUG_PRINT("failed waking worker %d", i);
+		}
+	}
+	for (int i = 0; i < worker_count; i++) {
+		pthread_join(workers[i].thread, NULL);
+	}
+	printf(server_shutdown);
+
+	// report traffic of every worker, then over all of them
+	struct worker_stats total;
+	memset(&total, 0, sizeof(total));
+	long timers_fired = 0;
+	long timers_cascaded = 0;
+	long keepalives = 0;
+	long idle_closes = 0;
+	long missed_deadlines = 0;
+	struct pool_stats packets;
+	memset(&packets, 0, sizeof(packets));
+	struct pool_stats buffers;
+	memset(&buffers, 0, sizeof(buffers));
+	long published = 0;
+	long delivered = 0;
+	long relayed = 0;
+	for (int i = 0; i < worker_count; i++) {
+		struct worker_stats stats;
+		collect_stats(workers + i, &stats);
+		printf(server_worker, i, stats.connections, stats.packets_in, stats.bytes_in, stats.bytes_out);
+		if (workers[i].ring != NULL) {
+			printf(server_uring, i, workers[i].ring->enters, workers[i].ring->turns);
+		}
+
+		total.connections += stats.connections;
+		total.packets_in += stats.packets_in;
+		total.bytes_in += stats.bytes_in;
+		total.bytes_out += stats.bytes_out;
+		total.backpressure += stats.backpressure;
+		total.refused += stats.refused;
+		total.admission_pauses += stats.admission_pauses;
+
+		timers_fired += workers[i].wheel->fired;
+		timers_cascaded += workers[i].wheel->cascaded;
+		keepalives += workers[i].keepalives;
+		idle_closes += workers[i].idle_closes;
+		missed_deadlines += workers[i].missed_deadlines;
+		published += workers[i].host->topics->published - workers[i].inbox.received;
+		delivered += workers[i].host->topics->delivered;
+		relayed += workers[i].inbox.received;
+
+		// pooling is per worker too, high water marks add up
+		struct pool_stats worker_buffers;
+		pool_buffer_stats(workers[i].host->pool, &worker_buffers);
+		buffers.hits += worker_buffers.hits;
+		buffers.misses += worker_buffers.misses;
+		buffers.high_water += worker_buffers.high_water;
+		packets.hits += workers[i].host->pool->packet_stats.hits;
+		packets.misses += workers[i].host->pool->packet_stats.misses;
+		packets.high_water += workers[i].host->pool->packet_stats.high_water;
+	}
+	printf(server_total, total.connections, total.packets_in, total.bytes_in, total.bytes_out);
+	printf(server_admission, total.refused, total.admission_pauses);
+	printf(server_topics, published, delivered, relayed);
+	printf(server_backpressure, total.backpressure);
+	printf(server_timers, timers_fired, timers_cascaded, keepalives, idle_closes, missed_deadlines);
+
+	// report how well pooling kept allocation off the packet path
+	printf(server_pool, "Packet", packets.hits, packets.misses, packets.high_water);
+	printf(server_pool, "Buffer", buffers.hits, buffers.misses, buffers.high_water);
+
+	// report the cost of every status handler that ran
+	for (int code = 0; code < DISPATCH_LEN; code++) {
+		struct handler_stats stats;
+		memset(&stats, 0, sizeof(stats));
+		for (int i = 0; i < worker_count; i++) {
+			struct handler_stats *cur = workers[i].handlers + code;
+			stats.calls += cur->calls;
+			stats.failures += cur->failures;
+			stats.total_ns += cur->total_ns;
+			if (cur->max_ns > stats.max_ns) {
+				stats.max_ns = cur->max_ns;
 			}
+		}
 
-			if (client_fd > max_fd) max_fd = client_fd;
-			FD_SET(client_fd, &all_fds);
-			printf(connection_accept, client_fd);
+		if (stats.calls > 0) {
+			printf(server_handler, stat_to_str(code), stats.calls, stats.failures, stats.total_ns / stats.calls, stats.max_ns);
 		}
 	}
 
+	// traffic by status and the latency histograms over every worker
+	print_metrics_text();
+
+	// closing connections and freeing memory before the process ends
+	for (int i = 0; i < worker_count; i++) {
+		destroy_worker(workers + i);
+	}
+	free(workers);
 	return 0;
 }
@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "chopdebug.h"
+#include "chopsink.h"
+
+__thread struct sink *message_sink = NULL;
+
+static const int sink_str_len = 3;
+static const char *sink_str[] = {
+		"none",
+		"batch",
+		"console"};
+
+/*
+ * Sink Helpers
+ */
+
+static long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int write_all(const int fd, const char *buf, const int len) {
+	int written = 0;
+	while (written < len) {
+		ssize_t ret = write(fd, buf + written, len - written);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			DEBUG_PRINT("write");
+			return -errno;
+		}
+		written += ret;
+	}
+	return written;
+}
+
+/*
+ * Sink Management Functions
+ */
+
+int init_sink_struct(struct sink **target, const int type, const int fd) {
+	// check valid arguments
+	if (target == NULL || type < 0 || type >= sink_str_len || fd < 0) {
+		return -EINVAL;
+	}
+
+	// allocate structure
+	struct sink *init = (struct sink *) malloc(sizeof(struct sink));
+	if (init == NULL) {
+		DEBUG_PRINT("malloc, structure");
+		return -ENOMEM;
+	}
+
+	// initialize structure fields
+	init->type = type;
+	init->fd = fd;
+	init->buf = NULL;
+	init->inbuf = 0;
+	init->bufsize = 0;
+	init->oldest_ns = 0;
+	init->flushes = 0;
+
+	// only batches need room to wait in
+	if (type == SINK_BATCH) {
+		init->buf = (char *) malloc(sizeof(char) * SINK_BATCH_LEN);
+		if (init->buf == NULL) {
+			DEBUG_PRINT("malloc, batch");
+			free(init);
+			return -ENOMEM;
+		}
+		init->bufsize = SINK_BATCH_LEN;
+	}
+
+	DEBUG_PRINT("%s sink on fd %d", sink_str[type], fd);
+
+	// set given pointer to new struct
+	*target = init;
+	return 0;
+}
+
+int destroy_sink_struct(struct sink **target) {
+	// check valid argument
+	if (target == NULL) {
+		return -EINVAL;
+	}
+
+	// struct already doesn't exist
+	if (*target == NULL) {
+		return 0;
+	}
+
+	// direct reference to structure
+	struct sink *old = *target;
+
+	// nothing batched may be lost
+	sink_flush(old);
+
+	// deallocate structure
+	free(old->buf);
+	free(old);
+
+	// dereference holder
+	*target = NULL;
+	return 0;
+}
+
+/*
+ * Output Functions
+ */
+
+int sink_printf(struct sink *sink, const char *format, ...) {
+	// check valid arguments
+	if (format == NULL) {
+		return -EINVAL;
+	}
+
+	if (sink != NULL && sink->type == SINK_NONE) {
+		return 0;
+	}
+
+	va_list args;
+	va_start(args, format);
+
+	// unset sinks print like the console
+	if (sink == NULL || sink->type == SINK_CONSOLE) {
+		int ret = vprintf(format, args);
+		va_end(args);
+		return ret;
+	}
+
+	// format behind what is already batched
+	va_list retry;
+	va_copy(retry, args);
+	int room = sink->bufsize - sink->inbuf;
+	int len = vsnprintf(sink->buf + sink->inbuf, room, format, args);
+	va_end(args);
+
+	if (len >= room) {
+		// did not fit, make room and try again
+		sink_flush(sink);
+		if (len >= sink->bufsize) {
+			// larger than any batch, write it on its own
+			len = vdprintf(sink->fd, format, retry);
+			va_end(retry);
+			return len;
+		}
+		len = vsnprintf(sink->buf, sink->bufsize, format, retry);
+	}
+	va_end(retry);
+
+	if (len > 0) {
+		if (sink->inbuf == 0) {
+			sink->oldest_ns = now_ns();
+		}
+		sink->inbuf += len;
+	}
+	return len;
+}
+
+int sink_write(struct sink *sink, const char *buf, const int len) {
+	// check valid arguments
+	if (buf == NULL || len < 0) {
+		return -EINVAL;
+	}
+
+	if (sink != NULL && sink->type == SINK_NONE) {
+		return 0;
+	}
+
+	// unset sinks print like the console
+	if (sink == NULL || sink->type == SINK_CONSOLE) {
+		return fwrite(buf, sizeof(char), len, stdout);
+	}
+
+	// make room behind what is already batched
+	if (len > sink->bufsize - sink->inbuf) {
+		sink_flush(sink);
+		if (len > sink->bufsize) {
+			// larger than any batch, write it on its own
+			return write_all(sink->fd, buf, len);
+		}
+	}
+
+	if (sink->inbuf == 0) {
+		sink->oldest_ns = now_ns();
+	}
+	memcpy(sink->buf + sink->inbuf, buf, len);
+	sink->inbuf += len;
+	return len;
+}
+
+int sink_flush(struct sink *sink) {
+	// check valid argument
+	if (sink == NULL) {
+		return -EINVAL;
+	}
+
+	if (sink->type == SINK_CONSOLE) {
+		return fflush(stdout);
+	}
+
+	// nothing waiting
+	if (sink->inbuf == 0) {
+		return 0;
+	}
+
+	// keep anything already printed through stdio ahead of the batch
+	fflush(stdout);
+
+	int ret = write_all(sink->fd, sink->buf, sink->inbuf);
+	sink->inbuf = 0;
+	sink->flushes++;
+	return ret;
+}
+
+int sink_tick(struct sink *sink) {
+	// nothing can be waiting
+	if (sink == NULL || sink->type != SINK_BATCH || sink->inbuf == 0) {
+		return -1;
+	}
+
+	long waited = (now_ns() - sink->oldest_ns) / 1000000;
+	if (waited >= SINK_BATCH_MS) {
+		sink_flush(sink);
+		return -1;
+	}
+
+	return SINK_BATCH_MS - waited;
+}
+
+/*
+ * Sink Utility Functions
+ */
+
+int sink_from_str(const char *str) {
+	// check valid argument
+	if (str == NULL) {
+		return -EINVAL;
+	}
+
+	for (int i = 0; i < sink_str_len; i++) {
+		if (strcmp(str, sink_str[i]) == 0) {
+			return i;
+		}
+	}
+
+	return -ENOENT;
+}
+
+const char *sink_to_str(const int type) {
+	if (type < 0 || type >= sink_str_len) {
+		return NULL;
+	}
+
+	return sink_str[type];
+}
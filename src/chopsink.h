@@ -0,0 +1,79 @@
+#ifndef __CHOPSINK_H__
+#define __CHOPSINK_H__
+
+/*
+ * Sink Macros
+ */
+
+/// Sink Types
+#define SINK_NONE 0 // messages are dropped
+#define SINK_BATCH 1 // messages are buffered and written in large blocks
+#define SINK_CONSOLE 2 // messages are printed through stdio as they arrive
+
+#define SINK_BATCH_LEN 65536 // buffered bytes that force a batch out
+#define SINK_BATCH_MS 100 // longest a buffered message waits to be written
+
+/*
+ * Structures
+ */
+
+struct sink {
+	int type;
+	int fd; // descriptor batches are written to
+	char *buf; // batched messages waiting to be written
+	int inbuf;
+	int bufsize;
+	long oldest_ns; // when the first byte in the batch was buffered
+	long flushes; // batches written
+};
+
+/*
+ * Sink the print_* functions write displayed packets to, stdio when unset.
+ * Every thread has its own.
+ */
+extern __thread struct sink *message_sink;
+
+/*
+ * Sink Management Functions
+ */
+
+int init_sink_struct(struct sink **target, const int type, const int fd);
+
+/*
+ * Writes out anything still batched before destroying the sink.
+ */
+int destroy_sink_struct(struct sink **target);
+
+/*
+ * Output Functions
+ */
+
+/*
+ * Formats a message into the sink. A batch sink writes itself out once its
+ * buffer cannot hold the message.
+ */
+int sink_printf(struct sink *sink, const char *format, ...);
+
+int sink_write(struct sink *sink, const char *buf, const int len);
+
+/*
+ * Writes out everything batched so far with a single write.
+ */
+int sink_flush(struct sink *sink);
+
+/*
+ * Writes out the batch if its oldest message has waited SINK_BATCH_MS.
+ * Returns how many milliseconds until it will have to be written, or -1 when
+ * nothing is waiting, suitable as an event loop timeout.
+ */
+int sink_tick(struct sink *sink);
+
+/*
+ * Sink Utility Functions
+ */
+
+int sink_from_str(const char *str);
+
+const char *sink_to_str(const int type);
+
+#endif
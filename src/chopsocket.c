@@ -1,8 +1,11 @@
+#define _GNU_SOURCE // accept4
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <arpa/inet.h>     /* inet_ntoa */
 #include <netdb.h>         /* gethostname */
 #include <sys/socket.h>
@@ -27,7 +30,7 @@ int init_server_addr(struct sockaddr_in *addr, const int port) {
 	return 0;
 }
 
-int setup_server_socket(struct sockaddr_in *self, const int port, const int num_queue) {
+static int open_server_socket(struct sockaddr_in *self, const int port, const int num_queue, const int shared) {
 	// check valid arguments
 	if (self == NULL || num_queue < 1 || port < 0) {
 		DEBUG_PRINT("invalid arguments");
@@ -55,6 +58,13 @@ int setup_server_socket(struct sockaddr_in *self, const int port, const int num_
 		return -errno;
 	}
 
+	// Let every socket that asks bind the same port, the kernel spreads
+	// incoming connections between them
+	if (shared && setsockopt(soc, SOL_SOCKET, SO_REUSEPORT, (const char *) &on, sizeof(on)) < 0) {
+		DEBUG_PRINT("setsockopt reuseport fail");
+		return -errno;
+	}
+
 	// Associate the process with the address and a port
 	if (bind(soc, (struct sockaddr *) self, sizeof(*self)) < 0) {
 		DEBUG_PRINT("bind fail"); // port might be in use
@@ -71,6 +81,14 @@ int setup_server_socket(struct sockaddr_in *self, const int port, const int num_
 	return soc;
 }
 
+int setup_server_socket(struct sockaddr_in *self, const int port, const int num_queue) {
+	return open_server_socket(self, port, num_queue, 0);
+}
+
+int setup_shared_server_socket(struct sockaddr_in *self, const int port, const int num_queue) {
+	return open_server_socket(self, port, num_queue, 1);
+}
+
 int accept_connection(const int listenfd, struct sockaddr_in *peer) {
 	// check valid arguments
 	if (listenfd < MIN_FD) {
@@ -96,11 +114,27 @@ int refuse_connection(const int listenfd) {
 		return -EINVAL;
 	}
 
-	struct sockaddr_in peer;
-	unsigned int peer_len = sizeof(peer);
-	peer.sin_family = PF_INET;
+	// never wait on the queue or the refused peer
+	int client_socket = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK);
+	if (client_socket < MIN_FD) {
+		return -errno;
+	}
+
+	return send_refusal(client_socket, REFUSE_FULL);
+}
+
+int send_refusal(const int fd, const int reason) {
+	if (fd < MIN_FD) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
 
-	close(accept(listenfd, (struct sockaddr *) &peer, &peer_len)); // TODO: return a refusal message
+	// a bare header, the peer learns why before the connection closes
+	const unsigned char refusal[HEADER_LEN] = {0, NEG_ACKNOWLEDGE, NULL_BYTE, reason};
+	if (send(fd, refusal, sizeof(refusal), MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+		DEBUG_PRINT("refusal to fd %d lost", fd);
+	}
+	close(fd);
 
 	return 0;
 }
@@ -139,3 +173,24 @@ int connect_to_server(struct sockaddr_in *addr, const char *hostname, const int
 
 	return soc;
 }
+
+int set_nonblocking(const int fd) {
+	// check valid arguments
+	if (fd < MIN_FD) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags < 0) {
+		DEBUG_PRINT("fcntl get fail");
+		return -errno;
+	}
+
+	if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		DEBUG_PRINT("fcntl set fail");
+		return -errno;
+	}
+
+	return 0;
+}
@@ -13,6 +13,12 @@ int init_server_addr(struct sockaddr_in *addr, const int port);
  */
 int setup_server_socket(struct sockaddr_in *self, const int port, const int num_queue);
 
+/*
+ * Create and setup a socket for a server to listen on, sharing the port with
+ * every other socket set up this way through SO_REUSEPORT.
+ */
+int setup_shared_server_socket(struct sockaddr_in *self, const int port, const int num_queue);
+
 /*
  * Wait for and accept a new connection.
  * Return -1 if the accept call failed.
@@ -20,14 +26,26 @@ int setup_server_socket(struct sockaddr_in *self, const int port, const int num_
 int accept_connection(const int listenfd, struct sockaddr_in *peer);
 
 /*
- * Waits for an incoming connection, immediately closing the connection.
- * Returns 0 on success, negative on error.
+ * Accepts a waiting connection only to refuse it, without blocking. Returns 0
+ * on success, -EAGAIN if nothing was waiting, negative on error.
  */
 int refuse_connection(const int listenfd);
 
+/*
+ * Sends a NEG_ACKNOWLEDGE refusing the connection for the given reason, then
+ * closes the descriptor.
+ */
+int send_refusal(const int fd, const int reason);
+
 /*
  * Create a socket and connect to the server indicated by the port and hostname
  */
 int connect_to_server(struct sockaddr_in *addr, const char *hostname, const int port);
 
+/*
+ * Marks the given descriptor as non-blocking.
+ * Returns 0 on success, negative on error.
+ */
+int set_nonblocking(const int fd);
+
 #endif
@@ -0,0 +1,256 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "chopconst.h"
+#include "chopdebug.h"
+#include "choptimer.h"
+
+#define TIMER_MAX_DELTA ((1L << (TIMER_LEVEL_BITS * TIMER_LEVELS)) - 1)
+
+/*
+ * Slot Helpers
+ */
+
+static void link_timer(struct timer **slot, struct timer *timer) {
+	timer->next = *slot;
+	if (timer->next != NULL) {
+		timer->next->pprev = &(timer->next);
+	}
+	*slot = timer;
+	timer->pprev = slot;
+}
+
+static void unlink_timer(struct timer *timer) {
+	*(timer->pprev) = timer->next;
+	if (timer->next != NULL) {
+		timer->next->pprev = timer->pprev;
+	}
+	timer->next = NULL;
+	timer->pprev = NULL;
+}
+
+static long current_tick(struct timer_wheel *wheel) {
+	return (wheel->clock() - wheel->start_ms) / wheel->tick_ms;
+}
+
+/*
+ * Files the timer under the lowest level whose span still reaches its expiry.
+ */
+static void place_timer(struct timer_wheel *wheel, struct timer *timer) {
+	long delta = timer->expires - wheel->now;
+	if (delta > TIMER_MAX_DELTA) {
+		timer->expires = wheel->now + TIMER_MAX_DELTA;
+		delta = TIMER_MAX_DELTA;
+	}
+
+	int level = 0;
+	while (level < TIMER_LEVELS - 1 && delta >= (1L << (TIMER_LEVEL_BITS * (level + 1)))) {
+		level++;
+	}
+
+	int index = (timer->expires >> (TIMER_LEVEL_BITS * level)) & (TIMER_SLOTS - 1);
+	link_timer(&(wheel->slots[level][index]), timer);
+}
+
+/*
+ * Moves every timer of a higher level slot down now that its span has come.
+ */
+static void cascade(struct timer_wheel *wheel, const int level, const int index) {
+	struct timer *cur = wheel->slots[level][index];
+	wheel->slots[level][index] = NULL;
+
+	while (cur != NULL) {
+		struct timer *next = cur->next;
+		place_timer(wheel, cur);
+		wheel->cascaded++;
+		cur = next;
+	}
+}
+
+/*
+ * Timer Wheel Management Functions
+ */
+
+int init_timer_wheel(struct timer_wheel **target, const long tick_ms, long (*clock)(void)) {
+	// check valid arguments
+	if (target == NULL || tick_ms < 1) {
+		return -EINVAL;
+	}
+
+	// allocate structure, every slot starts empty
+	struct timer_wheel *init = (struct timer_wheel *) calloc(1, sizeof(struct timer_wheel));
+	if (init == NULL) {
+		DEBUG_PRINT("calloc, structure");
+		return -ENOMEM;
+	}
+
+	// initialize structure fields
+	init->tick_ms = tick_ms;
+	init->clock = (clock != NULL) ? clock : timer_now_ms;
+	init->start_ms = init->clock();
+	init->now = 0;
+	init->owner = NULL;
+
+	// set given pointer to new struct
+	*target = init;
+	return 0;
+}
+
+int destroy_timer_wheel(struct timer_wheel **target) {
+	// check valid argument
+	if (target == NULL) {
+		return -EINVAL;
+	}
+
+	// struct already doesn't exist
+	if (*target == NULL) {
+		return 0;
+	}
+
+	// direct reference to structure
+	struct timer_wheel *old = *target;
+
+	// timers outlive the wheel, leave them unarmed
+	for (int level = 0; level < TIMER_LEVELS; level++) {
+		for (int index = 0; index < TIMER_SLOTS; index++) {
+			while (old->slots[level][index] != NULL) {
+				unlink_timer(old->slots[level][index]);
+			}
+		}
+	}
+
+	// deallocate structure
+	free(old);
+
+	// dereference holder
+	*target = NULL;
+	return 0;
+}
+
+/*
+ * Timer Functions
+ */
+
+void timer_setup(struct timer *timer, void (*callback)(struct timer_wheel *wheel, struct timer *timer), void *arg) {
+	timer->next = NULL;
+	timer->pprev = NULL;
+	timer->expires = 0;
+	timer->callback = callback;
+	timer->arg = arg;
+	timer->wheel = NULL;
+}
+
+int timer_arm(struct timer_wheel *wheel, struct timer *timer, const long delay_ms) {
+	// check valid arguments
+	if (wheel == NULL || timer == NULL || timer->callback == NULL || delay_ms < 0) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// rearming only moves the timer
+	timer_cancel(timer);
+
+	// count from the present, the wheel can lag behind while its loop is busy
+	long now = current_tick(wheel);
+	if (now < wheel->now) now = wheel->now;
+
+	// never fire on the tick already run
+	long ticks = (delay_ms + wheel->tick_ms - 1) / wheel->tick_ms;
+	timer->expires = now + ((ticks > 0) ? ticks : 1);
+	timer->wheel = wheel;
+	place_timer(wheel, timer);
+	wheel->armed++;
+
+	return 0;
+}
+
+void timer_cancel(struct timer *timer) {
+	if (timer == NULL || timer->pprev == NULL) {
+		return;
+	}
+
+	unlink_timer(timer);
+	timer->wheel->armed--;
+}
+
+int timer_armed(const struct timer *timer) {
+	return timer != NULL && timer->pprev != NULL;
+}
+
+int timer_advance(struct timer_wheel *wheel) {
+	// check valid argument
+	if (wheel == NULL) {
+		return -EINVAL;
+	}
+
+	long target = current_tick(wheel);
+
+	// nothing can fire, skip straight to the present
+	if (wheel->armed == 0) {
+		if (target > wheel->now) {
+			wheel->now = target;
+		}
+		return 0;
+	}
+
+	int fired = 0;
+	while (wheel->now < target) {
+		wheel->now++;
+
+		// a wrapped level pulls the next span down from the one above
+		for (int level = 1; level < TIMER_LEVELS; level++) {
+			int shift = TIMER_LEVEL_BITS * level;
+			if ((wheel->now & ((1L << shift) - 1)) != 0) {
+				break;
+			}
+			cascade(wheel, level, (wheel->now >> shift) & (TIMER_SLOTS - 1));
+		}
+
+		// everything left in this slot expires on this tick
+		struct timer **slot = &(wheel->slots[0][wheel->now & (TIMER_SLOTS - 1)]);
+		while (*slot != NULL) {
+			struct timer *timer = *slot;
+			unlink_timer(timer);
+			wheel->armed--;
+			wheel->fired++;
+			fired++;
+			timer->callback(wheel, timer);
+		}
+	}
+
+	return fired;
+}
+
+int timer_next_ms(struct timer_wheel *wheel) {
+	// nothing armed, wait forever
+	if (wheel == NULL || wheel->armed == 0) {
+		return -1;
+	}
+
+	// the next expiry, or the next cascade that may reveal one
+	long tick = wheel->now + 1;
+	while ((tick & (TIMER_SLOTS - 1)) != 0 && wheel->slots[0][tick & (TIMER_SLOTS - 1)] == NULL) {
+		tick++;
+	}
+
+	long due = wheel->start_ms + tick * wheel->tick_ms - wheel->clock();
+	return (due > 0) ? (int) due : 0;
+}
+
+/*
+ * Timer Utility Functions
+ */
+
+long timer_now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+long timer_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
@@ -0,0 +1,100 @@
+#ifndef __CHOPTIMER_H__
+#define __CHOPTIMER_H__
+
+#include "chopconst.h"
+
+/*
+ * Timer Macros
+ */
+
+#define TIMER_TICK_MS 10 // resolution of the wheels the server and client run
+#define TIMER_LEVEL_BITS 6
+#define TIMER_SLOTS (1 << TIMER_LEVEL_BITS) // slots in every level
+#define TIMER_LEVELS 4 // reaches 2^24 ticks, longer delays are clamped
+
+/*
+ * Structures
+ */
+
+/*
+ * Timers are kept in buckets by expiry, a level for every 64 times longer
+ * span. Only the slot of the next tick is visited when time advances, and a
+ * higher level slot is redistributed once every time the level below wraps.
+ */
+struct timer_wheel {
+	long tick_ms; // milliseconds per tick
+	long start_ms; // time of tick 0
+	long (*clock)(void); // milliseconds on a monotonic clock, timer_now_ms unless replaced
+	long now; // last tick that was run
+	struct timer *slots[TIMER_LEVELS][TIMER_SLOTS];
+	int armed; // timers waiting in the wheel
+	long fired; // callbacks run since the wheel was created
+	long cascaded; // timers moved down a level
+	void *owner; // pointer handed to callbacks through the wheel
+};
+
+/*
+ * Timer Wheel Management Functions
+ */
+
+/*
+ * Sets up an empty wheel whose tick 0 starts now on the given clock, NULL for
+ * the monotonic clock.
+ */
+int init_timer_wheel(struct timer_wheel **target, const long tick_ms, long (*clock)(void));
+
+/*
+ * Disarms every timer left in the wheel before freeing it.
+ */
+int destroy_timer_wheel(struct timer_wheel **target);
+
+/*
+ * Timer Functions
+ */
+
+/*
+ * Prepares an unarmed timer, must be called once before it is armed.
+ */
+void timer_setup(struct timer *timer, void (*callback)(struct timer_wheel *wheel, struct timer *timer), void *arg);
+
+/*
+ * Arms the timer to fire delay_ms from now, rounded up to whole ticks. An
+ * armed timer is moved rather than armed twice.
+ */
+int timer_arm(struct timer_wheel *wheel, struct timer *timer, const long delay_ms);
+
+/*
+ * Disarms the timer, doing nothing if it is not armed.
+ */
+void timer_cancel(struct timer *timer);
+
+int timer_armed(const struct timer *timer);
+
+/*
+ * Runs every tick up to now, firing the timers that expired. Callbacks may arm
+ * and cancel any timer, including their own. Returns the number fired.
+ */
+int timer_advance(struct timer_wheel *wheel);
+
+/*
+ * Returns how many milliseconds until the wheel has to be advanced, or -1
+ * when nothing is armed, suitable as an event loop timeout. Looks no further
+ * than the next slot of the lowest level.
+ */
+int timer_next_ms(struct timer_wheel *wheel);
+
+/*
+ * Timer Utility Functions
+ */
+
+/*
+ * Milliseconds on the monotonic clock.
+ */
+long timer_now_ms(void);
+
+/*
+ * Nanoseconds on the same clock.
+ */
+long timer_now_ns(void);
+
+#endif
@@ -0,0 +1,369 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "chopconst.h"
+#include "chopdebug.h"
+#include "choppacket.h"
+#include "choptopic.h"
+
+/*
+ * Table Helpers
+ */
+
+// FNV-1a, names are short and hashed once per packet
+static unsigned int hash_name(const char *name, const int len) {
+	unsigned int hash = 2166136261u;
+	for (int i = 0; i < len; i++) {
+		hash ^= (unsigned char) name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/*
+ * Returns the slot holding the named topic, or the empty slot ending its
+ * probe if there is none.
+ */
+static int probe_slot(struct topic_table *table, const char *name, const int len, const unsigned int hash) {
+	int mask = table->cap - 1;
+	int index = hash & mask;
+	while (table->slots[index] != NULL) {
+		struct topic *cur = table->slots[index];
+		if (cur->hash == hash && cur->len == len && memcmp(cur->name, name, len) == 0) {
+			break;
+		}
+		index = (index + 1) & mask;
+	}
+	return index;
+}
+
+static int grow_table(struct topic_table *table) {
+	int cap = table->cap * 2;
+	struct topic **slots = (struct topic **) calloc(cap, sizeof(struct topic *));
+	if (slots == NULL) {
+		DEBUG_PRINT("calloc, slots");
+		return -ENOMEM;
+	}
+
+	// every topic is probed for again in the larger table
+	struct topic **old = table->slots;
+	int old_cap = table->cap;
+	table->slots = slots;
+	table->cap = cap;
+	for (int i = 0; i < old_cap; i++) {
+		if (old[i] != NULL) {
+			table->slots[probe_slot(table, old[i]->name, old[i]->len, old[i]->hash)] = old[i];
+		}
+	}
+
+	free(old);
+	DEBUG_PRINT("topic table grew to %d", cap);
+	return 0;
+}
+
+/*
+ * Empties the topic's slot, moving back every later topic of the probe so no
+ * lookup stops short at the hole.
+ */
+static void remove_topic(struct topic_table *table, struct topic *topic) {
+	int mask = table->cap - 1;
+	int hole = probe_slot(table, topic->name, topic->len, topic->hash);
+	table->slots[hole] = NULL;
+
+	int index = (hole + 1) & mask;
+	while (table->slots[index] != NULL) {
+		struct topic *cur = table->slots[index];
+		int home = cur->hash & mask;
+
+		// a topic may fill the hole if the hole lies between its home and itself
+		if (((index - home) & mask) >= ((index - hole) & mask)) {
+			table->slots[hole] = cur;
+			table->slots[index] = NULL;
+			hole = index;
+		}
+		index = (index + 1) & mask;
+	}
+
+	table->count--;
+	free(topic->subs);
+	free(topic);
+}
+
+/*
+ * Swaps the last subscription of the client into the given one's place.
+ */
+static void unlink_subscription(struct client *cli, const int index) {
+	struct subscription *last = cli->subs + (--cli->sub_count);
+	if (index != cli->sub_count) {
+		cli->subs[index] = *last;
+		last->topic->subs[last->index].index = index;
+	}
+}
+
+/*
+ * Swaps the last subscriber of the topic into the given one's place, removing
+ * the topic once it has none left.
+ */
+static void unlink_subscriber(struct topic_table *table, struct topic *topic, const int index) {
+	struct subscriber *last = topic->subs + (--topic->count);
+	if (index != topic->count) {
+		topic->subs[index] = *last;
+		topic->subs[index].cli->subs[last->index].index = index;
+	}
+
+	if (topic->count == 0) {
+		remove_topic(table, topic);
+	}
+}
+
+/*
+ * Topic Table Management Functions
+ */
+
+int init_topic_table(struct topic_table **target) {
+	// check valid argument
+	if (target == NULL) {
+		return -EINVAL;
+	}
+
+	// allocate structure
+	struct topic_table *init = (struct topic_table *) malloc(sizeof(struct topic_table));
+	if (init == NULL) {
+		DEBUG_PRINT("malloc, structure");
+		return -ENOMEM;
+	}
+
+	// allocate empty slots
+	init->slots = (struct topic **) calloc(TOPIC_TABLE_MIN, sizeof(struct topic *));
+	if (init->slots == NULL) {
+		DEBUG_PRINT("calloc, slots");
+		free(init);
+		return -ENOMEM;
+	}
+
+	// initialize structure fields
+	init->cap = TOPIC_TABLE_MIN;
+	init->count = 0;
+	init->published = 0;
+	init->delivered = 0;
+	init->on_deliver = NULL;
+	init->on_publish = NULL;
+	init->owner = NULL;
+
+	// set given pointer to new struct
+	*target = init;
+	return 0;
+}
+
+int destroy_topic_table(struct topic_table **target) {
+	// check valid argument
+	if (target == NULL) {
+		return -EINVAL;
+	}
+
+	// struct already doesn't exist
+	if (*target == NULL) {
+		return 0;
+	}
+
+	// direct reference to structure
+	struct topic_table *old = *target;
+
+	// deallocate every topic
+	for (int i = 0; i < old->cap; i++) {
+		if (old->slots[i] != NULL) {
+			free(old->slots[i]->subs);
+			free(old->slots[i]);
+		}
+	}
+
+	// deallocate structure
+	free(old->slots);
+	free(old);
+
+	// dereference holder
+	*target = NULL;
+	return 0;
+}
+
+/*
+ * Subscription Functions
+ */
+
+int topic_subscribe(struct topic_table *table, struct client *cli, const char *name, const int len) {
+	// check valid arguments
+	if (table == NULL || cli == NULL || name == NULL || len < 1 || len > TOPIC_NAME_MAX) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// a client lists few topics, looking through them is cheaper than hashing
+	for (int i = 0; i < cli->sub_count; i++) {
+		struct topic *cur = cli->subs[i].topic;
+		if (cur->len == len && memcmp(cur->name, name, len) == 0) {
+			return 1;
+		}
+	}
+
+	// make room on the client's side first, nothing to undo if it fails
+	if (cli->sub_count == cli->sub_cap) {
+		int cap = (cli->sub_cap > 0) ? cli->sub_cap * 2 : TOPIC_SUBS_MIN;
+		struct subscription *subs = (struct subscription *) realloc(cli->subs, sizeof(struct subscription) * cap);
+		if (subs == NULL) {
+			DEBUG_PRINT("realloc, subscriptions");
+			return -ENOMEM;
+		}
+		cli->subs = subs;
+		cli->sub_cap = cap;
+	}
+
+	// keep probes short, at most half the slots are taken
+	if ((table->count + 1) * 2 > table->cap && grow_table(table) < 0) {
+		return -ENOMEM;
+	}
+
+	// first subscriber creates the topic, name stored behind it
+	unsigned int hash = hash_name(name, len);
+	int slot = probe_slot(table, name, len, hash);
+	struct topic *topic = table->slots[slot];
+	if (topic == NULL) {
+		topic = (struct topic *) malloc(sizeof(struct topic) + sizeof(char) * len);
+		if (topic == NULL) {
+			DEBUG_PRINT("malloc, topic");
+			return -ENOMEM;
+		}
+		topic->name = (char *) (topic + 1);
+		memcpy(topic->name, name, len);
+		topic->len = len;
+		topic->hash = hash;
+		topic->subs = NULL;
+		topic->count = 0;
+		topic->cap = 0;
+		table->slots[slot] = topic;
+		table->count++;
+	}
+
+	if (topic->count == topic->cap) {
+		int cap = (topic->cap > 0) ? topic->cap * 2 : TOPIC_SUBS_MIN;
+		struct subscriber *subs = (struct subscriber *) realloc(topic->subs, sizeof(struct subscriber) * cap);
+		if (subs == NULL) {
+			DEBUG_PRINT("realloc, subscribers");
+			if (topic->count == 0) {
+				remove_topic(table, topic);
+			}
+			return -ENOMEM;
+		}
+		topic->subs = subs;
+		topic->cap = cap;
+	}
+
+	// link both sides to each other
+	topic->subs[topic->count].cli = cli;
+	topic->subs[topic->count].index = cli->sub_count;
+	cli->subs[cli->sub_count].topic = topic;
+	cli->subs[cli->sub_count].index = topic->count;
+	topic->count++;
+	cli->sub_count++;
+
+	DEBUG_PRINT("client %d subscribed, %d on topic", cli->socket_fd, topic->count);
+	return 0;
+}
+
+int topic_unsubscribe(struct topic_table *table, struct client *cli, const char *name, const int len) {
+	// check valid arguments
+	if (table == NULL || cli == NULL || name == NULL || len < 0) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	for (int i = 0; i < cli->sub_count; i++) {
+		struct subscription sub = cli->subs[i];
+		if (sub.topic->len == len && memcmp(sub.topic->name, name, len) == 0) {
+			unlink_subscription(cli, i);
+			unlink_subscriber(table, sub.topic, sub.index);
+			return 0;
+		}
+	}
+
+	DEBUG_PRINT("client %d not subscribed", cli->socket_fd);
+	return -ENOENT;
+}
+
+int topic_drop_client(struct topic_table *table, struct client *cli) {
+	// check valid arguments
+	if (table == NULL || cli == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+
+	// last subscription first, nothing on the client's side has to move
+	while (cli->sub_count > 0) {
+		struct subscription sub = cli->subs[--cli->sub_count];
+		unlink_subscriber(table, sub.topic, sub.index);
+	}
+
+	return 0;
+}
+
+/*
+ * Publishing Functions
+ */
+
+int topic_publish(struct topic_table *table, struct shared *payload) {
+	// check valid arguments
+	if (table == NULL || payload == NULL) {
+		DEBUG_PRINT("invalid arguments");
+		return -EINVAL;
+	}
+	table->published++;
+
+	// nobody listening
+	const char *name;
+	int len = payload_topic(payload, &name);
+	struct topic *topic = topic_find(table, name, len);
+	if (topic == NULL) {
+		return 0;
+	}
+
+	// every subscriber takes a reference, none takes a copy
+	int queued = 0;
+	for (int i = 0; i < topic->count; i++) {
+		struct client *cli = topic->subs[i].cli;
+		if (cli->inc_flag == CANCEL || cli->out_flag == CANCEL) {
+			continue;
+		}
+
+		if (write_shared(cli, payload) < 0) {
+			DEBUG_PRINT("failed delivery to client %d", cli->socket_fd);
+			continue;
+		}
+		queued++;
+
+		if (table->on_deliver != NULL) {
+			table->on_deliver(table, cli);
+		}
+	}
+
+	table->delivered += queued;
+	return queued;
+}
+
+/*
+ * Topic Utility Functions
+ */
+
+struct topic *topic_find(struct topic_table *table, const char *name, const int len) {
+	// check valid arguments
+	if (table == NULL || name == NULL || len < 0) {
+		return NULL;
+	}
+
+	return table->slots[probe_slot(table, name, len, hash_name(name, len))];
+}
+
+int payload_topic(struct shared *payload, const char **name) {
+	// topic length is control1, the name opens the data section
+	*name = payload->bytes + HEADER_LEN;
+	return (unsigned char) payload->bytes[PACKET_CONTROL1];
+}
@@ -0,0 +1,111 @@
+#ifndef __CHOPTOPIC_H__
+#define __CHOPTOPIC_H__
+
+#include "chopconst.h"
+
+/*
+ * Topic Macros
+ */
+
+#define TOPIC_NAME_MAX 255 // names are counted by control1
+#define TOPIC_TABLE_MIN 64 // slots a table starts with, a power of two
+#define TOPIC_SUBS_MIN 4 // subscribers a topic makes room for at first
+
+/*
+ * Structures
+ */
+
+/*
+ * A client's membership in a topic, kept on both sides so either can be
+ * dropped without searching the other.
+ */
+struct subscription {
+	struct topic *topic;
+	int index; // of the client in the topic's subscribers
+};
+
+struct subscriber {
+	struct client *cli;
+	int index; // of the subscription in the client's
+};
+
+struct topic {
+	char *name; // not terminated, stored directly behind the structure
+	int len;
+	unsigned int hash;
+	struct subscriber *subs; // packed at the front, in no particular order
+	int count;
+	int cap;
+};
+
+/*
+ * Topics of a single worker's clients by name, in open addressed slots probed
+ * linearly. A topic is removed with its last subscriber.
+ */
+struct topic_table {
+	struct topic **slots; // NULL where empty
+	int cap;
+	int count;
+	long published; // payloads handed to topic_publish
+	long delivered; // payloads queued for subscribers
+	void (*on_deliver)(struct topic_table *table, struct client *cli); // a subscriber's queue grew
+	void (*on_publish)(struct topic_table *table, struct shared *payload); // a client published
+	void *owner; // pointer handed to the callbacks through the table
+};
+
+/*
+ * Topic Table Management Functions
+ */
+
+int init_topic_table(struct topic_table **target);
+
+/*
+ * Frees every topic, the clients' own subscription arrays are left to them.
+ */
+int destroy_topic_table(struct topic_table **target);
+
+/*
+ * Subscription Functions
+ */
+
+/*
+ * Adds the client to the named topic, creating the topic if needed. Returns 0
+ * if the client was added, 1 if it was already subscribed, or negative on
+ * error.
+ */
+int topic_subscribe(struct topic_table *table, struct client *cli, const char *name, const int len);
+
+/*
+ * Removes the client from the named topic. Returns -ENOENT if it was not
+ * subscribed.
+ */
+int topic_unsubscribe(struct topic_table *table, struct client *cli, const char *name, const int len);
+
+/*
+ * Removes the client from every topic it subscribed to, for when it is gone.
+ */
+int topic_drop_client(struct topic_table *table, struct client *cli);
+
+/*
+ * Publishing Functions
+ */
+
+/*
+ * Queues the serialized delivery for every subscriber of the topic named in
+ * it, sharing the one copy, and reports each through on_deliver. Returns the
+ * number of subscribers it was queued for.
+ */
+int topic_publish(struct topic_table *table, struct shared *payload);
+
+/*
+ * Topic Utility Functions
+ */
+
+struct topic *topic_find(struct topic_table *table, const char *name, const int len);
+
+/*
+ * Points name at the topic a serialized delivery is for, returning its length.
+ */
+int payload_topic(struct shared *payload, const char **name);
+
+#endif
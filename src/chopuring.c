@@ -0,0 +1,910 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/time_types.h>
+
+#include "chopconn.h"
+#include "chopconst.h"
+#include "chopdata.h"
+#include "chopdebug.h"
+#include "chopmetrics.h"
+#include "choppacket.h"
+#include "choppool.h"
+#include "chopsocket.h"
+#include "choptimer.h"
+#include "chopuring.h"
+
+/// Completion Tags, kept in the low bits of user_data
+#define TAG_MASK 0x7
+#define TAG_ACCEPT 1
+#define TAG_RECV 2
+#define TAG_SEND 3
+#define TAG_WAKE 4
+#define TAG_IGNORE 5
+#define TAG_NOTIFY 6
+
+#define user_data_of(ptr, tag) ((__u64) (uintptr_t) (ptr) | (tag))
+#define conn_of(data) ((struct uring_conn *) (uintptr_t) ((data) & ~(__u64) TAG_MASK))
+
+/*
+ * System Call Wrappers
+ */
+
+static int sys_setup(const unsigned entries, struct io_uring_params *params) {
+	return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_enter(const int fd, const unsigned to_submit, const unsigned min_complete, const unsigned flags, void *arg, const size_t argsz) {
+	return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int sys_register(const int fd, const unsigned opcode, void *arg, const unsigned nr_args) {
+	return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/*
+ * Ring Helpers
+ */
+
+static int map_ring(struct uring *ring, const int entries, const int cq_entries) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = cq_entries;
+
+	ring->fd = sys_setup(entries, &params);
+	if (ring->fd < 0) {
+		DEBUG_PRINT("io_uring_setup fail");
+		return -errno;
+	}
+
+	// both queues share one mapping on every kernel with multishot receives
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+		DEBUG_PRINT("separate queue mappings unsupported");
+		return -ENOTSUP;
+	}
+	ring->ext_arg = (params.features & IORING_FEAT_EXT_ARG) != 0;
+
+	size_t sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	size_t cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->ring_len = (sq_len > cq_len) ? sq_len : cq_len;
+	ring->ring_mem = mmap(NULL, ring->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->ring_mem == MAP_FAILED) {
+		DEBUG_PRINT("mmap, rings");
+		ring->ring_mem = NULL;
+		return -errno;
+	}
+
+	ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = (struct io_uring_sqe *) mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		DEBUG_PRINT("mmap, entries");
+		ring->sqes = NULL;
+		return -errno;
+	}
+
+	char *mem = (char *) ring->ring_mem;
+	ring->sq_head = (unsigned *) (mem + params.sq_off.head);
+	ring->sq_tail = (unsigned *) (mem + params.sq_off.tail);
+	ring->sq_mask = *(unsigned *) (mem + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned *) (mem + params.sq_off.array);
+	ring->sq_entries = params.sq_entries;
+	ring->cq_head = (unsigned *) (mem + params.cq_off.head);
+	ring->cq_tail = (unsigned *) (mem + params.cq_off.tail);
+	ring->cq_mask = *(unsigned *) (mem + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) (mem + params.cq_off.cqes);
+	return 0;
+}
+
+static void unmap_ring(struct uring *ring) {
+	if (ring->sqes != NULL) {
+		munmap(ring->sqes, ring->sqes_len);
+	}
+	if (ring->ring_mem != NULL) {
+		munmap(ring->ring_mem, ring->ring_len);
+	}
+	if (ring->fd > MIN_FD) {
+		close(ring->fd);
+	}
+}
+
+static int map_buf_ring(struct uring *ring, const int entries) {
+	ring->buf_ring_len = entries * sizeof(struct io_uring_buf);
+	void *mem = mmap(NULL, ring->buf_ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		DEBUG_PRINT("mmap, buffer ring");
+		return -errno;
+	}
+	ring->buf_ring = (struct io_uring_buf_ring *) mem;
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (__u64) (uintptr_t) mem;
+	reg.ring_entries = entries;
+	reg.bgid = URING_BUF_GROUP;
+	if (sys_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		DEBUG_PRINT("register buffer ring fail");
+		return -errno;
+	}
+	return 0;
+}
+
+/*
+ * Hands a receive buffer back to the kernel.
+ */
+static void provide_buffer(struct uring *ring, const int bid, char *addr, const int len) {
+	struct io_uring_buf *buf = &(ring->buf_ring->bufs[ring->buf_tail & (URING_BUFS - 1)]);
+	buf->addr = (__u64) (uintptr_t) addr;
+	buf->len = len;
+	buf->bid = bid;
+	ring->buf_tail++;
+	__atomic_store_n(&(ring->buf_ring->tail), ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+static int submit(struct uring *ring, const unsigned min_complete, const int timeout) {
+	unsigned flags = (min_complete > 0) ? IORING_ENTER_GETEVENTS : 0;
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	void *argp = NULL;
+	size_t argsz = 0;
+
+	// bound the wait when asked, on kernels that take a timeout with the wait
+	if (min_complete > 0 && timeout >= 0 && ring->ext_arg) {
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000L;
+		memset(&arg, 0, sizeof(arg));
+		arg.sigmask_sz = _NSIG / 8;
+		arg.ts = (__u64) (uintptr_t) &ts;
+		flags |= IORING_ENTER_EXT_ARG;
+		argp = &arg;
+		argsz = sizeof(arg);
+	}
+
+	int ret = sys_enter(ring->fd, ring->to_submit, min_complete, flags, argp, argsz);
+	ring->enters++;
+	if (ret < 0) {
+		if (errno == ETIME || errno == EINTR) {
+			// nothing completed in time, anything prepared was still submitted
+			ring->to_submit = 0;
+			return 0;
+		}
+		DEBUG_PRINT("io_uring_enter fail");
+		return -errno;
+	}
+
+	ring->to_submit -= ((unsigned) ret < ring->to_submit) ? (unsigned) ret : ring->to_submit;
+	return ret;
+}
+
+static struct io_uring_sqe *get_sqe(struct uring *ring) {
+	unsigned tail = *(ring->sq_tail);
+
+	// queue is full, submit what is waiting without waiting on completions
+	if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+		if (submit(ring, 0, -1) < 0) {
+			return NULL;
+		}
+		if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+			return NULL;
+		}
+	}
+
+	unsigned index = tail & ring->sq_mask;
+	struct io_uring_sqe *sqe = ring->sqes + index;
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	ring->sq_array[index] = index;
+
+	// publish the entry, the kernel only reads it on the next enter
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->to_submit++;
+	return sqe;
+}
+
+/*
+ * Operation Helpers
+ */
+
+static int arm_accept(struct uring *ring) {
+	struct io_uring_sqe *sqe = get_sqe(ring);
+	if (sqe == NULL) {
+		return -EBUSY;
+	}
+
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = ring->host->server_fd;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_CLOEXEC;
+	sqe->user_data = user_data_of(NULL, TAG_ACCEPT);
+
+	ring->accept_armed = 1;
+	return 0;
+}
+
+static int arm_notify(struct uring *ring) {
+	struct io_uring_sqe *sqe = get_sqe(ring);
+	if (sqe == NULL) {
+		return -EBUSY;
+	}
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = ring->notify_fd;
+	sqe->poll32_events = POLLIN;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = user_data_of(NULL, TAG_NOTIFY);
+	return 0;
+}
+
+/*
+ * Stops accepting once the server is full, admission_can_resume says when to
+ * start again.
+ */
+static int pause_accept(struct uring *ring) {
+	struct io_uring_sqe *sqe = get_sqe(ring);
+	if (sqe == NULL) {
+		return -EBUSY;
+	}
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = user_data_of(NULL, TAG_ACCEPT);
+	sqe->user_data = user_data_of(NULL, TAG_IGNORE);
+
+	ring->host->admitting = 0;
+	ring->host->admission_pauses++;
+	DEBUG_PRINT("server full, accepting paused");
+	return 0;
+}
+
+static int arm_recv(struct uring *ring, struct uring_conn *conn) {
+	struct io_uring_sqe *sqe = get_sqe(ring);
+	if (sqe == NULL) {
+		return -EBUSY;
+	}
+
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = conn->cli->socket_fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BUF_GROUP;
+	sqe->user_data = user_data_of(conn, TAG_RECV);
+
+	conn->recv_armed = 1;
+	conn->starved = 0;
+	return 0;
+}
+
+static int cancel_recv(struct uring *ring, struct uring_conn *conn) {
+	struct io_uring_sqe *sqe = get_sqe(ring);
+	if (sqe == NULL) {
+		return -EBUSY;
+	}
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = user_data_of(conn, TAG_RECV);
+	sqe->user_data = user_data_of(NULL, TAG_IGNORE);
+
+	conn->cancelling = 1;
+	return 0;
+}
+
+/*
+ * Waits for room in the socket to send the rest of a file body, which the
+ * ring cannot send from the file itself.
+ */
+static int arm_file_poll(struct uring *ring, struct uring_conn *conn) {
+	struct io_uring_sqe *sqe = get_sqe(ring);
+	if (sqe == NULL) {
+		return -EBUSY;
+	}
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = conn->cli->socket_fd;
+	sqe->poll32_events = POLLOUT;
+	sqe->user_data = user_data_of(conn, TAG_SEND);
+
+	conn->send_inflight = 1;
+	conn->file_polled = 1;
+	return 0;
+}
+
+static int arm_send(struct uring *ring, struct uring_conn *conn) {
+	// a file body goes out through sendfile once its header is written
+	struct client *cli = conn->cli;
+	while (cli->out_head != NULL && cli->out_head->file_left > 0 && cli->out_offset == HEADER_LEN + cli->out_head->datasize) {
+		int ret = send_file_body(cli, cli->out_head);
+		if (ret == 1) {
+			return arm_file_poll(ring, conn);
+		} else if (ret < 0) {
+			DEBUG_PRINT("failed file flush");
+			conn->send_failed = 1;
+			cli->inc_flag = CANCEL;
+			cli->out_flag = CANCEL;
+			return ret;
+		}
+		advance_queue(cli, 0);
+	}
+
+	int iovcnt = gather_queue(conn->cli, conn->iov, URING_SEND_IOV);
+	if (iovcnt < 1) {
+		return 0;
+	}
+
+	struct io_uring_sqe *sqe = get_sqe(ring);
+	if (sqe == NULL) {
+		return -EBUSY;
+	}
+
+	memset(&(conn->msg), 0, sizeof(conn->msg));
+	conn->msg.msg_iov = conn->iov;
+	conn->msg.msg_iovlen = iovcnt;
+
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = conn->cli->socket_fd;
+	sqe->addr = (__u64) (uintptr_t) &(conn->msg);
+	sqe->len = 1;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = user_data_of(conn, TAG_SEND);
+
+	conn->send_inflight = 1;
+	return 0;
+}
+
+/*
+ * Connection Helpers
+ */
+
+static void mark_dirty(struct uring *ring, struct uring_conn *conn) {
+	if (!conn->dirty) {
+		conn->dirty = 1;
+		ring->dirty[ring->dirty_count++] = conn;
+	}
+}
+
+/*
+ * Moves held buffers into the client's ring and parses them, as far as the
+ * ring has room. Buffers are given back to the kernel once emptied.
+ */
+static void deliver(struct uring *ring, struct uring_conn *conn) {
+	struct client *cli = conn->cli;
+	while (!is_client_status(cli, CANCEL)) {
+		// parsing frees room in the ring
+		if (parse_stream(cli) < 0) {
+			DEBUG_PRINT("failed stream parse");
+		}
+
+		if (conn->held_count == 0 || cli->recv->inring == cli->recv->ringsize) {
+			break;
+		}
+
+		struct uring_hold *hold = conn->held + conn->held_head;
+		struct buffer *buf = ring->bufs[hold->bid];
+		int moved = ring_write(cli->recv, buf->buf + hold->offset, hold->len - hold->offset);
+		hold->offset += moved;
+		cli->bytes_in += moved;
+
+		if (hold->offset == hold->len) {
+			provide_buffer(ring, hold->bid, buf->buf, buf->bufsize);
+			ring->held_total--;
+			conn->held_head = (conn->held_head + 1) & (URING_BUFS - 1);
+			conn->held_count--;
+
+			// clients that ran dry can receive again
+			if (ring->starved_count > 0) {
+				for (int i = 0; i < ring->host->cur_connections; i++) {
+					struct client *other = ring->host->live[i];
+					if (other->engine != NULL && ((struct uring_conn *) other->engine)->starved) {
+						((struct uring_conn *) other->engine)->starved = 0;
+						ring->starved_count--;
+						mark_dirty(ring, (struct uring_conn *) other->engine);
+					}
+				}
+			}
+		}
+	}
+
+	// holding too much, stop receiving until the client catches up
+	if (conn->held_count > URING_HOLD_MAX && conn->recv_armed && !conn->cancelling) {
+		cancel_recv(ring, conn);
+	}
+}
+
+static void release_held(struct uring *ring, struct uring_conn *conn) {
+	while (conn->held_count > 0) {
+		struct buffer *buf = ring->bufs[conn->held[conn->held_head].bid];
+		provide_buffer(ring, conn->held[conn->held_head].bid, buf->buf, buf->bufsize);
+		ring->held_total--;
+		conn->held_head = (conn->held_head + 1) & (URING_BUFS - 1);
+		conn->held_count--;
+	}
+}
+
+/*
+ * Queues whatever the client needs next: its replies, another receive, or
+ * its removal once it is closing and nothing is outstanding.
+ */
+static void settle(struct uring *ring, struct uring_conn *conn) {
+	struct client *cli = conn->cli;
+
+	// everything acknowledged since the last settle goes out as one packet
+	send_ack_block(cli);
+
+	if (is_client_status(cli, CANCEL) || conn->closing) {
+		// say goodbye before shutting down
+		if (!conn->closing) {
+			if (cli->out_head != NULL && !conn->send_failed) {
+				if (!conn->send_inflight) {
+					arm_send(ring, conn);
+				}
+				return;
+			}
+
+			shutdown(cli->socket_fd, SHUT_RDWR);
+			if (conn->recv_armed && !conn->cancelling) {
+				cancel_recv(ring, conn);
+			}
+			conn->closing = 1;
+		}
+
+		// nothing may complete against the client once it is gone
+		if (conn->recv_armed || conn->send_inflight) {
+			return;
+		}
+
+		release_held(ring, conn);
+		if (conn->starved) {
+			ring->starved_count--;
+		}
+		if (ring->on_close != NULL) {
+			ring->on_close(ring, cli);
+		}
+		remove_client_index(find_client_index(ring->host, cli), ring->host);
+		free(conn);
+		return;
+	}
+
+	// room was made since the last delivery, or a pause was lifted
+	if (!cli->throttled) {
+		deliver(ring, conn);
+	}
+	send_ack_block(cli);
+
+	if (cli->out_head != NULL && !conn->send_inflight) {
+		arm_send(ring, conn);
+	}
+
+	if (!conn->recv_armed && !conn->starved && conn->held_count == 0 && !cli->throttled && !is_client_status(cli, CANCEL)) {
+		arm_recv(ring, conn);
+	}
+
+	// the client may have cancelled while delivering
+	if (is_client_status(cli, CANCEL)) {
+		mark_dirty(ring, conn);
+	}
+}
+
+static void complete_accept(struct uring *ring, struct io_uring_cqe *cqe) {
+	if (!(cqe->flags & IORING_CQE_F_MORE)) {
+		ring->accept_armed = 0;
+		if (ring->host->admitting && !ring->woken) {
+			arm_accept(ring);
+		}
+	}
+
+	if (cqe->res < 0) {
+		if (cqe->res != -ECANCELED) {
+			errno = -cqe->res;
+			DEBUG_PRINT("failed accept");
+		}
+		return;
+	}
+
+	// accepted before the pause took hold, turn it away before allocating
+	if (!server_has_room(ring->host)) {
+		send_refusal(cqe->res, REFUSE_FULL);
+		ring->host->refused++;
+		if (ring->host->metrics != NULL) {
+			metrics_add(&(ring->host->metrics->refused), 1);
+		}
+		if (ring->host->admitting) {
+			pause_accept(ring);
+		}
+		return;
+	}
+
+	struct uring_conn *conn = (struct uring_conn *) calloc(1, sizeof(struct uring_conn));
+	if (conn == NULL) {
+		DEBUG_PRINT("calloc, connection");
+		close(cqe->res);
+		return;
+	}
+
+	struct client *cli;
+	if (adopt_client(ring->host, cqe->res, ring->bufsize, &cli) < 0) {
+		DEBUG_PRINT("failed adopt");
+		free(conn);
+		return;
+	}
+	socklen_t len = sizeof(cli->address);
+	getpeername(cli->socket_fd, (struct sockaddr *) &(cli->address), &len);
+
+	// the table may have grown to take the client
+	if (ring->host->max_connections * 2 > ring->dirty_cap) {
+		struct uring_conn **dirty = (struct uring_conn **) realloc(ring->dirty, sizeof(struct uring_conn *) * ring->host->max_connections * 2);
+		if (dirty == NULL) {
+			DEBUG_PRINT("realloc, dirty list");
+			remove_client_index(find_client_index(ring->host, cli), ring->host);
+			free(conn);
+			return;
+		}
+		ring->dirty = dirty;
+		ring->dirty_cap = ring->host->max_connections * 2;
+	}
+
+	conn->cli = cli;
+	cli->engine = conn;
+	if (ring->on_accept != NULL) {
+		ring->on_accept(ring, cli);
+	}
+	mark_dirty(ring, conn);
+}
+
+static void complete_recv(struct uring *ring, struct uring_conn *conn, struct io_uring_cqe *cqe) {
+	if (!(cqe->flags & IORING_CQE_F_MORE)) {
+		conn->recv_armed = 0;
+		conn->cancelling = 0;
+	}
+	mark_dirty(ring, conn);
+
+	if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+		struct uring_hold *hold = conn->held + ((conn->held_head + conn->held_count) & (URING_BUFS - 1));
+		hold->bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		hold->offset = 0;
+		hold->len = cqe->res;
+		conn->held_count++;
+		ring->held_total++;
+		conn->cli->recv_ns = timer_now_ns();
+
+		if (!conn->closing) {
+			deliver(ring, conn);
+		}
+		return;
+	}
+
+	if (cqe->res == -ENOBUFS) {
+		// buffers were given back since the kernel ran out, settling receives again
+		if (ring->held_total < URING_BUFS) {
+			return;
+		}
+
+		// every buffer is held by a client, receive again once one is given back
+		DEBUG_PRINT("client %d out of receive buffers", conn->cli->socket_fd);
+		if (!conn->starved) {
+			conn->starved = 1;
+			ring->starved_count++;
+		}
+		return;
+	}
+
+	if (cqe->res == -ECANCELED) {
+		return;
+	}
+
+	// closed by the peer, or failed
+	conn->cli->inc_flag = CANCEL;
+	conn->cli->out_flag = CANCEL;
+}
+
+static void complete_send(struct uring *ring, struct uring_conn *conn, struct io_uring_cqe *cqe) {
+	conn->send_inflight = 0;
+	mark_dirty(ring, conn);
+
+	// the socket has room again, settling sends more of the file
+	if (conn->file_polled) {
+		conn->file_polled = 0;
+		if (cqe->res < 0 || (cqe->res & (POLLERR | POLLHUP))) {
+			conn->send_failed = 1;
+			conn->cli->inc_flag = CANCEL;
+			conn->cli->out_flag = CANCEL;
+		}
+		return;
+	}
+
+	if (cqe->res < 0) {
+		errno = -cqe->res;
+		DEBUG_PRINT("failed queue flush");
+		conn->send_failed = 1;
+		conn->cli->inc_flag = CANCEL;
+		conn->cli->out_flag = CANCEL;
+		return;
+	}
+
+	advance_queue(conn->cli, cqe->res);
+}
+
+/*
+ * Uring Management Functions
+ */
+
+int uring_supported(void) {
+	struct uring ring;
+	memset(&ring, 0, sizeof(ring));
+	ring.fd = -1;
+
+	int pair[2] = {-1, -1};
+	char data[16];
+	int supported = 0;
+
+	if (map_ring(&ring, 4, 8) < 0 || socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+		goto done;
+	}
+
+	// a single provided buffer is enough to see a multishot receive through
+	if (map_buf_ring(&ring, 1) < 0) {
+		goto done;
+	}
+	struct io_uring_buf *buf = &(ring.buf_ring->bufs[0]);
+	buf->addr = (__u64) (uintptr_t) data;
+	buf->len = sizeof(data);
+	buf->bid = 0;
+	__atomic_store_n(&(ring.buf_ring->tail), 1, __ATOMIC_RELEASE);
+
+	struct io_uring_sqe *sqe = get_sqe(&ring);
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = pair[0];
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BUF_GROUP;
+
+	if (write(pair[1], "x", 1) != 1 || submit(&ring, 1, 1000) < 0) {
+		goto done;
+	}
+
+	// older kernels refuse the multishot flag outright
+	unsigned head = *(ring.cq_head);
+	if (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+		supported = (ring.cqes[head & ring.cq_mask].res == 1);
+	}
+
+done:
+	if (pair[0] >= 0) {
+		close(pair[0]);
+		close(pair[1]);
+	}
+	if (ring.buf_ring != NULL) {
+		munmap(ring.buf_ring, ring.buf_ring_len);
+	}
+	unmap_ring(&ring);
+
+	DEBUG_PRINT("io_uring %s", supported ? "supported" : "unsupported");
+	return supported;
+}
+
+int init_uring_struct(struct uring **target, struct server *host, const int bufsize) {
+	// check valid arguments
+	if (target == NULL || host == NULL || host->server_fd < MIN_FD || bufsize < 1) {
+		return -EINVAL;
+	}
+
+	// allocate structure
+	struct uring *init = (struct uring *) calloc(1, sizeof(struct uring));
+	if (init == NULL) {
+		DEBUG_PRINT("calloc, structure");
+		return -ENOMEM;
+	}
+	init->fd = -1;
+	init->host = host;
+	init->bufsize = bufsize;
+
+	// every client can be settled and dirtied again in a single turn
+	init->dirty_cap = host->max_connections * 2;
+	init->dirty = (struct uring_conn **) calloc(init->dirty_cap, sizeof(struct uring_conn *));
+	if (init->dirty == NULL) {
+		DEBUG_PRINT("calloc, dirty list");
+		destroy_uring_struct(&init);
+		return -ENOMEM;
+	}
+
+	int ret = map_ring(init, URING_ENTRIES, URING_ENTRIES * 4);
+	if (ret < 0) {
+		destroy_uring_struct(&init);
+		return ret;
+	}
+
+	ret = map_buf_ring(init, URING_BUFS);
+	if (ret < 0) {
+		destroy_uring_struct(&init);
+		return ret;
+	}
+
+	// receive buffers come out of the server's pool
+	if (pool_add_class(host->pool, URING_BUF_LEN) < 0) {
+		DEBUG_PRINT("no slab class for receive buffers");
+	}
+	for (int bid = 0; bid < URING_BUFS; bid++) {
+		if (pool_alloc_buffer(host->pool, URING_BUF_LEN, init->bufs + bid) < 0) {
+			destroy_uring_struct(&init);
+			return -ENOMEM;
+		}
+		provide_buffer(init, bid, init->bufs[bid]->buf, init->bufs[bid]->bufsize);
+	}
+
+	ret = arm_accept(init);
+	if (ret < 0) {
+		destroy_uring_struct(&init);
+		return ret;
+	}
+
+	DEBUG_PRINT("io_uring with %d entries, %d receive buffers", init->sq_entries, URING_BUFS);
+
+	// set given pointer to new struct
+	*target = init;
+	return 0;
+}
+
+int destroy_uring_struct(struct uring **target) {
+	// check valid argument
+	if (target == NULL) {
+		return -EINVAL;
+	}
+
+	// struct already doesn't exist
+	if (*target == NULL) {
+		return 0;
+	}
+
+	// direct reference to structure
+	struct uring *old = *target;
+
+	// closing the ring ends every outstanding operation
+	unmap_ring(old);
+	if (old->buf_ring != NULL) {
+		munmap(old->buf_ring, old->buf_ring_len);
+	}
+
+	// remaining clients are destroyed with the server, their engine state is not
+	if (old->host != NULL) {
+		for (int i = 0; i < old->host->cur_connections; i++) {
+			struct client *cli = old->host->live[i];
+			if (cli->engine != NULL) {
+				free(cli->engine);
+				cli->engine = NULL;
+			}
+		}
+	}
+
+	// give receive buffers back to the pool
+	for (int bid = 0; bid < URING_BUFS; bid++) {
+		destroy_buffer_struct(old->bufs + bid);
+	}
+
+	// deallocate structure
+	free(old->dirty);
+	free(old);
+
+	// dereference holder
+	*target = NULL;
+	return 0;
+}
+
+int uring_watch_wake(struct uring *ring, const int fd) {
+	// check valid arguments
+	if (ring == NULL || fd < MIN_FD) {
+		return -EINVAL;
+	}
+
+	struct io_uring_sqe *sqe = get_sqe(ring);
+	if (sqe == NULL) {
+		return -EBUSY;
+	}
+
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (__u64) (uintptr_t) &(ring->wake_byte);
+	sqe->len = 1;
+	sqe->user_data = user_data_of(NULL, TAG_WAKE);
+	return 0;
+}
+
+int uring_watch_notify(struct uring *ring, const int fd) {
+	// check valid arguments
+	if (ring == NULL || fd < MIN_FD) {
+		return -EINVAL;
+	}
+
+	ring->notify_fd = fd;
+	return arm_notify(ring);
+}
+
+int uring_touch(struct uring *ring, struct client *cli) {
+	// check valid arguments
+	if (ring == NULL || cli == NULL || cli->engine == NULL) {
+		return -EINVAL;
+	}
+
+	mark_dirty(ring, (struct uring_conn *) cli->engine);
+	return 0;
+}
+
+int uring_run(struct uring *ring, const int timeout) {
+	// check valid argument
+	if (ring == NULL) {
+		return -EINVAL;
+	}
+	ring->turns++;
+
+	// enough clients left a full server
+	if (admission_can_resume(ring->host)) {
+		ring->host->admitting = 1;
+		if (!ring->accept_armed) {
+			arm_accept(ring);
+		}
+		DEBUG_PRINT("accepting resumed");
+	}
+
+	// queue what the last turn's clients need, settling can dirty more clients
+	int settled = ring->dirty_count;
+	for (int i = 0; i < settled; i++) {
+		struct uring_conn *conn = ring->dirty[i];
+		conn->dirty = 0;
+		settle(ring, conn);
+	}
+
+	// keep clients dirtied while settling for the next turn
+	ring->dirty_count -= settled;
+	memmove(ring->dirty, ring->dirty + settled, ring->dirty_count * sizeof(struct uring_conn *));
+
+	// submit and wait together, unless completions are already waiting
+	unsigned head = *(ring->cq_head);
+	int waiting = (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE));
+	int ret = submit(ring, (waiting || ring->dirty_count > 0) ? 0 : 1, timeout);
+	if (ret < 0) {
+		return ret;
+	}
+
+	// handle every completion
+	unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		struct io_uring_cqe *cqe = ring->cqes + (head & ring->cq_mask);
+		switch (cqe->user_data & TAG_MASK) {
+			case TAG_ACCEPT:
+				complete_accept(ring, cqe);
+				break;
+
+			case TAG_RECV:
+				complete_recv(ring, conn_of(cqe->user_data), cqe);
+				break;
+
+			case TAG_SEND:
+				complete_send(ring, conn_of(cqe->user_data), cqe);
+				break;
+
+			case TAG_WAKE:
+				ring->woken = 1;
+				break;
+
+			case TAG_NOTIFY:
+				// a multishot poll can end, keep it going
+				if (!(cqe->flags & IORING_CQE_F_MORE) && !ring->woken) {
+					arm_notify(ring);
+				}
+				if (cqe->res > 0 && ring->on_notify != NULL) {
+					ring->on_notify(ring);
+				}
+				break;
+
+			default:
+				break;
+		}
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+	return !ring->woken;
+}
@@ -0,0 +1,147 @@
+#ifndef __CHOPURING_H__
+#define __CHOPURING_H__
+
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+#include "chopconst.h"
+
+/*
+ * Uring Macros
+ */
+
+#define URING_ENTRIES 256 // submission queue entries, completions get four times as many
+#define URING_BUFS 256 // provided receive buffers, a power of two
+#define URING_BUF_LEN 4096 // bytes in every provided receive buffer
+#define URING_BUF_GROUP 0 // group the provided buffers are registered under
+#define URING_SEND_IOV 64 // queue entries gathered into a single send
+#define URING_HOLD_MAX 8 // received buffers a client may hold before its receive is cancelled
+
+/*
+ * Structures
+ */
+
+struct uring_hold {
+	int bid; // provided buffer the bytes are in
+	int offset; // bytes already moved into the client's ring
+	int len;
+};
+
+/*
+ * Engine state of a single client, reached through client->engine.
+ */
+struct uring_conn {
+	struct client *cli;
+	struct msghdr msg; // the send in flight, must outlive its submission
+	struct iovec iov[URING_SEND_IOV];
+	struct uring_hold held[URING_BUFS]; // received buffers the ring had no room for yet
+	int held_head;
+	int held_count;
+	int recv_armed; // a multishot receive is outstanding
+	int cancelling; // the outstanding receive was asked to stop
+	int send_inflight;
+	int send_failed;
+	int file_polled; // the send in flight waits on room for a file body
+	int starved; // the receive stopped for lack of provided buffers
+	int closing; // shut down, removed once nothing is outstanding
+	int dirty; // on the list to be settled before the next submission
+};
+
+struct uring {
+	int fd;
+	int ext_arg; // waits can carry a timeout
+
+	// submission queue
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned sq_mask;
+	unsigned *sq_array;
+	unsigned sq_entries;
+	struct io_uring_sqe *sqes;
+	unsigned to_submit; // entries prepared since the last enter
+
+	// completion queue
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *ring_mem;
+	size_t ring_len;
+	size_t sqes_len;
+
+	// provided receive buffers, taken from the server's pool
+	struct io_uring_buf_ring *buf_ring;
+	size_t buf_ring_len;
+	struct buffer *bufs[URING_BUFS];
+	unsigned short buf_tail;
+	int starved_count; // clients waiting for buffers to be given back
+	int held_total; // provided buffers held by clients, not yet given back
+
+	// connections
+	struct server *host;
+	int bufsize; // window given to accepted clients
+	struct uring_conn **dirty; // clients to settle before the next submission
+	int dirty_count;
+	int dirty_cap;
+	int accept_armed; // a multishot accept is outstanding
+	char wake_byte;
+	int woken;
+	int notify_fd; // polled for on_notify
+	void (*on_accept)(struct uring *ring, struct client *cli);
+	void (*on_close)(struct uring *ring, struct client *cli);
+	void (*on_notify)(struct uring *ring); // notify_fd became readable
+	void *owner; // pointer handed to the callbacks through the ring
+
+	long enters; // io_uring_enter calls
+	long turns; // calls to uring_run
+};
+
+/*
+ * Uring Management Functions
+ */
+
+/*
+ * Checks that the kernel takes multishot receives into provided buffer rings,
+ * the newest feature the engine relies on. Returns 1 if so, 0 otherwise.
+ */
+int uring_supported(void);
+
+/*
+ * Sets up a ring serving the given server's clients: a multishot accept on its
+ * listening socket, and a ring of provided receive buffers from its pool.
+ */
+int init_uring_struct(struct uring **target, struct server *host, const int bufsize);
+
+/*
+ * Must be destroyed before the server, whose pool holds the receive buffers.
+ */
+int destroy_uring_struct(struct uring **target);
+
+/*
+ * Stops uring_run once the given descriptor becomes readable.
+ */
+int uring_watch_wake(struct uring *ring, const int fd);
+
+/*
+ * Calls on_notify every time the given descriptor becomes readable, which is
+ * left to on_notify to drain.
+ */
+int uring_watch_notify(struct uring *ring, const int fd);
+
+/*
+ * Settles the client on the next turn, for when packets were queued for it or
+ * it was cancelled outside of its own completions.
+ */
+int uring_touch(struct uring *ring, struct client *cli);
+
+/*
+ * Runs one loop turn: queues sends and receives for every client touched by
+ * the last turn, submits them and waits for completions with a single
+ * io_uring_enter, then handles every completion. The timeout is in
+ * milliseconds, -1 waits indefinitely. Returns 0 once woken, 1 otherwise, or
+ * negative on error.
+ */
+int uring_run(struct uring *ring, const int timeout);
+
+#endif